@@ -10,6 +10,12 @@
 #include "errno.h"
 #include <pwd.h>
 #include <time.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <stddef.h>
+#include <stdint.h>
 
 extern int errno;
 
@@ -46,6 +52,20 @@ extern int errno;
 
 #define CONFIG_DISK_SZ  (4 * 1024 * 1024)
 #define CONFIG_BLOCK_SZ (512)
+#define CONFIG_IOV_MAX  (1024)                      /* 单次向量IO最多的iov个数 */
+#define CONFIG_QDEPTH_MAX (64)                      /* 异步IO最大队列深度 */
+#define CONFIG_QDEPTH_DEF (8)                       /* 异步IO默认队列深度 */
+#define CONFIG_READ_LAT   (2)                       /* 2ms */
+#define CONFIG_WRITE_LAT  (1)                       /* 1ms */
+#define CONFIG_SEEK_LAT   (4)                       /* 4.17ms per 360 degree */
+
+/* 内核头文件缺少io_uring时只使用线程池引擎 */
+#if defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define CONFIG_HAVE_IO_URING
+#endif
+#endif
 /******************************************************************************
 * SECTION: Macro Functions 
 *******************************************************************************/
@@ -53,20 +73,17 @@ extern int errno;
 #define IS_ADDR_ALIGN(addr)     (addr % CONFIG_BLOCK_SZ == 0)
 #define ADDR_ROUND_UP(addr)     ((addr / CONFIG_BLOCK_SZ) * CONFIG_BLOCK_SZ)
 
-#define INC_READCNT(disk)       (disk.read_cnt++)
-#define INC_WRITECNT(disk)      (disk.write_cnt++)
-#define INC_SEEKCNT(disk)       (disk.seek_cnt++)
+/* 统计可能被多个线程同时更新 */
+#define STAT_ADD(field, v)      (__atomic_fetch_add(&dstats.field, (v), __ATOMIC_RELAXED))
+#define STAT_WORDS              ((sizeof(struct ddriver_stats) - offsetof(struct ddriver_stats, read_cnt)) / sizeof(uint64_t))
 
-#define RW_DELAY(disk, rw_ops)  (usleep(disk.rw_ops##_lat * 1000))
+#define RW_DELAY(disk, rw_ops)  do { if (disk.rw_ops##_lat) usleep(disk.rw_ops##_lat * 1000); } while (0)
 /******************************************************************************
 * SECTION: Type definitions
 *******************************************************************************/
 struct ddriver
 {
     int  ddriver_fd;                                 /* Disk ddriver_fd */
-    int  read_cnt;
-    int  write_cnt;
-    int  seek_cnt;
     int  read_lat;
     int  write_lat;
     int  seek_lat;
@@ -74,22 +91,95 @@ struct ddriver
     int  major_num;
     int  layout_size;
     int  iounit_size;
+    char *map;                                      /* mmap后端: 整个磁盘文件的映射，NULL表示文件后端 */
+    off_t pos;                                      /* mmap后端: 磁盘头位置 */
+    off_t last_pos;                                 /* 上一个请求结束的位置，定位IO据此模拟寻道 */
+};
+enum ddriver_aio_engine
+{
+    AIO_ENGINE_NONE,
+    AIO_ENGINE_URING,                               /* io_uring下发，完成后按截止时间交付 */
+    AIO_ENGINE_THREAD                               /* 线程池，每个工作线程同步执行一个请求 */
+};
+
+#ifdef CONFIG_HAVE_IO_URING
+struct ddriver_uring
+{
+    int                 ring_fd;
+    unsigned            to_submit;                  /* 已填入SQ但内核尚未接收的请求数 */
+    unsigned            *sq_tail;
+    unsigned            *sq_mask;
+    unsigned            *sq_array;
+    unsigned            *cq_head;
+    unsigned            *cq_tail;
+    unsigned            *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void                *sq_ptr;
+    void                *cq_ptr;
+    size_t              sq_sz;
+    size_t              cq_sz;
+    size_t              sqes_sz;
+};
+#endif
+
+struct ddriver_aio
+{
+    int                 fd;
+    int                 engine;
+    int                 flags;                      /* 打开驱动时的DDRIVER_OPEN_* */
+    int                 qdepth;                     /* 同时在途的请求数上限 */
+    int                 outstanding;                /* 已提交、尚未被调用者收割 */
+    int                 inflight;                   /* 已下发、尚未完成，占用队列深度 */
+    int                 in_kernel;                  /* io_uring: 已下发、尚未收到CQE */
+    int                 reaping;                    /* io_uring: 有线程阻塞在io_uring_enter */
+    int                 nworkers;
+    int                 stop;
+    struct ddriver_req  *pending_head;              /* 超出队列深度，等待下发 */
+    struct ddriver_req  *pending_tail;
+    struct ddriver_req  *done_head;                 /* 已完成，等待收割 */
+    struct ddriver_req  *done_tail;
+    struct ddriver_req  *landed;                    /* io_uring: 已收到CQE，模拟延迟未到 */
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    pthread_t           workers[CONFIG_QDEPTH_MAX];
+#ifdef CONFIG_HAVE_IO_URING
+    struct ddriver_uring ring;
+#endif
 };
 /******************************************************************************
 * SECTION: Global Variable
 *******************************************************************************/
 /* reference: https://en.wikipedia.org/wiki/Hard_disk_drive_performance_characteristics */
 struct ddriver disk = {
-    .read_cnt    = 0,
-    .write_cnt   = 0,
-    .seek_cnt    = 0,
-    .read_lat    = 2,       /* 2ms */       
-    .write_lat   = 1,       /* 1ms */
-    .seek_lat    = 4,       /* 4.17ms per 360 degree */
+    .read_lat    = CONFIG_READ_LAT,
+    .write_lat   = CONFIG_WRITE_LAT,
+    .seek_lat    = CONFIG_SEEK_LAT,
     .major_num   = 0,
     .track_num   = 100,
     .layout_size = CONFIG_DISK_SZ,
-    .iounit_size = CONFIG_BLOCK_SZ
+    .iounit_size = CONFIG_BLOCK_SZ,
+    .map         = NULL,
+    .pos         = 0,
+    .last_pos    = 0
+};
+
+/* 统计计数，与IOC_REQ_DEVICE_STATS返回的结构相同 */
+struct ddriver_stats dstats = {
+    .version     = DDRIVER_STATS_VERSION,
+    .size        = sizeof(struct ddriver_stats)
+};
+/* 未注册区域时整个磁盘为一个区域 */
+struct ddriver_regions dregions = {
+    .nr          = 1,
+    .start       = { 0 }
+};
+
+struct ddriver_aio aio = {
+    .fd          = -1,
+    .engine      = AIO_ENGINE_NONE,
+    .qdepth      = CONFIG_QDEPTH_DEF,
+    .lock        = PTHREAD_MUTEX_INITIALIZER
 };
 
 FILE *debugf = NULL;
@@ -104,27 +194,637 @@ int check_valid(size_t size) {
     return 0;
 }
 
-int emulate_rotate(int fd, off_t start, off_t end) {
+int check_valid_multi(size_t size) {
+    if (size == 0 || size % CONFIG_BLOCK_SZ != 0){
+        user_alert("io size %ld should be multiple of %d", size, CONFIG_BLOCK_SZ);
+        return -EIO;
+    }
+    return 0;
+}
+
+int check_valid_vec(const struct iovec *iov, int iovcnt, size_t *total) {
+    int i;
+    *total = 0;
+    if (iovcnt <= 0 || iovcnt > CONFIG_IOV_MAX) {
+        user_alert("iovcnt %d out of range", iovcnt);
+        return -EINVAL;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len % CONFIG_BLOCK_SZ != 0) {
+            user_alert("iov[%d] size %ld should be multiple of %d", i, iov[i].iov_len, CONFIG_BLOCK_SZ);
+            return -EIO;
+        }
+        *total += iov[i].iov_len;
+    }
+    return *total == 0 ? -EIO : 0;
+}
+
+/**
+ * @brief 从start寻道到end的旋转延迟(us)
+ */
+static long rotate_lat(off_t start, off_t end) {
     int bytes_per_track = disk.layout_size / disk.track_num;
     int lat_per_track = disk.seek_lat;
     int distance = abs(end - start) % bytes_per_track; 
     
-    if (distance == 0) {
+    return (long)distance * lat_per_track / bytes_per_track * 1000;
+}
+
+/**
+ * @brief log2分桶: 0号桶为0，第i个桶为[2^(i-1), 2^i)，超出的计入最后一个桶
+ */
+static int log2_bucket(uint64_t v, int nr) {
+    int b = v ? 64 - __builtin_clzll(v) : 0;
+    return b < nr ? b : nr - 1;
+}
+/**
+ * @brief 记一次寻道: 次数、距离分布与模拟延迟(us)
+ */
+static void stat_seek(off_t from, off_t to, long lat) {
+    uint64_t dist = from > to ? from - to : to - from;
+
+    STAT_ADD(seek_cnt, 1);
+    STAT_ADD(seek_lat_us, lat);
+    STAT_ADD(seek_lat_hist[log2_bucket(lat, DDRIVER_LAT_BUCKETS)], 1);
+    STAT_ADD(seek_dist_hist[log2_bucket(dist, DDRIVER_SEEK_BUCKETS)], 1);
+}
+/**
+ * @brief 记一次读/写: 次数、字节数、模拟延迟(us)，并按区域拆分字节数
+ */
+static void stat_rw(int is_write, off_t pos, size_t bytes, long lat) {
+    off_t start, end, lo, hi;
+    int i;
+
+    if (is_write) {
+        STAT_ADD(write_cnt, 1);
+        STAT_ADD(write_bytes, bytes);
+        STAT_ADD(write_lat_us, lat);
+        STAT_ADD(write_lat_hist[log2_bucket(lat, DDRIVER_LAT_BUCKETS)], 1);
+    }
+    else {
+        STAT_ADD(read_cnt, 1);
+        STAT_ADD(read_bytes, bytes);
+        STAT_ADD(read_lat_us, lat);
+        STAT_ADD(read_lat_hist[log2_bucket(lat, DDRIVER_LAT_BUCKETS)], 1);
+    }
+    for (i = 0; i < dregions.nr; i++) {
+        start = dregions.start[i];
+        end   = i + 1 < dregions.nr ? dregions.start[i + 1] : disk.layout_size;
+        lo    = pos > start ? pos : start;
+        hi    = pos + (off_t)bytes < end ? pos + (off_t)bytes : end;
+        if (lo >= hi) {
+            continue;
+        }
+        if (is_write) {
+            STAT_ADD(region_write_cnt[i], 1);
+            STAT_ADD(region_write_bytes[i], hi - lo);
+        }
+        else {
+            STAT_ADD(region_read_cnt[i], 1);
+            STAT_ADD(region_read_bytes[i], hi - lo);
+        }
+    }
+}
+/**
+ * @brief 只清零统计，不改变磁盘内容
+ */
+static void stat_reset(void) {
+    uint64_t *words = &dstats.read_cnt;
+    size_t i;
+
+    for (i = 0; i < STAT_WORDS; i++) {
+        __atomic_store_n(&words[i], 0, __ATOMIC_RELAXED);
+    }
+}
+/**
+ * @brief 拷贝统计快照，只拷贝调用者结构能容纳的部分，便于新旧版本共存
+ */
+static int stat_copy(struct ddriver_stats *out) {
+    struct ddriver_stats snap;
+    uint64_t *src = &dstats.read_cnt;
+    uint64_t *dst = &snap.read_cnt;
+    uint32_t size = out->size;
+    size_t i;
+
+    if (size < offsetof(struct ddriver_stats, read_cnt)) {
+        return -EINVAL;
+    }
+    for (i = 0; i < STAT_WORDS; i++) {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+    if (size > sizeof(struct ddriver_stats)) {
+        size = sizeof(struct ddriver_stats);
+    }
+    snap.version = DDRIVER_STATS_VERSION;
+    snap.size    = size;
+    memcpy(out, &snap, size);
+    return 0;
+}
+
+int emulate_rotate(int fd, off_t start, off_t end) {
+    long lat = rotate_lat(start, end);
+    
+    if (lat == 0) {
         return 0;
     }
 
-    usleep(distance * lat_per_track / bytes_per_track * 1000);
+    usleep(lat);
     return 0;
 }
+/**
+ * @brief 当前磁盘头位置
+ */
+static off_t disk_tell(int fd) {
+    return disk.map ? disk.pos : lseek(fd, 0, SEEK_CUR);
+}
+/**
+ * @brief 移动磁盘头，mmap后端只记录位置，不产生系统调用
+ */
+static off_t disk_lseek(int fd, off_t offset, int whence) {
+    off_t pos;
+    if (disk.map == NULL) {
+        return lseek(fd, offset, whence);
+    }
+    switch (whence)
+    {
+    case SEEK_SET: pos = offset; break;
+    case SEEK_CUR: pos = disk.pos + offset; break;
+    case SEEK_END: pos = disk.layout_size + offset; break;
+    default: errno = EINVAL; return -1;
+    }
+    if (pos < 0 || pos > disk.layout_size) {
+        errno = EINVAL;
+        return -1;
+    }
+    disk.pos = pos;
+    return pos;
+}
+/**
+ * @brief 记录请求结束位置，供定位IO判断是否需要寻道
+ */
+static void disk_mark_pos(off_t end) {
+    __atomic_store_n(&disk.last_pos, end, __ATOMIC_RELAXED);
+}
+/**
+ * @brief 在pos处分散读/聚集写，文件后端为preadv/pwritev，mmap后端为memcpy
+ * 要么传输完整个请求，要么返回-1；请求不得越过磁盘末尾，避免撑大后备文件
+ */
+static ssize_t disk_rw(int fd, const struct iovec *iov, int iovcnt, off_t pos, int is_write) {
+    ssize_t total = 0, done, ret;
+    size_t  skip, len;
+    int i;
+
+    for (i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    if (pos < 0 || pos + total > disk.layout_size) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (disk.map) {
+        for (i = 0, done = 0; i < iovcnt; done += iov[i].iov_len, i++) {
+            if (is_write) {
+                memcpy(disk.map + pos + done, iov[i].iov_base, iov[i].iov_len);
+            }
+            else {
+                memcpy(iov[i].iov_base, disk.map + pos + done, iov[i].iov_len);
+            }
+        }
+        return total;
+    }
+
+    do {
+        done = is_write ? pwritev(fd, iov, iovcnt, pos) : preadv(fd, iov, iovcnt, pos);
+    } while (done < 0 && errno == EINTR);
+    if (done < 0) {
+        return -1;
+    }
+    /* 短传输: 从中断处逐段补完 */
+    for (i = 0, skip = done; i < iovcnt && done < total; i++, skip = 0) {
+        if (skip >= iov[i].iov_len) {
+            skip -= iov[i].iov_len;
+            continue;
+        }
+        while (skip < iov[i].iov_len) {
+            len = iov[i].iov_len - skip;
+            ret = is_write ? pwrite(fd, (char *)iov[i].iov_base + skip, len, pos + done)
+                           : pread(fd, (char *)iov[i].iov_base + skip, len, pos + done);
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ret <= 0) {
+                if (ret == 0) {
+                    errno = EIO;
+                }
+                return -1;
+            }
+            skip += ret;
+            done += ret;
+        }
+    }
+    return done;
+}
+/**
+ * @brief 定位IO: 不读写共享的磁盘头位置，多线程可并发调用
+ * 寻道按上一个请求的结束位置模拟，与本请求起点不连续时计一次寻道
+ */
+static int disk_prw(int fd, const struct iovec *iov, int iovcnt, off_t offset, int is_write) {
+    size_t  total;
+    off_t   prev;
+    ssize_t ret;
+    long    lat;
+    int res = check_valid_vec(iov, iovcnt, &total);
+    if (res < 0)
+        return res;
+    if (offset < 0 || !IS_ADDR_ALIGN(offset)) {
+        user_alert("offset %ld must be aligned to block size %d", 
+                      offset, CONFIG_BLOCK_SZ);
+        return -EINVAL;
+    }
+    if (offset + (off_t)total > disk.layout_size) {
+        user_alert("io [%ld, %ld) exceeds disk size %d", 
+                      offset, offset + (long)total, disk.layout_size);
+        return -EINVAL;
+    }
+
+    prev = __atomic_exchange_n(&disk.last_pos, offset + total, __ATOMIC_RELAXED);
+    if (prev != offset) {
+        stat_seek(prev, offset, rotate_lat(prev, offset));
+        emulate_rotate(fd, prev, offset);
+    }
+
+    if (is_write) {
+        RW_DELAY(disk, write);
+    }
+    else {
+        RW_DELAY(disk, read);
+    }
+    ret = disk_rw(fd, iov, iovcnt, offset, is_write);
+    if (ret < 0) {
+        user_panic("%s error: %s", is_write ? "pwrite" : "pread", strerror(errno));
+        return -errno;
+    }
+
+    lat = (is_write ? disk.write_lat : disk.read_lat) * 1000L;
+    stat_rw(is_write, offset, total, lat);
+    return total;
+}
+/******************************************************************************
+* SECTION: Async IO
+* 请求先进入pending队列，在途请求数不超过队列深度时下发：
+*   io_uring: 下发时按寻道距离与读写延迟算出截止时间，CQE到达且截止时间已过才交付，
+*             在途请求的延迟相互重叠
+*   线程池:   每个工作线程同步执行一个请求(含延迟模拟)，线程数即队列深度
+* 下发时机与交付都在aio.lock保护下进行
+*******************************************************************************/
+static long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static void aio_push(struct ddriver_req **head, struct ddriver_req **tail, struct ddriver_req *req) {
+    req->next = NULL;
+    if (*tail) {
+        (*tail)->next = req;
+    }
+    else {
+        *head = req;
+    }
+    *tail = req;
+}
+
+static struct ddriver_req *aio_pop(struct ddriver_req **head, struct ddriver_req **tail) {
+    struct ddriver_req *req = *head;
+    if (req) {
+        *head = req->next;
+        if (*head == NULL) {
+            *tail = NULL;
+        }
+        req->next = NULL;
+    }
+    return req;
+}
+/**
+ * @brief 请求离开队列: 交给调用者收割，唤醒等待者
+ */
+static void aio_complete(struct ddriver_req *req) {
+    aio.inflight--;
+    aio_push(&aio.done_head, &aio.done_tail, req);
+    pthread_cond_broadcast(&aio.cond);
+}
+/**
+ * @brief 线程池工作线程，编号不小于队列深度的线程保持空闲
+ */
+static void *aio_worker(void *arg) {
+    long id = (long)arg;
+    struct ddriver_req *req;
+
+    pthread_mutex_lock(&aio.lock);
+    while (!aio.stop) {
+        if (id >= aio.qdepth || aio.pending_head == NULL) {
+            pthread_cond_wait(&aio.cond, &aio.lock);
+            continue;
+        }
+        req = aio_pop(&aio.pending_head, &aio.pending_tail);
+        aio.inflight++;
+        pthread_mutex_unlock(&aio.lock);
+
+        req->res = disk_prw(aio.fd, req->vec ? req->vec : &req->iov, req->vec ? req->nvec : 1,
+                            req->offset, req->op == DDRIVER_OP_WRITE);
+
+        pthread_mutex_lock(&aio.lock);
+        aio_complete(req);
+    }
+    pthread_mutex_unlock(&aio.lock);
+    return NULL;
+}
+
+#ifdef CONFIG_HAVE_IO_URING
+static void uring_teardown(struct ddriver_uring *r) {
+    if (r->sqes && r->sqes != MAP_FAILED)
+        munmap(r->sqes, r->sqes_sz);
+    if (r->cq_ptr && r->cq_ptr != MAP_FAILED)
+        munmap(r->cq_ptr, r->cq_sz);
+    if (r->sq_ptr && r->sq_ptr != MAP_FAILED)
+        munmap(r->sq_ptr, r->sq_sz);
+    if (r->ring_fd > 0)
+        close(r->ring_fd);
+    memset(r, 0, sizeof(struct ddriver_uring));
+}
+
+static int uring_setup(struct ddriver_uring *r, unsigned entries) {
+    struct io_uring_params p;
+
+    memset(r, 0, sizeof(struct ddriver_uring));
+    memset(&p, 0, sizeof(p));
+    r->ring_fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->ring_fd < 0) {
+        r->ring_fd = 0;
+        return -1;
+    }
+    r->sq_sz   = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_sz   = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sq_ptr  = mmap(NULL, r->sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      r->ring_fd, IORING_OFF_SQ_RING);
+    r->cq_ptr  = mmap(NULL, r->cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      r->ring_fd, IORING_OFF_CQ_RING);
+    r->sqes    = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      r->ring_fd, IORING_OFF_SQES);
+    if (r->sq_ptr == MAP_FAILED || r->cq_ptr == MAP_FAILED || r->sqes == MAP_FAILED) {
+        uring_teardown(r);
+        return -1;
+    }
+    r->sq_tail  = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+    r->sq_mask  = (unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+    r->cq_head  = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+    r->cq_tail  = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+    r->cq_mask  = (unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes     = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+    return 0;
+}
+/**
+ * @brief 按请求模型计数，返回该请求的模拟延迟(us)
+ */
+static long uring_req_lat(struct ddriver_req *req) {
+    off_t prev = __atomic_exchange_n(&disk.last_pos, req->offset + req->size, __ATOMIC_RELAXED);
+    long lat = 0;
+
+    long rw_lat = (req->op == DDRIVER_OP_WRITE ? disk.write_lat : disk.read_lat) * 1000L;
+
+    if (prev != req->offset) {
+        lat = rotate_lat(prev, req->offset);
+        stat_seek(prev, req->offset, lat);
+    }
+    stat_rw(req->op == DDRIVER_OP_WRITE, req->offset, req->size, rw_lat);
+    return lat + rw_lat;
+}
+
+static void uring_prep(struct ddriver_uring *r, struct ddriver_req *req) {
+    unsigned tail = *r->sq_tail;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode    = req->op == DDRIVER_OP_WRITE ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd        = aio.fd;
+    sqe->addr      = (unsigned long)(req->vec ? req->vec : &req->iov);
+    sqe->len       = req->vec ? req->nvec : 1;
+    sqe->off       = req->offset;
+    sqe->user_data = (unsigned long)req;
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->to_submit++;
+}
+
+static int uring_enter(struct ddriver_uring *r, unsigned to_submit, unsigned min_complete) {
+    return syscall(__NR_io_uring_enter, r->ring_fd, to_submit, min_complete,
+                   min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+/**
+ * @brief 收取CQE，放入landed等待截止时间
+ */
+static void uring_reap(struct ddriver_uring *r) {
+    unsigned head = *r->cq_head;
+    struct io_uring_cqe *cqe;
+    struct ddriver_req *req;
+
+    while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        cqe = &r->cqes[head & *r->cq_mask];
+        req = (struct ddriver_req *)(unsigned long)cqe->user_data;
+        req->res = cqe->res;
+        req->next = aio.landed;
+        aio.landed = req;
+        aio.in_kernel--;
+        head++;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+/**
+ * @brief 交付截止时间已到的请求
+ * 
+ * @return long 仍未到期的最早截止时间，没有则为0
+ */
+static long uring_deliver(long now) {
+    struct ddriver_req **pprev = &aio.landed;
+    struct ddriver_req *req;
+    long earliest = 0;
+
+    while ((req = *pprev) != NULL) {
+        if (req->deadline <= now) {
+            *pprev = req->next;
+            aio_complete(req);
+            continue;
+        }
+        if (earliest == 0 || req->deadline < earliest) {
+            earliest = req->deadline;
+        }
+        pprev = &req->next;
+    }
+    return earliest;
+}
+#endif
+/**
+ * @brief 选择引擎: mmap后端或io_uring不可用时使用线程池
+ */
+static void aio_init_engine(void) {
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&aio.cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    aio.engine = AIO_ENGINE_THREAD;
+#ifdef CONFIG_HAVE_IO_URING
+    if (disk.map == NULL && !(aio.flags & DDRIVER_OPEN_NOURING) &&
+        uring_setup(&aio.ring, CONFIG_QDEPTH_MAX) == 0) {
+        aio.engine = AIO_ENGINE_URING;
+    }
+#endif
+}
+/**
+ * @brief 在队列深度允许的范围内下发pending中的请求
+ */
+static void aio_kick(void) {
+#ifdef CONFIG_HAVE_IO_URING
+    struct ddriver_req *req;
+    long now;
+    int ret;
+
+    if (aio.engine == AIO_ENGINE_URING) {
+        now = now_us();
+        while (aio.pending_head && aio.inflight < aio.qdepth) {
+            req = aio_pop(&aio.pending_head, &aio.pending_tail);
+            req->deadline = now + uring_req_lat(req);
+            uring_prep(&aio.ring, req);
+            aio.inflight++;
+            aio.in_kernel++;
+        }
+        if (aio.ring.to_submit > 0) {
+            ret = uring_enter(&aio.ring, aio.ring.to_submit, 0);
+            if (ret > 0) {
+                aio.ring.to_submit -= ret;
+            }
+        }
+        return;
+    }
+#endif
+    while (aio.nworkers < aio.qdepth) {
+        if (pthread_create(&aio.workers[aio.nworkers], NULL, aio_worker,
+                           (void *)(long)aio.nworkers) != 0) {
+            break;
+        }
+        aio.nworkers++;
+    }
+    pthread_cond_broadcast(&aio.cond);
+}
+/**
+ * @brief 停止异步引擎，未收割的请求被丢弃
+ */
+static void aio_shutdown(void) {
+    int i;
+
+    if (aio.engine == AIO_ENGINE_NONE) {
+        return;
+    }
+    pthread_mutex_lock(&aio.lock);
+    aio.stop = 1;
+    pthread_cond_broadcast(&aio.cond);
+    pthread_mutex_unlock(&aio.lock);
+    for (i = 0; i < aio.nworkers; i++) {
+        pthread_join(aio.workers[i], NULL);
+    }
+#ifdef CONFIG_HAVE_IO_URING
+    if (aio.engine == AIO_ENGINE_URING) {
+        uring_teardown(&aio.ring);
+    }
+#endif
+    pthread_cond_destroy(&aio.cond);
+    aio.engine = AIO_ENGINE_NONE;
+    aio.nworkers = 0;
+    aio.stop = 0;
+    aio.outstanding = 0;
+    aio.inflight = 0;
+    aio.in_kernel = 0;
+    aio.reaping = 0;
+    aio.pending_head = aio.pending_tail = NULL;
+    aio.done_head = aio.done_tail = NULL;
+    aio.landed = NULL;
+}
+/**
+ * @brief 取出已完成的请求，并推进引擎
+ * 
+ * @param block 没有足够完成时是否阻塞
+ */
+static int aio_collect(struct ddriver_req **done, int min_nr, int max_nr, int block) {
+    struct timespec ts;
+    int n = 0;
+#ifdef CONFIG_HAVE_IO_URING
+    long earliest = 0;
+#endif
+
+    if (aio.engine == AIO_ENGINE_NONE) {
+        return 0;
+    }
+    pthread_mutex_lock(&aio.lock);
+    for (;;) {
+#ifdef CONFIG_HAVE_IO_URING
+        if (aio.engine == AIO_ENGINE_URING) {
+            uring_reap(&aio.ring);
+            earliest = uring_deliver(now_us());
+            aio_kick();
+        }
+#endif
+        while (n < max_nr && aio.done_head) {
+            done[n++] = aio_pop(&aio.done_head, &aio.done_tail);
+            aio.outstanding--;
+        }
+        if (!block || n >= min_nr || n >= max_nr || aio.outstanding == 0) {
+            break;
+        }
+#ifdef CONFIG_HAVE_IO_URING
+        if (aio.engine == AIO_ENGINE_URING && earliest == 0 && aio.ring.to_submit > 0) {
+            earliest = now_us() + 1000;             /* SQ暂时提交失败，稍后重试 */
+        }
+        if (aio.engine == AIO_ENGINE_URING && earliest == 0 && aio.in_kernel > 0 && !aio.reaping) {
+            /* 只有一个线程阻塞在内核里，其余线程等待它的广播 */
+            aio.reaping = 1;
+            pthread_mutex_unlock(&aio.lock);
+            uring_enter(&aio.ring, 0, 1);
+            pthread_mutex_lock(&aio.lock);
+            aio.reaping = 0;
+            pthread_cond_broadcast(&aio.cond);
+            continue;
+        }
+        if (aio.engine == AIO_ENGINE_URING && earliest != 0) {
+            ts.tv_sec  = earliest / 1000000L;
+            ts.tv_nsec = earliest % 1000000L * 1000;
+            pthread_cond_timedwait(&aio.cond, &aio.lock, &ts);
+            continue;
+        }
+#endif
+        IGNORE_ARG(ts);
+        pthread_cond_wait(&aio.cond, &aio.lock);
+    }
+    pthread_mutex_unlock(&aio.lock);
+    return n;
+}
 /******************************************************************************
 * SECTION: Global Function Implementation
 *******************************************************************************/
 /**
  * @brief 打开驱动
  * 
+ * @param path 
+ * @param flags DDRIVER_OPEN_MMAP: 映射整个磁盘文件，读写变为memcpy
+ *              DDRIVER_OPEN_NOLAT: 关闭延迟模拟
+ *              DDRIVER_OPEN_NOURING: 异步IO不使用io_uring，总是使用线程池
  * @return int 文件描述符
  */
-int ddriver_open(char *path) {
+int ddriver_open_ex(char *path, int flags) {
     int fd, ret = 0;
     char device_path[128] = {0};
     char log_path[128] = {0};
@@ -153,6 +853,24 @@ int ddriver_open(char *path) {
         return ret;
     }
 
+    disk.map = NULL;
+    disk.pos = 0;
+    if (flags & DDRIVER_OPEN_MMAP) {
+        disk.map = mmap(NULL, CONFIG_DISK_SZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (disk.map == MAP_FAILED) {
+            user_panic("can't mmap device: %s", strerror(errno));
+            disk.map = NULL;
+            close(fd);
+            return -1;
+        }
+    }
+    aio.fd = fd;
+    aio.flags = flags;
+    /* 延迟设置只对本次打开有效，每次打开都重新设置 */
+    disk.read_lat  = (flags & DDRIVER_OPEN_NOLAT) ? 0 : CONFIG_READ_LAT;
+    disk.write_lat = (flags & DDRIVER_OPEN_NOLAT) ? 0 : CONFIG_WRITE_LAT;
+    disk.seek_lat  = (flags & DDRIVER_OPEN_NOLAT) ? 0 : CONFIG_SEEK_LAT;
+
     debugf = fopen(log_path, "w+");
     if (debugf == NULL) {
         user_panic("can't init log: %s", log_path);
@@ -161,6 +879,14 @@ int ddriver_open(char *path) {
 
     return fd;
 }
+/**
+ * @brief 打开驱动，使用文件后端并模拟磁盘延迟
+ * 
+ * @return int 文件描述符
+ */
+int ddriver_open(char *path) {
+    return ddriver_open_ex(path, 0);
+}
 /**
  * @brief 关闭驱动
  * 
@@ -168,6 +894,13 @@ int ddriver_open(char *path) {
  * @return int 
  */
 int ddriver_close(int fd) {
+    aio_shutdown();
+    aio.fd = -1;
+    if (disk.map) {
+        msync(disk.map, CONFIG_DISK_SZ, MS_SYNC);
+        munmap(disk.map, CONFIG_DISK_SZ);
+        disk.map = NULL;
+    }
     return close(fd) && fclose(debugf);
 }
 /**
@@ -188,13 +921,13 @@ int ddriver_seek(int fd, off_t offset, int whence){
         return -EINVAL;
     }
 
-    INC_SEEKCNT(disk);
-    cur = lseek(fd, 0, SEEK_CUR);
-    ret = lseek(fd, offset, whence);
+    cur = disk_tell(fd);
+    ret = disk_lseek(fd, offset, whence);
     if (ret < 0) {
         user_panic("seek error: %s", strerror(errno));
         return ret;
     }
+    stat_seek(cur, ret, rotate_lat(cur, ret));
     emulate_rotate(fd, cur, ret);
     return ret;
 }
@@ -207,14 +940,22 @@ int ddriver_seek(int fd, off_t offset, int whence){
  * @return int 
  */
 int ddriver_write(int fd, char *buf, size_t size){
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    off_t cur;
     int res = check_valid(size);
     if(res < 0)
         return res;
         
     RW_DELAY(disk, write);
-    write(fd, buf, size);
+    cur = disk_tell(fd);
+    if (disk_rw(fd, &iov, 1, cur, 1) < 0) {
+        user_panic("write error: %s", strerror(errno));
+        return -errno;
+    }
+    disk_lseek(fd, cur + size, SEEK_SET);
+    disk_mark_pos(cur + size);
 
-    INC_WRITECNT(disk);
+    stat_rw(1, cur, size, disk.write_lat * 1000L);
     return CONFIG_BLOCK_SZ;
 }
 /**
@@ -226,16 +967,244 @@ int ddriver_write(int fd, char *buf, size_t size){
  * @return int 
  */
 int ddriver_read(int fd, char *buf, size_t size){
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    off_t cur;
     int res = check_valid(size);
     if(res < 0)
         return res;
 
     RW_DELAY(disk, read);
-    read(fd, buf, size);
+    cur = disk_tell(fd);
+    if (disk_rw(fd, &iov, 1, cur, 0) < 0) {
+        user_panic("read error: %s", strerror(errno));
+        return -errno;
+    }
+    disk_lseek(fd, cur + size, SEEK_SET);
+    disk_mark_pos(cur + size);
 
-    INC_READCNT(disk);
+    stat_rw(0, cur, size, disk.read_lat * 1000L);
     return CONFIG_BLOCK_SZ;
 }
+/**
+ * @brief 从当前磁盘头位置起分散读(scatter)，每个iov长度须为IO单元整数倍
+ * 整个请求只计一次读延迟
+ * 
+ * @param fd 
+ * @param iov 
+ * @param iovcnt 
+ * @return int 读出的字节数，失败返回负数
+ */
+int ddriver_readv(int fd, const struct iovec *iov, int iovcnt){
+    size_t  total;
+    off_t   cur;
+    ssize_t ret;
+    int res = check_valid_vec(iov, iovcnt, &total);
+    if(res < 0)
+        return res;
+
+    RW_DELAY(disk, read);
+    cur = disk_tell(fd);
+    ret = disk_rw(fd, iov, iovcnt, cur, 0);
+    if (ret < 0) {
+        user_panic("readv error: %s", strerror(errno));
+        return -errno;
+    }
+    disk_lseek(fd, cur + total, SEEK_SET);
+    disk_mark_pos(cur + total);
+
+    stat_rw(0, cur, total, disk.read_lat * 1000L);
+    return total;
+}
+/**
+ * @brief 从当前磁盘头位置起聚集写(gather)，每个iov长度须为IO单元整数倍
+ * 整个请求只计一次写延迟
+ * 
+ * @param fd 
+ * @param iov 
+ * @param iovcnt 
+ * @return int 写入的字节数，失败返回负数
+ */
+int ddriver_writev(int fd, const struct iovec *iov, int iovcnt){
+    size_t  total;
+    off_t   cur;
+    ssize_t ret;
+    int res = check_valid_vec(iov, iovcnt, &total);
+    if(res < 0)
+        return res;
+
+    RW_DELAY(disk, write);
+    cur = disk_tell(fd);
+    ret = disk_rw(fd, iov, iovcnt, cur, 1);
+    if (ret < 0) {
+        user_panic("writev error: %s", strerror(errno));
+        return -errno;
+    }
+    disk_lseek(fd, cur + total, SEEK_SET);
+    disk_mark_pos(cur + total);
+
+    stat_rw(1, cur, total, disk.write_lat * 1000L);
+    return total;
+}
+/**
+ * @brief 连续读出多个IO单元
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size IO单元的整数倍
+ * @return int 
+ */
+int ddriver_read_units(int fd, char *buf, size_t size){
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    int res = check_valid_multi(size);
+    if(res < 0)
+        return res;
+    return ddriver_readv(fd, &iov, 1);
+}
+/**
+ * @brief 连续写入多个IO单元
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size IO单元的整数倍
+ * @return int 
+ */
+int ddriver_write_units(int fd, char *buf, size_t size){
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    int res = check_valid_multi(size);
+    if(res < 0)
+        return res;
+    return ddriver_writev(fd, &iov, 1);
+}
+/**
+ * @brief 从offset处读出，不改变磁盘头位置，可多线程并发调用
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size IO单元的整数倍
+ * @param offset IO单元对齐
+ * @return int 读出的字节数，失败返回负数
+ */
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset){
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    int res = check_valid_multi(size);
+    if(res < 0)
+        return res;
+    return disk_prw(fd, &iov, 1, offset, 0);
+}
+/**
+ * @brief 写入offset处，不改变磁盘头位置，可多线程并发调用
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size IO单元的整数倍
+ * @param offset IO单元对齐
+ * @return int 写入的字节数，失败返回负数
+ */
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset){
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    int res = check_valid_multi(size);
+    if(res < 0)
+        return res;
+    return disk_prw(fd, &iov, 1, offset, 1);
+}
+/**
+ * @brief 从offset处分散读，整个请求只计一次读延迟
+ * 
+ * @param fd 
+ * @param iov 
+ * @param iovcnt 
+ * @param offset IO单元对齐
+ * @return int 读出的字节数，失败返回负数
+ */
+int ddriver_preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset){
+    return disk_prw(fd, iov, iovcnt, offset, 0);
+}
+/**
+ * @brief 向offset处聚集写，整个请求只计一次写延迟
+ * 
+ * @param fd 
+ * @param iov 
+ * @param iovcnt 
+ * @param offset IO单元对齐
+ * @return int 写入的字节数，失败返回负数
+ */
+int ddriver_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset){
+    return disk_prw(fd, iov, iovcnt, offset, 1);
+}
+/**
+ * @brief 异步提交一批请求，超出队列深度的请求排队等待下发
+ * 请求在被ddriver_poll/ddriver_wait收割前不能释放或修改，
+ * 设置了vec的请求分散读/聚集写到各段，size被填为各段总长
+ * 
+ * @param fd 
+ * @param reqs 
+ * @param nr 
+ * @return int 提交的请求数，参数非法时返回负数且不提交任何请求
+ */
+int ddriver_submit(int fd, struct ddriver_req **reqs, int nr){
+    int i;
+
+    if (fd != aio.fd) {
+        return -EBADF;
+    }
+    for (i = 0; i < nr; i++) {
+        if (reqs[i]->vec != NULL &&
+            check_valid_vec(reqs[i]->vec, reqs[i]->nvec, &reqs[i]->size) < 0) {
+            return -EINVAL;
+        }
+        if (check_valid_multi(reqs[i]->size) < 0 || reqs[i]->offset < 0 ||
+            !IS_ADDR_ALIGN(reqs[i]->offset) ||
+            reqs[i]->offset + (off_t)reqs[i]->size > disk.layout_size) {
+            user_alert("invalid async request %d: offset %ld, size %ld",
+                       i, reqs[i]->offset, reqs[i]->size);
+            return -EINVAL;
+        }
+    }
+
+    pthread_mutex_lock(&aio.lock);
+    if (aio.engine == AIO_ENGINE_NONE) {
+        aio_init_engine();
+    }
+    for (i = 0; i < nr; i++) {
+        reqs[i]->res = 0;
+        reqs[i]->iov.iov_base = reqs[i]->buf;
+        reqs[i]->iov.iov_len = reqs[i]->size;
+        aio_push(&aio.pending_head, &aio.pending_tail, reqs[i]);
+    }
+    aio.outstanding += nr;
+    aio_kick();
+    pthread_mutex_unlock(&aio.lock);
+    return nr;
+}
+/**
+ * @brief 收割已完成的请求，不阻塞
+ * 
+ * @param fd 
+ * @param done 
+ * @param max_nr 
+ * @return int 收割的请求数
+ */
+int ddriver_poll(int fd, struct ddriver_req **done, int max_nr){
+    if (fd != aio.fd) {
+        return -EBADF;
+    }
+    return aio_collect(done, 0, max_nr, 0);
+}
+/**
+ * @brief 收割已完成的请求，至少min_nr个(或所有未收割的请求)完成前阻塞
+ * 
+ * @param fd 
+ * @param done 
+ * @param min_nr 
+ * @param max_nr 
+ * @return int 收割的请求数
+ */
+int ddriver_wait(int fd, struct ddriver_req **done, int min_nr, int max_nr){
+    if (fd != aio.fd) {
+        return -EBADF;
+    }
+    return aio_collect(done, min_nr, max_nr, 1);
+}
 /**
  * @brief 
  * 
@@ -252,26 +1221,62 @@ int ddriver_ioctl(int fd, unsigned long cmd, void *arg){
         memcpy(arg, &disk.layout_size, sizeof(int));
         break;
     case IOC_REQ_DEVICE_STATE:                        /* Device State */
-        state.read_cnt = disk.read_cnt;
-        state.write_cnt = disk.write_cnt;
-        state.seek_cnt = disk.seek_cnt;
+        state.read_cnt = (int)__atomic_load_n(&dstats.read_cnt, __ATOMIC_RELAXED);
+        state.write_cnt = (int)__atomic_load_n(&dstats.write_cnt, __ATOMIC_RELAXED);
+        state.seek_cnt = (int)__atomic_load_n(&dstats.seek_cnt, __ATOMIC_RELAXED);
         memcpy(arg, &state, sizeof(struct ddriver_state));
         break;
     case IOC_REQ_DEVICE_RESET:                        /* Reset Device */
-        lseek(fd, 0, SEEK_SET);
-        char buf[4096] = {'\0'};
-        for (size_t i = 0; i < CONFIG_DISK_SZ; i += 4096)
-        {
-            write(fd, buf, 4096);
+        if (disk.map) {
+            memset(disk.map, 0, CONFIG_DISK_SZ);
+            disk.pos = 0;
+        }
+        else {
+            lseek(fd, 0, SEEK_SET);
+            char buf[4096] = {'\0'};
+            for (size_t i = 0; i < CONFIG_DISK_SZ; i += 4096)
+            {
+                write(fd, buf, 4096);
+            }
+            lseek(fd, 0, SEEK_SET);
         }
-        lseek(fd, 0, SEEK_SET);
-        disk.read_cnt = 0;
-        disk.write_cnt = 0;
-        disk.seek_cnt = 0;
+        stat_reset();
+        disk_mark_pos(0);
         break;
     case IOC_REQ_DEVICE_IO_SZ:
         memcpy(arg, &disk.iounit_size, sizeof(int));
         break;
+    case IOC_REQ_DEVICE_FLUSH:                        /* Flush to backing file */
+        if (disk.map) {
+            return msync(disk.map, CONFIG_DISK_SZ, MS_SYNC);
+        }
+        return fsync(fd);
+    case IOC_REQ_DEVICE_STATS:                        /* Extended statistics */
+        return stat_copy((struct ddriver_stats *)arg);
+    case IOC_REQ_DEVICE_STATS_RESET:                  /* Reset statistics only */
+        stat_reset();
+        break;
+    case IOC_REQ_DEVICE_REGIONS:                      /* Regions for per-region stats */
+        if (((struct ddriver_regions *)arg)->nr < 1 ||
+            ((struct ddriver_regions *)arg)->nr > DDRIVER_REGION_MAX) {
+            return -EINVAL;
+        }
+        memcpy(&dregions, arg, sizeof(struct ddriver_regions));
+        break;
+    case IOC_REQ_DEVICE_QDEPTH:                       /* Async queue depth */
+        pthread_mutex_lock(&aio.lock);
+        aio.qdepth = *(int *)arg;
+        if (aio.qdepth < 1) {
+            aio.qdepth = 1;
+        }
+        if (aio.qdepth > CONFIG_QDEPTH_MAX) {
+            aio.qdepth = CONFIG_QDEPTH_MAX;
+        }
+        if (aio.engine != AIO_ENGINE_NONE) {
+            aio_kick();
+        }
+        pthread_mutex_unlock(&aio.lock);
+        break;
     default:
         break;
     }
@@ -2,6 +2,9 @@
 #define _DDRIVER_CTL_H_
 
 #include <sys/ioctl.h>   
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stdint.h>
 /******************************************************************************
 * SECTION: IO ctl protocol definitions
 *******************************************************************************/
@@ -14,8 +17,69 @@ struct ddriver_state
     int seek_cnt;
 };
 
+#define DDRIVER_STATS_VERSION   1
+#define DDRIVER_LAT_BUCKETS     24          /* 延迟(us)的log2分桶: 0号桶为0，第i个桶为[2^(i-1), 2^i) */
+#define DDRIVER_SEEK_BUCKETS    24          /* 寻道距离(字节)的log2分桶，分法同上 */
+#define DDRIVER_REGION_MAX      8
+
+struct ddriver_regions
+{
+    int      nr;                            /* 区域数，1 ~ DDRIVER_REGION_MAX */
+    off_t    start[DDRIVER_REGION_MAX];     /* 第i个区域为[start[i], start[i+1])，须递增 */
+};
+
+struct ddriver_stats
+{
+    uint32_t version;                       /* 调用者填DDRIVER_STATS_VERSION，返回驱动的版本 */
+    uint32_t size;                          /* 调用者填结构大小，返回实际拷贝的字节数 */
+    uint64_t read_cnt;
+    uint64_t write_cnt;
+    uint64_t seek_cnt;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    uint64_t read_lat_us;                   /* 累计模拟延迟 */
+    uint64_t write_lat_us;
+    uint64_t seek_lat_us;
+    uint64_t read_lat_hist[DDRIVER_LAT_BUCKETS];
+    uint64_t write_lat_hist[DDRIVER_LAT_BUCKETS];
+    uint64_t seek_lat_hist[DDRIVER_LAT_BUCKETS];
+    uint64_t seek_dist_hist[DDRIVER_SEEK_BUCKETS];
+    uint64_t region_read_cnt[DDRIVER_REGION_MAX];
+    uint64_t region_write_cnt[DDRIVER_REGION_MAX];
+    uint64_t region_read_bytes[DDRIVER_REGION_MAX];
+    uint64_t region_write_bytes[DDRIVER_REGION_MAX];
+};
+
 #define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)
 #define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)
 #define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)
 #define IOC_REQ_DEVICE_IO_SZ    _IOR(IOC_MAGIC, 3, int)
+#define IOC_REQ_DEVICE_FLUSH    _IO(IOC_MAGIC, 4)
+#define IOC_REQ_DEVICE_QDEPTH   _IOW(IOC_MAGIC, 5, int)
+#define IOC_REQ_DEVICE_STATS    _IOWR(IOC_MAGIC, 6, struct ddriver_stats)
+#define IOC_REQ_DEVICE_STATS_RESET _IO(IOC_MAGIC, 7)
+#define IOC_REQ_DEVICE_REGIONS  _IOW(IOC_MAGIC, 8, struct ddriver_regions)
+
+#define DDRIVER_OPEN_MMAP       0x1
+#define DDRIVER_OPEN_NOLAT      0x2
+#define DDRIVER_OPEN_NOURING    0x4
+
+#define DDRIVER_OP_READ         0
+#define DDRIVER_OP_WRITE        1
+
+struct ddriver_req
+{
+    int     op;                 /* DDRIVER_OP_READ / DDRIVER_OP_WRITE */
+    char    *buf;
+    size_t  size;               /* IO单元的整数倍 */
+    off_t   offset;             /* IO单元对齐 */
+    int     res;                /* 完成后: 传输的字节数，失败为负errno */
+    void    *priv;              /* 调用者私有数据 */
+    const struct iovec *vec;    /* 非NULL时按vec分散读/聚集写，忽略buf，size由驱动填为总长 */
+    int     nvec;
+    /* 以下由驱动内部使用 */
+    struct ddriver_req *next;
+    long    deadline;
+    struct iovec iov;
+};
 #endif
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include "ddriver_ctl_user.h"
 #include "stdio.h"
+#include <sys/uio.h>
 
 /**
  * @brief 打开ddriver设备
@@ -12,6 +13,16 @@
  */
 int ddriver_open(char *path);
 
+/**
+ * @brief 以指定后端打开ddriver设备
+ * 
+ * @param path ddriver设备路径
+ * @param flags DDRIVER_OPEN_MMAP: 映射整个磁盘文件，读写变为memcpy，刷盘使用msync
+ *              DDRIVER_OPEN_NOLAT: 关闭读写与寻道的延迟模拟
+ * @return int 0成功，否则失败
+ */
+int ddriver_open_ex(char *path, int flags);
+
 /**
  * @brief 移动ddriver磁盘头
  * 
@@ -42,6 +53,122 @@ int ddriver_write(int fd, char *buf, size_t size);
  */
 int ddriver_read(int fd, char *buf, size_t size);
 
+/**
+ * @brief 从当前磁盘头位置起分散读，整个请求只计一次读延迟
+ * 
+ * @param fd ddriver设备handler
+ * @param iov 读出的Buf数组，每个Buf大小须为设备IO单位的整数倍
+ * @param iovcnt Buf个数
+ * @return int 读出的字节数，失败返回负数
+ */
+int ddriver_readv(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief 从当前磁盘头位置起聚集写，整个请求只计一次写延迟
+ * 
+ * @param fd ddriver设备handler
+ * @param iov 要写入的Buf数组，每个Buf大小须为设备IO单位的整数倍
+ * @param iovcnt Buf个数
+ * @return int 写入的字节数，失败返回负数
+ */
+int ddriver_writev(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief 连续读出多个IO单位
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要读出的数据Buf
+ * @param size 要读出的数据大小，须为设备IO单位的整数倍
+ * @return int 读出的字节数，失败返回负数
+ */
+int ddriver_read_units(int fd, char *buf, size_t size);
+
+/**
+ * @brief 连续写入多个IO单位
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要写入的数据Buf
+ * @param size 要写入的数据大小，须为设备IO单位的整数倍
+ * @return int 写入的字节数，失败返回负数
+ */
+int ddriver_write_units(int fd, char *buf, size_t size);
+
+/**
+ * @brief 从指定位置读出，不依赖也不改变ddriver的磁盘头位置，可多线程并发调用
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要读出的数据Buf
+ * @param size 要读出的数据大小，须为设备IO单位的整数倍
+ * @param offset 读出位置，须按设备IO单位对齐
+ * @return int 读出的字节数，失败返回负数
+ */
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset);
+
+/**
+ * @brief 写入指定位置，不依赖也不改变ddriver的磁盘头位置，可多线程并发调用
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要写入的数据Buf
+ * @param size 要写入的数据大小，须为设备IO单位的整数倍
+ * @param offset 写入位置，须按设备IO单位对齐
+ * @return int 写入的字节数，失败返回负数
+ */
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset);
+
+/**
+ * @brief 从指定位置分散读(scatter)，整个请求只计一次读延迟
+ * 
+ * @param fd ddriver设备handler
+ * @param iov 读出缓冲区数组，每个长度须为设备IO单位的整数倍
+ * @param iovcnt iov个数
+ * @param offset 读出位置，须按设备IO单位对齐
+ * @return int 读出的字节数，失败返回负数
+ */
+int ddriver_preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+
+/**
+ * @brief 向指定位置聚集写(gather)，整个请求只计一次写延迟
+ * 
+ * @param fd ddriver设备handler
+ * @param iov 写入缓冲区数组，每个长度须为设备IO单位的整数倍
+ * @param iovcnt iov个数
+ * @param offset 写入位置，须按设备IO单位对齐
+ * @return int 写入的字节数，失败返回负数
+ */
+int ddriver_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+
+/**
+ * @brief 异步提交一批请求，在途请求数受队列深度(IOC_REQ_DEVICE_QDEPTH)限制，
+ * 在途请求的模拟延迟相互重叠。请求被收割前不能释放或修改
+ * 
+ * @param fd ddriver设备handler
+ * @param reqs 请求数组
+ * @param nr 请求个数
+ * @return int 提交的请求数，参数非法时返回负数且不提交任何请求
+ */
+int ddriver_submit(int fd, struct ddriver_req **reqs, int nr);
+
+/**
+ * @brief 收割已完成的异步请求，不阻塞
+ * 
+ * @param fd ddriver设备handler
+ * @param done 存放已完成的请求
+ * @param max_nr 最多收割的个数
+ * @return int 收割的请求数，结果见各请求的res
+ */
+int ddriver_poll(int fd, struct ddriver_req **done, int max_nr);
+
+/**
+ * @brief 收割已完成的异步请求，至少min_nr个(或所有未收割的请求)完成前阻塞
+ * 
+ * @param fd ddriver设备handler
+ * @param done 存放已完成的请求
+ * @param min_nr 至少收割的个数
+ * @param max_nr 最多收割的个数
+ * @return int 收割的请求数，结果见各请求的res
+ */
+int ddriver_wait(int fd, struct ddriver_req **done, int min_nr, int max_nr);
+
 /**
  * @brief ddriver IO控制
  * 
@@ -13,6 +13,7 @@
 #include "errno.h"
 #include "types.h"
 #include "stdint.h"
+#include <pthread.h>
 
 #define NEWFS_MAGIC           0x52415453         /* TODO: Define by yourself */
 #define NEWFS_DEFAULT_PERM    0777   /* 全权限打开 */
@@ -37,27 +38,165 @@ int   			   newfs_rmdir(const char *);
 int   			   newfs_rename(const char *, const char *);
 int   			   newfs_utimens(const char *, const struct timespec tv[2]);
 int   			   newfs_truncate(const char *, off_t);
+int   			   newfs_statfs(const char *, struct statvfs *);
 			
 int   			   newfs_open(const char *, struct fuse_file_info *);
 int   			   newfs_opendir(const char *, struct fuse_file_info *);
+int   			   newfs_release(const char *, struct fuse_file_info *);
+int   			   newfs_flush(const char *, struct fuse_file_info *);
+int   			   newfs_fsync(const char *, int, struct fuse_file_info *);
+int   			   newfs_fsyncdir(const char *, int, struct fuse_file_info *);
 /******************************************************************************
 * SECTION: newfs_utils.c
 *******************************************************************************/
 
-char* 			   nfs_get_fname(const char* path);
-int 			   nfs_calc_lvl(const char * path);
+void 			   nfs_path_iter_init(struct nfs_path_iter *it, const char *path);
+boolean 		   nfs_path_next(struct nfs_path_iter *it);
+boolean 		   nfs_path_is_last(const struct nfs_path_iter *it);
+int 			   nfs_dev_read(int offset, uint8_t *out_content, int size);
+int 			   nfs_dev_write(int offset, uint8_t *in_content, int size);
 int 			   nfs_driver_read(int offset, uint8_t *out_content, int size);
+int 			   nfs_driver_readv(int offset, const struct iovec *iov, int iovcnt);
 int 			   nfs_driver_write(int offset, uint8_t *in_content, int size);
+int 			   nfs_driver_writev(int offset, const struct iovec *iov, int iovcnt);
+int 			   nfs_driver_flush(int offset, int size);
 int 			   nfs_mount(struct custom_options options);
 int 			   nfs_umount();
+struct nfs_dentry* new_dentry_len(const char *fname, int len, NFS_FILE_TYPE ftype);
+struct nfs_dentry* new_dentry(const char *fname, NFS_FILE_TYPE ftype);
+void 			   free_dentry(struct nfs_dentry *dentry);
+int 			   nfs_alloc_data_blk();
 int 			   nfs_alloc_dentry(struct nfs_inode * inode, struct nfs_dentry * dentry);
+int 			   nfs_drop_dentry(struct nfs_inode * inode, struct nfs_dentry * dentry);
 struct nfs_inode*  nfs_alloc_inode(struct nfs_dentry * dentry);
+int 			   nfs_inline_load(struct nfs_inode * inode);
+int 			   nfs_inline_promote(struct nfs_inode * inode);
 int 			   nfs_sync_inode(struct nfs_inode * inode);
+int 			   nfs_sync_dirty();
+int 			   nfs_sync_super();
+int 			   nfs_fsync_inode(struct nfs_inode * inode);
+void 			   nfs_mark_inode_dirty(struct nfs_inode * inode, int flags);
+void 			   nfs_mark_data_dirty(struct nfs_inode * inode, int blk);
+void 			   nfs_clear_inode_dirty(struct nfs_inode * inode);
+int 			   nfs_drop_inode(struct nfs_inode * inode);
 struct nfs_inode*  nfs_read_inode(struct nfs_dentry * dentry, int ino);
 struct nfs_dentry* nfs_get_dentry(struct nfs_inode * inode, int dir);
 struct nfs_dentry* nfs_lookup(const char * path, boolean * is_find, boolean* is_root);
+int 			   nfs_resolve(const char *path, struct nfs_nameidata *nd);
 
 
+void 				nfs_register_regions();
+void 				nfs_dump_dev_stats();
 void 				nfs_dump_map();
 void 				nfs_print_map();
+/******************************************************************************
+* SECTION: newfs_cache.c
+*******************************************************************************/
+int 			   nfs_cache_init(int capacity);
+boolean 		   nfs_cache_enabled();
+boolean 		   nfs_cache_peek(int blk, uint8_t *out_content);
+int 			   nfs_cache_read(int offset, uint8_t *out_content, int size);
+int 			   nfs_cache_write(int offset, uint8_t *in_content, int size);
+int 			   nfs_cache_sync();
+int 			   nfs_cache_sync_blk(int blk);
+void 			   nfs_cache_destroy();
+void 			   nfs_cache_dump();
+void 			   nfs_cache_stat(uint64_t *hits, uint64_t *misses, uint64_t *evictions);
+/******************************************************************************
+* SECTION: newfs_ioq.c
+*******************************************************************************/
+int 			   nfs_ioq_init(int depth);
+boolean 		   nfs_ioq_plugged();
+void 			   nfs_ioq_plug();
+int 			   nfs_ioq_unplug();
+uint8_t* 		   nfs_ioq_lookup(int blk);
+int 			   nfs_ioq_add(int blk, uint8_t *data);
+int 			   nfs_ioq_write(int offset, uint8_t *in_content, int size);
+void 			   nfs_ioq_refresh(int offset, const uint8_t *in_content, int size);
+void 			   nfs_ioq_overlay(int offset, uint8_t *out_content, int size);
+int 			   nfs_ioq_dispatch();
+void 			   nfs_ioq_destroy();
+void 			   nfs_ioq_dump();
+/******************************************************************************
+* SECTION: newfs_dir.c
+*******************************************************************************/
+struct nfs_dentry* nfs_dir_find(struct nfs_inode *inode, const char *name, int len);
+void 			   nfs_dir_hash_insert(struct nfs_inode *inode, struct nfs_dentry *dentry);
+void 			   nfs_dir_hash_remove(struct nfs_inode *inode, struct nfs_dentry *dentry);
+void 			   nfs_dir_hash_free(struct nfs_inode *inode);
+int 			   nfs_dir_blks(struct nfs_inode *inode);
+int 			   nfs_dir_read(struct nfs_inode *inode, int dir_cnt);
+int 			   nfs_dir_write(struct nfs_inode *inode);
+/******************************************************************************
+* SECTION: newfs_bitmap.c
+*******************************************************************************/
+void 			   nfs_bitmap_init(struct nfs_bitmap *bm, uint8_t *map, int nbits, int nfree);
+int 			   nfs_bitmap_alloc(struct nfs_bitmap *bm);
+int 			   nfs_bitmap_alloc_near(struct nfs_bitmap *bm, int goal);
+int 			   nfs_bitmap_alloc_run(struct nfs_bitmap *bm, int goal, int want, int *got);
+void 			   nfs_bitmap_set(struct nfs_bitmap *bm, int idx);
+void 			   nfs_bitmap_free(struct nfs_bitmap *bm, int idx);
+boolean 		   nfs_bitmap_test(struct nfs_bitmap *bm, int idx);
+/******************************************************************************
+* SECTION: newfs_dcache.c
+*******************************************************************************/
+int 			   nfs_dcache_init(int capacity);
+boolean 		   nfs_dcache_lookup(const char *path, struct nfs_nameidata *nd);
+void 			   nfs_dcache_insert(const char *path, const struct nfs_nameidata *nd);
+void 			   nfs_dcache_invalidate(const char *path);
+void 			   nfs_dcache_destroy();
+void 			   nfs_dcache_dump();
+/******************************************************************************
+* SECTION: newfs_slab.c
+*******************************************************************************/
+void 			   nfs_slab_init();
+void* 			   nfs_slab_alloc(int type);
+void* 			   nfs_slab_zalloc(int type);
+void 			   nfs_slab_free(int type, void *obj);
+void 			   nfs_slab_destroy();
+void 			   nfs_slab_stat(int type, uint64_t *in_use, uint64_t *peak, uint64_t *chunks);
+void 			   nfs_slab_dump();
+/******************************************************************************
+* SECTION: newfs_ra.c
+*******************************************************************************/
+void 			   nfs_ra_init(struct nfs_file *file);
+int 			   nfs_file_load(struct nfs_file *file, struct nfs_inode *inode, int blk_start, int blk_end);
+int 			   nfs_ra_read(struct nfs_file *file, struct nfs_inode *inode, int offset, int size);
+void 			   nfs_ra_drain(struct nfs_inode *inode);
+void 			   nfs_ra_dump();
+/******************************************************************************
+* SECTION: newfs_bmap.c
+*******************************************************************************/
+void 			   nfs_bmap_init(struct nfs_inode *inode, int ind_blk, int dind_blk, int blocks);
+int 			   nfs_file_reserve(struct nfs_inode *inode, int nblks);
+int 			   nfs_bmap(struct nfs_inode *inode, int lblk, boolean alloc);
+int 			   nfs_file_bmap(struct nfs_file *file, struct nfs_inode *inode, int lblk, boolean alloc);
+int 			   nfs_bmap_sync(struct nfs_inode *inode);
+int 			   nfs_bmap_truncate(struct nfs_inode *inode, int nblks);
+void 			   nfs_bmap_release(struct nfs_inode *inode);
+void 			   nfs_bmap_release_all(struct nfs_dentry *dentry);
+void 			   nfs_bmap_dump();
+/******************************************************************************
+* SECTION: newfs_extent.c
+*******************************************************************************/
+void 			   nfs_ext_init(struct nfs_inode *inode);
+int 			   nfs_ext_read(struct nfs_inode *inode, struct nfs_inode_d *inode_d);
+void 			   nfs_ext_fill(struct nfs_inode *inode, struct nfs_inode_d *inode_d);
+int 			   nfs_ext_map(struct nfs_file *file, struct nfs_inode *inode, int lblk, boolean alloc);
+int 			   nfs_ext_truncate(struct nfs_inode *inode, int nblks);
+int 			   nfs_ext_sync(struct nfs_inode *inode);
+void 			   nfs_ext_release(struct nfs_inode *inode);
+void 			   nfs_ext_rsv_drop(struct nfs_inode *inode);
+void 			   nfs_ext_rsv_hide(boolean hide);
+int 			   nfs_ext_rsv_count();
+void 			   nfs_ext_dump();
+/******************************************************************************
+* SECTION: newfs_itable.c
+*******************************************************************************/
+void 			   nfs_itable_init();
+uint8_t* 		   nfs_itable_get(int ino, boolean dirty);
+int 			   nfs_itable_flush();
+void 			   nfs_itable_load(const uint8_t *slot, struct nfs_inode_d *inode_d);
+void 			   nfs_itable_store(uint8_t *slot, const struct nfs_inode_d *inode_d);
+void 			   nfs_itable_dump();
 #endif  /* _newfs_H_ */
\ No newline at end of file
@@ -24,6 +24,9 @@ typedef enum nfs_file_type {
 #define UINT8_BITS              8
 
 #define NFS_MAGIC_NUM           0x52415453  
+#define NFS_SUPER_F_COUNTERS    0x1        /* nfs_super_d中的空闲计数有效 */
+#define NFS_SUPER_F_GEOMETRY    0x2        /* nfs_super_d中的max_ino/max_data有效 */
+#define NFS_SUPER_F_ISIZE       0x4        /* nfs_super_d中的inode_size有效，否则每个inode占一块 */
 #define NFS_SUPER_OFS           0
 #define NFS_ROOT_INO            0
 
@@ -37,6 +40,8 @@ typedef enum nfs_file_type {
 #define NFS_ERROR_UNSUPPORTED   ENXIO
 #define NFS_ERROR_IO            EIO     /* Error Input/Output */
 #define NFS_ERROR_INVAL         EINVAL  /* Invalid Args */
+#define NFS_ERROR_NOTDIR        ENOTDIR
+#define NFS_ERROR_NAMETOOLONG   ENAMETOOLONG
 
 #define NFS_MAX_FILE_NAME       128
 #define NFS_INODE_PER_FILE      1
@@ -50,11 +55,52 @@ typedef enum nfs_file_type {
 #define NFS_FLAG_BUF_OCCUPY     0x2
 
 #define NFS_BLOCK_SIZE                   1024        /* Logical Block Size in bytes */
-#define MAX_INO                          585
+#define MAX_INO                          585         /* 旧镜像(无NFS_SUPER_F_GEOMETRY)的固定布局 */
 #define MAX_DATA                         3508
 #define NFS_SUPER_BLKS                   1
 #define NFS_MAP_INODE_BLKS               1
 #define NFS_MAP_DATA_BLKS                1
+#define NFS_BYTES_PER_INODE              4096        /* 格式化时每多少字节设备容量配一个inode */
+#define NFS_INODE_SIZE                   256         /* 新格式的磁盘inode大小，一个inode表块存放多个 */
+#define NFS_BITS_PER_BLK                 (NFS_BLOCK_SIZE * UINT8_BITS)   /* 一个位图块可管理的对象数 */
+
+#define NFS_CACHE_DEFAULT_BLKS           128         /* 块缓存默认容量(块数)，0表示关闭缓存 */
+#define NFS_IOQ_DEPTH                    256         /* 刷写队列最多暂存的块数 */
+
+#define NFS_REGION_SUPER                 0           /* 向驱动登记的统计区域 */
+#define NFS_REGION_MAP                   1
+#define NFS_REGION_INODE                 2
+#define NFS_REGION_DATA                  3
+#define NFS_REGION_NR                    4
+#define NFS_RA_MIN_BLKS                  2           /* 检测到顺序读后的初始预读窗口(块数) */
+#define NFS_RA_MAX_BLKS                  32          /* 预读窗口上限(块数) */
+#define NFS_RA_ASYNC_REQS                4           /* 同时在途的异步预读请求数 */
+#define NFS_RA_INFLIGHT                  2           /* data_ra取值: 该块的异步预读尚未完成 */
+#define NFS_DIR_HASH_MIN                 8           /* 目录索引的初始桶数，须为2的幂 */
+
+#define NFS_INODE_DIRTY                  0x1         /* inode本身(大小、块指针等)需要写回 */
+#define NFS_INODE_DIRTY_DENTRY           0x2         /* 目录项需要写回 */
+#define NFS_INODE_DIRTY_DATA             0x4         /* 有数据块需要写回，见data_dirty */
+#define NFS_INODE_DIRTY_NEW              0x8         /* 新建后从未写回，磁盘上的inode槽无效 */
+#define NFS_BM_DIRTY_BLKS                64          /* 位图按块记录脏标记，最后一位代表其后所有块 */
+#define NFS_INODE_F_INLINE               0x1         /* 文件数据存放在inode槽内，不占数据块 */
+#define NFS_INODE_F_BMAP                 0x2         /* nfs_inode_d中的间接块与块数有效，旧镜像为0 */
+#define NFS_INODE_F_EXTENTS              0x4         /* 数据块由extent映射，不用块指针与间接块 */
+#define NFS_EXT_IN_INODE                 2           /* inode中直接存放的extent数，其余存入extent块 */
+#define NFS_EXT_RSV_SLOTS                16          /* 同时持有预留窗口的文件数 */
+#define NFS_EXT_RSV_MIN                  8           /* 第一个预留窗口的块数，之后每次翻倍 */
+#define NFS_EXT_RSV_MAX                  64          /* 预留窗口上限(块数) */
+#define NFS_WB_MAX_BLKS                  32          /* 写回时合并为一次写的最大块数 */
+#define NFS_DCACHE_ENTRIES               512         /* 路径缓存项数 */
+#define NFS_DCACHE_PATH_MAX              256         /* 更长的路径不缓存 */
+
+#define NFS_SLAB_DENTRY                  0           /* 各对象分配器 */
+#define NFS_SLAB_INODE                   1
+#define NFS_SLAB_BLK                     2           /* 文件数据块缓冲区 */
+#define NFS_SLAB_NR                      3
+#define NFS_SLAB_DENTRY_PER_CHUNK        128         /* 每次向malloc申请的对象数 */
+#define NFS_SLAB_INODE_PER_CHUNK         64
+#define NFS_SLAB_BLK_PER_CHUNK           16
 
 
 
@@ -71,16 +117,30 @@ typedef enum nfs_file_type {
 #define NFS_ROUND_UP(value, round)      ((value) % (round) == 0 ? (value) : ((value) / (round) + 1) * (round))
 
 #define NFS_BLKS_SZ(blks)               ((blks) * NFS_BLOCK_SIZE)
+#define NFS_BLK_OF(ofs)                 ((ofs) / NFS_BLOCK_SIZE)
+#define NFS_BM_DIRTY_BIT(blk)           (1ULL << ((blk) < NFS_BM_DIRTY_BLKS - 1 ? (blk) : NFS_BM_DIRTY_BLKS - 1))
 #define NFS_ASSIGN_FNAME(pnfs_dentry, _fname) memcpy(pnfs_dentry->fname, _fname, strlen(_fname))
 
-#define NFS_INO_OFS(ino)                (nfs_super.inode_offset + NFS_BLKS_SZ(ino))
+#define NFS_INO_OFS(ino)                (nfs_super.inode_offset + (ino) * nfs_super.inode_size)
+#define NFS_INODES_PER_BLK()            (NFS_BLOCK_SIZE / nfs_super.inode_size)
+#define NFS_ITABLE_OFS(blk)             NFS_INO_OFS((blk) * NFS_INODES_PER_BLK())   /* inode表第blk块，即其中第一个inode的位置 */
 #define NFS_DATA_OFS(ino)               (nfs_super.data_offset + NFS_BLKS_SZ(ino))
 
 #define NFS_IS_DIR(pinode)              (pinode->dentry->ftype == NFS_DIR)
 #define NFS_IS_REG(pinode)              (pinode->dentry->ftype == NFS_REG_FILE)
 #define NFS_IS_SYM_LINK(pinode)         (pinode->dentry->ftype == NFS_SYM_LINK)
 
-#define DENTRY_PER_BLOCK()              NFS_ROUND_DOWN((NFS_BLOCK_SIZE) / sizeof(struct nfs_dentry_d),1)
+#define DENTRY_PER_BLOCK()              NFS_ROUND_DOWN((NFS_BLOCK_SIZE) / sizeof(struct nfs_dentry_d),1)   /* 旧格式 */
+#define NFS_DIRENT_VERSION              2
+#define NFS_INODE_D_PAD()               (nfs_super.inode_legacy ? NFS_MAX_FILE_NAME : 0)   /* 旧镜像槽中未使用的target_path */
+#define NFS_INODE_D_SIZE()              ((int)sizeof(struct nfs_inode_d) + NFS_INODE_D_PAD())
+#define NFS_INLINE_MAX                  (nfs_super.inode_size - NFS_INODE_D_SIZE())  /* 内联数据上限 */
+#define NFS_IS_INLINE(pinode)           ((pinode)->flags & NFS_INODE_F_INLINE)
+#define NFS_PTRS_PER_BLK                (NFS_BLOCK_SIZE / (int)sizeof(int32_t))     /* 一个间接块中的块号数 */
+#define NFS_FILE_MAX_BLKS               (NFS_DATA_PER_FILE + NFS_PTRS_PER_BLK + NFS_PTRS_PER_BLK * NFS_PTRS_PER_BLK)
+#define NFS_IS_EXTENT(pinode)           ((pinode)->flags & NFS_INODE_F_EXTENTS)
+#define NFS_EXT_PER_BLK                 ((NFS_BLOCK_SIZE - (int)sizeof(struct nfs_extblk_d)) / (int)sizeof(struct nfs_extent_d))
+#define NFS_DIRENT_REC_LEN(name_len)    NFS_ROUND_UP(sizeof(struct nfs_dirent_d) + (name_len), 4)
 
 /****************************************************************************** 
 * SECTION: FS Specific Structure - In-memory structure 
@@ -91,6 +151,196 @@ struct nfs_super;
 
 struct custom_options {
     const char* device;  /* Device name (e.g., disk) */
+    int         cache_blks;  /* Block cache capacity in blocks */
+    int         use_mmap;    /* Use the mmap backend of ddriver */
+    int         no_lat;      /* Disable ddriver latency emulation */
+    int         show_stats;  /* Print per-module statistics at unmount */
+};
+
+struct nfs_buf {
+    int                blk;                           /* 缓存的逻辑块号 */
+    flag16             flag;                          /* NFS_FLAG_BUF_DIRTY / NFS_FLAG_BUF_OCCUPY */
+    uint8_t*           data;                          /* NFS_BLOCK_SIZE大小的块内容 */
+    struct nfs_buf*    hash_next;                     /* 哈希桶链 */
+    struct nfs_buf*    lru_prev;
+    struct nfs_buf*    lru_next;
+};
+
+struct nfs_cache {
+    int                capacity;                      /* 缓存块数，0表示不缓存 */
+    int                hash_sz;
+    struct nfs_buf*    bufs;
+    uint8_t*           pool;                          /* 所有块内容的连续内存 */
+    struct nfs_buf**   hash;                          /* 逻辑块号 -> nfs_buf */
+    struct nfs_buf     lru;                           /* LRU哨兵，lru.lru_next为最近使用 */
+
+    uint64_t           hits;
+    uint64_t           misses;
+    uint64_t           evictions;
+    uint64_t           writebacks;
+};
+
+struct nfs_ioq_req {
+    int                blk;                           /* 目标逻辑块号 */
+    int                hash_next;                     /* 同一哈希桶中下一个请求的下标，-1结束 */
+    uint8_t*           data;                          /* 块内容的拷贝 */
+};
+
+struct nfs_ioq {
+    int                depth;
+    int                cnt;                           /* 已暂存的块数 */
+    int                plugged;                       /* plug嵌套层数，>0时写请求只入队 */
+    int                head_blk;                      /* 上次派发结束时磁头所在的块 */
+    struct nfs_ioq_req* reqs;
+    uint8_t*           pool;
+    int*               hash;                          /* 按块号索引reqs，桶内存放首个请求的下标 */
+    int                hash_mask;
+
+    uint64_t           dispatched;                    /* 实际下发的写请求数 */
+    uint64_t           queued;                        /* 入队的块数 */
+};
+
+struct nfs_bitmap {
+    uint8_t*           map;                           /* 位图内容，格式同磁盘 */
+    int                nbits;                         /* 有效位数 */
+    int                hint;                          /* next-fit: 下次从这一位开始找 */
+    int                nfree;                         /* 空闲位数 */
+    uint64_t           dirty;                         /* 自上次写回以来修改过的块，见NFS_BM_DIRTY_BIT */
+};
+
+struct nfs_slab_chunk {
+    struct nfs_slab_chunk* next;
+    uint64_t           objs[];                        /* 对象从这里开始连续存放 */
+};
+
+struct nfs_slab {
+    const char*        name;
+    int                obj_size;
+    int                per_chunk;
+    void*              free_list;                     /* 空闲对象的前8字节存放下一个空闲对象 */
+    struct nfs_slab_chunk* chunks;
+    int                nr_chunks;
+
+    uint64_t           in_use;
+    uint64_t           peak;
+    uint64_t           allocs;
+    uint64_t           frees;
+};
+
+struct nfs_file {
+    int                ra_pos;                        /* 上次读结束的位置，下次从这里读即为顺序读 */
+    int                ra_size;                       /* 当前预读窗口(块数)，0表示未在顺序读 */
+    int                ra_end;                        /* 已预读到的位置(不含) */
+    struct nfs_inode*  bmap_inode;                    /* 下面缓存的映射所属的inode */
+    uint32_t           bmap_gen;                      /* 缓存时inode的map_gen，不同则缓存失效 */
+    int                bmap_base;                     /* bmap_buf映射的第一个文件内块号 */
+    struct nfs_mapbuf* bmap_buf;                      /* 上次查到的末级间接块，NULL表示没有 */
+    int                bmap_ext;                      /* extent文件上次查到的extent下标 */
+};
+
+struct nfs_extent {                                   /* 文件内[lblk, lblk + len)映射到[pblk, pblk + len) */
+    int                lblk;
+    int                pblk;
+    int                len;
+};
+
+struct nfs_ext_stat {
+    uint64_t           lookups;
+    uint64_t           hint_hits;                     /* 打开文件记录的extent即为所求 */
+    uint64_t           extended;                      /* 新分配的块接在已有extent之后 */
+    uint64_t           inserted;                      /* 新分配的块另起一个extent */
+    uint64_t           rsv_windows;                   /* 建立的预留窗口数 */
+    uint64_t           rsv_hits;                      /* 新块取自预留窗口 */
+};
+
+struct nfs_ext_rsv {                                  /* 预留窗口: 已在位图中占用、尚未映射的[start, start + len) */
+    struct nfs_inode*  inode;                         /* 只作比较不解引用，NULL表示空闲 */
+    int                start;
+    int                len;                           /* 尚未用掉的块数 */
+    int                size;                          /* 窗口大小，下一个窗口翻倍 */
+    uint64_t           used;                          /* 最近使用的时刻，槽满时换出最久未用的 */
+};
+
+struct nfs_mapbuf {                                   /* 已装入内存的间接块 */
+    int                blk;                           /* 所在数据块号 */
+    boolean            dirty;
+    int*               ptrs;                          /* NFS_PTRS_PER_BLK个块号，-1表示空洞 */
+    struct nfs_mapbuf* next;
+};
+
+struct nfs_bmap_stat {
+    uint64_t           hits;                          /* 由打开文件缓存的间接块直接得到 */
+    uint64_t           misses;                        /* 需要逐级查找间接块 */
+    uint64_t           map_reads;                     /* 从磁盘读入的间接块数 */
+};
+
+struct nfs_itable_stat {
+    uint64_t           hits;                          /* 所需inode已在缓冲的inode表块中 */
+    uint64_t           loads;                         /* 读入inode表块 */
+    uint64_t           flushes;                       /* 写回inode表块 */
+};
+
+struct nfs_ra_stat {
+    uint64_t           windows;                       /* 发起的预读次数 */
+    uint64_t           prefetched;                    /* 预读装入的块数 */
+    uint64_t           hits;                          /* 读到的块已由预读装入 */
+    uint64_t           misses;                        /* 读到的块需要同步装入 */
+    uint64_t           async;                         /* 异步提交的预读请求数 */
+    uint64_t           waits;                         /* 读到的块预读尚未完成，需等待 */
+};
+
+struct nfs_ra_req {                                   /* 一次在途的异步预读 */
+    struct ddriver_req req;
+    struct iovec       iov[NFS_RA_MAX_BLKS];          /* 各块的缓冲区，完成后交给inode */
+    struct nfs_inode*  inode;                         /* NULL表示空闲 */
+    int                blk;                           /* 第一个文件块 */
+    int                pblk;                          /* 对应的第一个数据块 */
+    int                cnt;
+};
+
+struct nfs_path_iter {
+    const char*        path;
+    const char*        cur;                           /* 下一个分量的查找起点 */
+    const char*        name;                          /* 当前分量，指向原路径，不以'\0'结尾 */
+    int                len;
+    boolean            canon;                         /* 目前为止是否为规范路径(无"//"、结尾'/'、"."、"..") */
+};
+
+struct nfs_nameidata {
+    int                err;                           /* 0或负的错误号 */
+    boolean            is_find;
+    boolean            is_root;
+    struct nfs_dentry* dentry;                        /* 找到的目录项，找不到时为最后一个存在的目录项 */
+    struct nfs_dentry* parent;                        /* 最后一个分量所在目录的目录项，中间分量不存在时为NULL */
+    const char*        name;                          /* 最后一个分量，指向原路径，不以'\0'结尾 */
+    int                len;
+};
+
+struct nfs_dcache_ent {
+    uint32_t           hash;
+    int                len;                           /* 路径长度，0表示空闲 */
+    int                err;                           /* 0为正项，否则为负项的错误号 */
+    struct nfs_dentry* dentry;                        /* 正项为路径对应的目录项，负项为最后一个存在的目录项 */
+    struct nfs_dentry* parent;                        /* 同nfs_nameidata.parent */
+    int                name_ofs;                      /* 最后一个分量在路径中的偏移，-1表示没有 */
+    int                name_len;
+    struct nfs_dcache_ent* hash_next;
+    struct nfs_dcache_ent* lru_prev;
+    struct nfs_dcache_ent* lru_next;
+    char               path[NFS_DCACHE_PATH_MAX];
+};
+
+struct nfs_dcache {
+    int                capacity;
+    int                hash_sz;
+    struct nfs_dcache_ent*  ents;
+    struct nfs_dcache_ent** hash;                     /* 路径 -> 缓存项 */
+    struct nfs_dcache_ent   lru;                      /* LRU哨兵，lru.lru_next为最近使用 */
+
+    uint64_t           hits;
+    uint64_t           neg_hits;
+    uint64_t           misses;
+    uint64_t           invalidations;
 };
 
 struct nfs_inode {
@@ -100,9 +350,32 @@ struct nfs_inode {
     int                dir_cnt;
     struct nfs_dentry* dentry;                        /* 指向该inode的dentry */
     struct nfs_dentry* dentrys;                       /* 所有目录项 */
+    struct nfs_dentry** dhash;                        /* 目录索引: 文件名 -> 目录项，NULL表示尚未建立 */
+    int                dhash_sz;                      /* 桶数 */
+    int                dhash_cnt;
     NFS_FILE_TYPE          ftype;                           // 文件类型（目录类型、普通文件类型）
-    uint8_t           data[NFS_DATA_PER_FILE];     
+    uint8_t**         data;                           /* 每块一个缓冲区，NULL表示未装入，共data_cap项 */
+    uint8_t*          data_ra;                        /* 该块由预读装入且尚未被读到，或NFS_RA_INFLIGHT */
+    int               data_cap;
     int               block_pointer[NFS_DATA_PER_FILE];          
+    int               ind_blk;                        /* 一级间接块，-1表示没有 */
+    int               dind_blk;                       /* 二级间接块 */
+    int               blocks;                         /* 占用的数据块数，含间接块 */
+    struct nfs_mapbuf* maps;                          /* 已装入的间接块 */
+    uint32_t          map_gen;                        /* 间接块被释放时更新，使打开文件缓存的映射失效 */
+    struct nfs_extent* ext;                           /* 按lblk递增，相邻且连续的extent总是合并 */
+    int               ext_cnt;
+    int               ext_cap;
+    int               ext_blk;                        /* 第一个extent块，-1表示没有 */
+    int*              ext_chain;                      /* 各extent块的块号，ext_loaded后有效 */
+    int               ext_nchain;
+    boolean           ext_loaded;                     /* extent块中的extent已装入 */
+    boolean           ext_dirty;                      /* extent块需要写回 */
+    uint32_t          flags;                          /* NFS_INODE_F_*，与磁盘相同 */
+    flag16            dirty;                          /* NFS_INODE_DIRTY_* */
+    uint8_t*          data_dirty;                     /* 该块被写过，需要写回 */
+    struct nfs_inode* dirty_next;                     /* 脏链表，不在链表上时dirty_pprev为NULL */
+    struct nfs_inode** dirty_pprev;
 };
 
 struct nfs_dentry {
@@ -113,6 +386,7 @@ struct nfs_dentry {
     struct nfs_inode*  inode;                         /* 指向inode */
     struct nfs_dentry* parent;                        /* 父亲Inode的dentry */
     struct nfs_dentry* brother;                       /* 兄弟 */
+    struct nfs_dentry* hash_next;                     /* 父目录索引的哈希桶链 */
 };
 
 struct nfs_super {
@@ -134,9 +408,16 @@ struct nfs_super {
     int                map_data_offset;  
 
     int                inode_offset;
+    int                inode_size;                    /* 磁盘inode大小，旧镜像为NFS_BLOCK_SIZE */
+    boolean            inode_legacy;                  /* 旧镜像，inode槽中保留target_path */
     int                data_offset;
 
+    struct nfs_bitmap  inode_bm;                      /* 基于map_inode的分配器 */
+    struct nfs_bitmap  data_bm;                       /* 基于map_data的分配器 */
+    struct nfs_inode*  dirty_list;                    /* 需要写回的inode */
+
     boolean            is_mounted;
+    boolean            show_stats;                    /* umount时打印统计，见--stats */
     struct nfs_dentry* root_dentry;
 };
 
@@ -155,41 +436,86 @@ struct nfs_super_d {
     int                map_data_blks;
     int                map_data_offset;  
     int                inode_offset;
+
+    uint32_t           flags;                         /* NFS_SUPER_F_*，旧镜像为0 */
+    uint32_t           free_inodes;                   /* umount时的空闲inode数 */
+    uint32_t           free_blks;                     /* umount时的空闲数据块数 */
+
+    uint32_t           max_ino;                       /* 格式化时按设备大小确定的inode数 */
+    uint32_t           max_data;                      /* 格式化时按设备大小确定的数据块数 */
+    uint32_t           inode_size;                    /* 磁盘inode大小 */
+};
+
+struct nfs_extent_d {
+    uint32_t           lblk;
+    uint32_t           pblk;
+    uint32_t           len;
+};
+
+struct nfs_extblk_d {                                 /* extent块的块头，之后是NFS_EXT_PER_BLK个nfs_extent_d */
+    int32_t            next;                          /* 下一个extent块，-1表示没有 */
+    uint32_t           cnt;                           /* 本块中的extent数 */
 };
 
 struct nfs_inode_d {
     uint32_t           ino;                           /* 在inode位图中的下标 */
     uint32_t           size;                          /* 文件已占用空间 */
-    char               target_path[NFS_MAX_FILE_NAME];/* store traget path when it is a symlink */
-    uint32_t           dir_cnt;
+    uint32_t           dir_cnt;                       /* 旧镜像在此前还有NFS_MAX_FILE_NAME字节的target_path，见NFS_INODE_D_PAD */
     NFS_FILE_TYPE      ftype;  
 
-    int                block_pointer[NFS_DATA_PER_FILE];         
-};
-
-struct nfs_dentry_d {
+    union {
+        int            block_pointer[NFS_DATA_PER_FILE];
+        struct nfs_extent_d ext[NFS_EXT_IN_INODE];    /* NFS_INODE_F_EXTENTS */
+    };
+    uint32_t           flags;                         /* NFS_INODE_F_*，旧镜像中此处为0 */
+    union {                                           /* 以下在NFS_INODE_F_BMAP时有效 */
+        struct {
+            int32_t    ind_blk;
+            int32_t    dind_blk;
+        };
+        struct {                                      /* NFS_INODE_F_EXTENTS */
+            int32_t    ext_blk;                       /* 第一个extent块 */
+            uint32_t   ext_cnt;                       /* extent总数，含extent块中的 */
+        };
+    };
+    uint32_t           blocks;
+};                                                    /* 内联数据紧接在后，位于inode槽的剩余部分 */
+
+struct nfs_dentry_d {                                 /* 旧格式的定长目录项，只读 */
     char               fname[NFS_MAX_FILE_NAME];
     NFS_FILE_TYPE      ftype;
     uint32_t           ino;                           /* 指向的ino号 */
 };
 
+struct nfs_dirblk_d {                                 /* 新格式目录块的块头 */
+    uint8_t            zero;                          /* 恒为0，旧格式块此处是文件名的第一个字节 */
+    uint8_t            version;                       /* NFS_DIRENT_VERSION */
+    uint16_t           reserved;
+};
+
+struct nfs_dirent_d {                                 /* 新格式的变长目录项 */
+    uint32_t           ino;                           /* 指向的ino号 */
+    uint16_t           rec_len;                       /* 到下一条记录的距离 */
+    uint8_t            name_len;
+    uint8_t            ftype;
+    char               name[];                        /* 不以'\0'结尾 */
+};
+
 
 
 /****************************************************************************** 
 * SECTION: FS Specific Function 
 ******************************************************************************/
 
-static inline struct nfs_dentry* new_dentry(char * fname, NFS_FILE_TYPE ftype) {
-    struct nfs_dentry * dentry = (struct nfs_dentry *)malloc(sizeof(struct nfs_dentry));
-    memset(dentry, 0, sizeof(struct nfs_dentry));
-    NFS_ASSIGN_FNAME(dentry, fname);
-    dentry->ftype   = ftype;
-    dentry->ino     = -1;
-    dentry->inode   = NULL;
-    dentry->parent  = NULL;
-    dentry->brother = NULL;
-
-    return dentry;                                            
+static inline uint32_t nfs_name_hash(const char *name, int len) {
+    uint32_t hash = 2166136261u;                              /* FNV-1a */
+    int i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
 }
 
 #endif /* _TYPES_H_ */
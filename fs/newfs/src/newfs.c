@@ -16,30 +16,222 @@ struct custom_options nfs_options;
 *******************************************************************************/
 static const struct fuse_opt option_spec[] = {		/* 用于FUSE文件系统解析参数 */
 	OPTION("--device=%s", device),
+	OPTION("--cache_blks=%d", cache_blks),
+	OPTION("--mmap", use_mmap),
+	OPTION("--nolat", no_lat),
+	OPTION("--stats", show_stats),
 	FUSE_OPT_END
 };
 
+/******************************************************************************
+* SECTION: 加锁分发
+* 块缓存、目录项缓存、inode表缓冲、预读请求等都是全局共享状态，FUSE默认多线程
+* 分发请求，因此每个操作都在nfs_big_lock下执行；设备IO与预读由ddriver的工作
+* 线程完成，不受此锁限制
+*******************************************************************************/
+static pthread_mutex_t nfs_big_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static int nfs_op_mkdir(const char* path, mode_t mode) {
+	int ret;
+
+	pthread_mutex_lock(&nfs_big_lock);
+	ret = newfs_mkdir(path, mode);
+	pthread_mutex_unlock(&nfs_big_lock);
+	return ret;
+}
+
+static int nfs_op_getattr(const char* path, struct stat* newfs_stat) {
+	int ret;
+
+	pthread_mutex_lock(&nfs_big_lock);
+	ret = newfs_getattr(path, newfs_stat);
+	pthread_mutex_unlock(&nfs_big_lock);
+	return ret;
+}
+
+static int nfs_op_readdir(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset,
+						  struct fuse_file_info* fi) {
+	int ret;
+
+	pthread_mutex_lock(&nfs_big_lock);
+	ret = newfs_readdir(path, buf, filler, offset, fi);
+	pthread_mutex_unlock(&nfs_big_lock);
+	return ret;
+}
+
+static int nfs_op_mknod(const char* path, mode_t mode, dev_t dev) {
+	int ret;
+
+	pthread_mutex_lock(&nfs_big_lock);
+	ret = newfs_mknod(path, mode, dev);
+	pthread_mutex_unlock(&nfs_big_lock);
+	return ret;
+}
+
+static int nfs_op_write(const char* path, const char* buf, size_t size, off_t offset,
+						struct fuse_file_info* fi) {
+	int ret;
+
+	pthread_mutex_lock(&nfs_big_lock);
+	ret = newfs_write(path, buf, size, offset, fi);
+	pthread_mutex_unlock(&nfs_big_lock);
+	return ret;
+}
+
+static int nfs_op_read(const char* path, char* buf, size_t size, off_t offset,
+					   struct fuse_file_info* fi) {
+	int ret;
+
+	pthread_mutex_lock(&nfs_big_lock);
+	ret = newfs_read(path, buf, size, offset, fi);
+	pthread_mutex_unlock(&nfs_big_lock);
+	return ret;
+}
+
+static int nfs_op_utimens(const char* path, const struct timespec tv[2]) {
+	int ret;
+
+	pthread_mutex_lock(&nfs_big_lock);
+	ret = newfs_utimens(path, tv);
+	pthread_mutex_unlock(&nfs_big_lock);
+	return ret;
+}
+
+static int nfs_op_truncate(const char* path, off_t offset) {
+	int ret;
+
+	pthread_mutex_lock(&nfs_big_lock);
+	ret = newfs_truncate(path, offset);
+	pthread_mutex_unlock(&nfs_big_lock);
+	return ret;
+}
+
+static int nfs_op_unlink(const char* path) {
+	int ret;
+
+	pthread_mutex_lock(&nfs_big_lock);
+	ret = newfs_unlink(path);
+	pthread_mutex_unlock(&nfs_big_lock);
+	return ret;
+}
+
+static int nfs_op_rmdir(const char* path) {
+	int ret;
+
+	pthread_mutex_lock(&nfs_big_lock);
+	ret = newfs_rmdir(path);
+	pthread_mutex_unlock(&nfs_big_lock);
+	return ret;
+}
+
+static int nfs_op_rename(const char* from, const char* to) {
+	int ret;
+
+	pthread_mutex_lock(&nfs_big_lock);
+	ret = newfs_rename(from, to);
+	pthread_mutex_unlock(&nfs_big_lock);
+	return ret;
+}
+
+static int nfs_op_statfs(const char* path, struct statvfs* stbuf) {
+	int ret;
+
+	pthread_mutex_lock(&nfs_big_lock);
+	ret = newfs_statfs(path, stbuf);
+	pthread_mutex_unlock(&nfs_big_lock);
+	return ret;
+}
+
+static int nfs_op_open(const char* path, struct fuse_file_info* fi) {
+	int ret;
+
+	pthread_mutex_lock(&nfs_big_lock);
+	ret = newfs_open(path, fi);
+	pthread_mutex_unlock(&nfs_big_lock);
+	return ret;
+}
+
+static int nfs_op_release(const char* path, struct fuse_file_info* fi) {
+	int ret;
+
+	pthread_mutex_lock(&nfs_big_lock);
+	ret = newfs_release(path, fi);
+	pthread_mutex_unlock(&nfs_big_lock);
+	return ret;
+}
+
+static int nfs_op_flush(const char* path, struct fuse_file_info* fi) {
+	int ret;
+
+	pthread_mutex_lock(&nfs_big_lock);
+	ret = newfs_flush(path, fi);
+	pthread_mutex_unlock(&nfs_big_lock);
+	return ret;
+}
+
+static int nfs_op_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+	int ret;
+
+	pthread_mutex_lock(&nfs_big_lock);
+	ret = newfs_fsync(path, datasync, fi);
+	pthread_mutex_unlock(&nfs_big_lock);
+	return ret;
+}
+
+static int nfs_op_opendir(const char* path, struct fuse_file_info* fi) {
+	int ret;
+
+	pthread_mutex_lock(&nfs_big_lock);
+	ret = newfs_opendir(path, fi);
+	pthread_mutex_unlock(&nfs_big_lock);
+	return ret;
+}
+
+static int nfs_op_fsyncdir(const char* path, int datasync, struct fuse_file_info* fi) {
+	int ret;
+
+	pthread_mutex_lock(&nfs_big_lock);
+	ret = newfs_fsyncdir(path, datasync, fi);
+	pthread_mutex_unlock(&nfs_big_lock);
+	return ret;
+}
+
+static int nfs_op_access(const char* path, int type) {
+	int ret;
+
+	pthread_mutex_lock(&nfs_big_lock);
+	ret = newfs_access(path, type);
+	pthread_mutex_unlock(&nfs_big_lock);
+	return ret;
+}
+
 /******************************************************************************
 * SECTION: FUSE操作定义
 *******************************************************************************/
 static struct fuse_operations operations = {
 	.init = newfs_init,						 /* mount文件系统 */		
 	.destroy = newfs_destroy,				 /* umount文件系统 */
-	.mkdir = newfs_mkdir,					 /* 建目录，mkdir */
-	.getattr = newfs_getattr,				 /* 获取文件属性，类似stat，必须完成 */
-	.readdir = newfs_readdir,				 /* 填充dentrys */
-	.mknod = newfs_mknod,					 /* 创建文件，touch相关 */
-	.write = newfs_write,								  	 /* 写入文件 */
-	.read = newfs_read,								  	 /* 读文件 */
-	.utimens = newfs_utimens,				 /* 修改时间，忽略，避免touch报错 */
-	.truncate = newfs_truncate,						  		 /* 改变文件大小 */
-	.unlink = newfs_unlink,							  		 /* 删除文件 */
-	.rmdir	= newfs_rmdir,							  		 /* 删除目录， rm -r */
-	.rename = newfs_rename,							  		 /* 重命名，mv */
-
-	.open = newfs_open,							
-	.opendir = newfs_opendir,
-	.access = newfs_access
+	.mkdir = nfs_op_mkdir,					 /* 建目录，mkdir */
+	.getattr = nfs_op_getattr,				 /* 获取文件属性，类似stat，必须完成 */
+	.readdir = nfs_op_readdir,				 /* 填充dentrys */
+	.mknod = nfs_op_mknod,					 /* 创建文件，touch相关 */
+	.write = nfs_op_write,								  	 /* 写入文件 */
+	.read = nfs_op_read,								  	 /* 读文件 */
+	.utimens = nfs_op_utimens,				 /* 修改时间，忽略，避免touch报错 */
+	.truncate = nfs_op_truncate,						  		 /* 改变文件大小 */
+	.unlink = nfs_op_unlink,							  		 /* 删除文件 */
+	.rmdir	= nfs_op_rmdir,							  		 /* 删除目录， rm -r */
+	.rename = nfs_op_rename,							  		 /* 重命名，mv */
+	.statfs = nfs_op_statfs,							  		 /* 文件系统容量，df */
+
+	.open = nfs_op_open,							
+	.release = nfs_op_release,				 /* 关闭文件 */
+	.flush = nfs_op_flush,					 /* close时写回 */
+	.fsync = nfs_op_fsync,					 /* fsync，只写回该文件 */
+	.opendir = nfs_op_opendir,
+	.fsyncdir = nfs_op_fsyncdir,				 /* fsync目录 */
+	.access = nfs_op_access
 };
 /******************************************************************************
 * SECTION: 必做函数实现
@@ -91,25 +283,31 @@ void newfs_destroy(void* p) {
 int newfs_mkdir(const char* path, mode_t mode) {
 	/* TODO: 解析路径，创建目录 */
 	(void)mode;
-	boolean is_find, is_root;
-	char* fname;
-	struct nfs_dentry* last_dentry = nfs_lookup(path, &is_find, &is_root);
+	struct nfs_nameidata nd;
 	struct nfs_dentry* dentry;
 	struct nfs_inode*  inode;
 
-	if (is_find) {
+	if (nfs_resolve(path, &nd) == NFS_ERROR_NONE) {
 		return -NFS_ERROR_EXISTS;
 	}
-
-	if (NFS_IS_REG(last_dentry->inode)) {
-		return -NFS_ERROR_UNSUPPORTED;
+	if (nd.parent == NULL) {						  /* 中间分量不存在或不是目录 */
+		return nd.err;
 	}
 
-	fname  = nfs_get_fname(path);
-	dentry = new_dentry(fname, NFS_DIR); 
-	dentry->parent = last_dentry;
+	dentry = new_dentry_len(nd.name, nd.len, NFS_DIR); 
+	dentry->parent = nd.parent;
+	if (nfs_alloc_dentry(nd.parent->inode, dentry) < 0) {	/* 目录已满 */
+		free_dentry(dentry);
+		return -NFS_ERROR_NOSPACE;
+	}
 	inode  = nfs_alloc_inode(dentry);
-	nfs_alloc_dentry(last_dentry->inode, dentry);
+	if (inode == NULL) {							  /* 没有空闲inode */
+		nfs_drop_dentry(nd.parent->inode, dentry);
+		free_dentry(dentry);
+		return -NFS_ERROR_NOSPACE;
+	}
+	nfs_mark_inode_dirty(nd.parent->inode, NFS_INODE_DIRTY | NFS_INODE_DIRTY_DENTRY);
+	nfs_dcache_invalidate(path);					  /* 清除该路径上的负项 */
 	
 	return NFS_ERROR_NONE;
 }
@@ -131,7 +329,7 @@ int newfs_getattr(const char* path, struct stat * newfs_stat) {
 
 	if (NFS_IS_DIR(dentry->inode)) {
 		newfs_stat->st_mode = S_IFDIR | NFS_DEFAULT_PERM;
-		newfs_stat->st_size = dentry->inode->dir_cnt * sizeof(struct nfs_dentry_d);
+		newfs_stat->st_size = NFS_BLKS_SZ(dentry->inode->blocks);	/* 目录大小为已分配的目录块 */
 	}
 	else if (NFS_IS_REG(dentry->inode)) {
 		newfs_stat->st_mode = S_IFREG | NFS_DEFAULT_PERM;
@@ -148,10 +346,11 @@ int newfs_getattr(const char* path, struct stat * newfs_stat) {
 	newfs_stat->st_atime   = time(NULL);
 	newfs_stat->st_mtime   = time(NULL);
 	newfs_stat->st_blksize = NFS_BLOCK_SIZE;
+	newfs_stat->st_blocks  = (blkcnt_t)dentry->inode->blocks * (NFS_BLOCK_SIZE / 512);	/* 含间接块，内联文件为0 */
 
 	if (is_root) {
 		newfs_stat->st_size	= nfs_super.sz_usage; 
-		newfs_stat->st_blocks = NFS_DISK_SZ() /NFS_BLOCK_SIZE;
+		newfs_stat->st_blocks = (blkcnt_t)(nfs_super.max_data - nfs_super.data_bm.nfree - nfs_ext_rsv_count()) * (NFS_BLOCK_SIZE / 512);
 		newfs_stat->st_nlink  = 2;		/* !特殊，根目录link数为2 */
 	}
 	return NFS_ERROR_NONE;
@@ -205,30 +404,39 @@ int newfs_readdir(const char * path, void * buf, fuse_fill_dir_t filler, off_t o
  */
 int newfs_mknod(const char* path, mode_t mode, dev_t dev) {
 	/* TODO: 解析路径，并创建相应的文件 */
-	boolean	is_find, is_root;
-	struct nfs_dentry* last_dentry = nfs_lookup(path, &is_find, &is_root);
+	struct nfs_nameidata nd;
 	struct nfs_dentry* dentry;
 	struct nfs_inode* inode;
-	char* fname;
 	
-	if (is_find == TRUE) {
+	if (nfs_resolve(path, &nd) == NFS_ERROR_NONE) {
 		return -NFS_ERROR_EXISTS;
 	}
-
-	fname = nfs_get_fname(path);
+	if (nd.parent == NULL) {						  /* 中间分量不存在或不是目录 */
+		return nd.err;
+	}
 	
 	if (S_ISREG(mode)) {
-		dentry = new_dentry(fname, NFS_REG_FILE);
+		dentry = new_dentry_len(nd.name, nd.len, NFS_REG_FILE);
 	}
 	else if (S_ISDIR(mode)) {
-		dentry = new_dentry(fname, NFS_DIR);
+		dentry = new_dentry_len(nd.name, nd.len, NFS_DIR);
 	}
 	else {
-		dentry = new_dentry(fname, NFS_REG_FILE);
+		dentry = new_dentry_len(nd.name, nd.len, NFS_REG_FILE);
+	}
+	dentry->parent = nd.parent;
+	if (nfs_alloc_dentry(nd.parent->inode, dentry) < 0) {	/* 目录已满 */
+		free_dentry(dentry);
+		return -NFS_ERROR_NOSPACE;
 	}
-	dentry->parent = last_dentry;
 	inode = nfs_alloc_inode(dentry);
-	nfs_alloc_dentry(last_dentry->inode, dentry);
+	if (inode == NULL) {							  /* 没有空闲inode */
+		nfs_drop_dentry(nd.parent->inode, dentry);
+		free_dentry(dentry);
+		return -NFS_ERROR_NOSPACE;
+	}
+	nfs_mark_inode_dirty(nd.parent->inode, NFS_INODE_DIRTY | NFS_INODE_DIRTY_DENTRY);
+	nfs_dcache_invalidate(path);					  /* 清除该路径上的负项 */
 
 	return NFS_ERROR_NONE;
 }
@@ -260,9 +468,11 @@ int newfs_utimens(const char* path, const struct timespec tv[2]) {
 int newfs_write(const char* path, const char* buf, size_t size, off_t offset,
 		        struct fuse_file_info* fi) {
 	/* 选做 */
-	 boolean	is_find, is_root;
+	boolean	is_find, is_root;
 	struct nfs_dentry* dentry = nfs_lookup(path, &is_find, &is_root);
 	struct nfs_inode*  inode;
+	struct nfs_file*   file = fi ? (struct nfs_file*)(uintptr_t)fi->fh : NULL;
+	int blk, bias, len, done;
 	
 	if (is_find == FALSE) {
 		return -NFS_ERROR_NOTFOUND;
@@ -278,8 +488,63 @@ int newfs_write(const char* path, const char* buf, size_t size, off_t offset,
 		return -NFS_ERROR_SEEK;
 	}
 
-	memcpy(inode->data + offset, buf, size);
-	inode->size = offset + size > inode->size ? offset + size : inode->size;
+	if (offset + size > (size_t)NFS_BLKS_SZ(NFS_FILE_MAX_BLKS)) {
+		return -NFS_ERROR_NOSPACE;
+	}
+	if (size == 0) {
+		return 0;
+	}
+
+	if (NFS_IS_INLINE(inode)) {
+		if (offset + size <= NFS_INLINE_MAX) {		  /* 仍可内联，数据随inode写回 */
+			if (nfs_inline_load(inode) != NFS_ERROR_NONE) {
+				return -NFS_ERROR_IO;
+			}
+			memcpy(inode->data[0] + offset, buf, size);
+			if (offset + size > inode->size) {
+				inode->size = offset + size;
+			}
+			nfs_mark_inode_dirty(inode, NFS_INODE_DIRTY);
+			return size;
+		}
+		if (nfs_inline_promote(inode) != NFS_ERROR_NONE) {
+			return -NFS_ERROR_NOSPACE;
+		}
+	}
+
+	if (nfs_file_reserve(inode, NFS_BLK_OF(offset + size - 1) + 1) != NFS_ERROR_NONE) {
+		return -NFS_ERROR_NOSPACE;
+	}
+	for (done = 0; done < size; done += len) {
+		blk  = NFS_BLK_OF(offset + done);
+		bias = (offset + done) % NFS_BLOCK_SIZE;
+		len  = NFS_BLOCK_SIZE - bias < size - done ? NFS_BLOCK_SIZE - bias : size - done;
+		if (inode->data[blk] == NULL) {
+			if (len == NFS_BLOCK_SIZE) {			  /* 整块覆盖，不必读出原内容 */
+				inode->data[blk] = (uint8_t*)nfs_slab_alloc(NFS_SLAB_BLK);
+				if (inode->data[blk] == NULL) {
+					return done ? done : -NFS_ERROR_NOSPACE;
+				}
+			}
+			else if (nfs_file_load(file, inode, blk, blk + 1) != NFS_ERROR_NONE) {
+				return done ? done : -NFS_ERROR_IO;	  /* 部分覆盖的块需要先装入原内容 */
+			}
+		}
+		if (nfs_file_bmap(file, inode, blk, TRUE) < 0) {	  /* 空洞处分配数据块，必要时分配间接块 */
+			if (!inode->data_dirty[blk]) {			  /* 未写过的缓冲区丢弃，之后按空洞重新装入 */
+				nfs_slab_free(NFS_SLAB_BLK, inode->data[blk]);
+				inode->data[blk] = NULL;
+			}
+			return done ? done : -NFS_ERROR_NOSPACE;
+		}
+		memcpy(inode->data[blk] + bias, buf + done, len);
+		inode->data_ra[blk] = FALSE;
+		nfs_mark_data_dirty(inode, blk);
+		if (offset + done + len > inode->size) {
+			inode->size = offset + done + len;
+			nfs_mark_inode_dirty(inode, NFS_INODE_DIRTY);
+		}
+	}
 	
 	return size;
 }
@@ -299,6 +564,7 @@ int newfs_read(const char* path, char* buf, size_t size, off_t offset,
 	boolean	is_find, is_root;
 	struct nfs_dentry* dentry = nfs_lookup(path, &is_find, &is_root);
 	struct nfs_inode*  inode;
+	int blk, bias, len, done;
 
 	if (is_find == FALSE) {
 		return -NFS_ERROR_NOTFOUND;
@@ -314,7 +580,22 @@ int newfs_read(const char* path, char* buf, size_t size, off_t offset,
 		return -NFS_ERROR_SEEK;
 	}
 
-	memcpy(buf, inode->data + offset, size);
+	if (offset + size > inode->size) {
+		size = inode->size - offset;
+	}
+	if (size == 0) {
+		return 0;
+	}
+
+	if (nfs_ra_read(fi ? (struct nfs_file*)(uintptr_t)fi->fh : NULL, inode, offset, size) != NFS_ERROR_NONE) {
+		return -NFS_ERROR_IO;
+	}
+	for (done = 0; done < size; done += len) {
+		blk  = NFS_BLK_OF(offset + done);
+		bias = (offset + done) % NFS_BLOCK_SIZE;
+		len  = NFS_BLOCK_SIZE - bias < size - done ? NFS_BLOCK_SIZE - bias : size - done;
+		memcpy(buf + done, inode->data[blk] + bias, len);
+	}
 
 	return size;			 		   
 }
@@ -336,8 +617,10 @@ int newfs_unlink(const char* path) {
 
 	inode = dentry->inode;
 
+	nfs_dcache_invalidate(path);					  /* 该路径及其下的目录项即将释放 */
 	nfs_drop_inode(inode);
 	nfs_drop_dentry(dentry->parent->inode, dentry);
+	nfs_mark_inode_dirty(dentry->parent->inode, NFS_INODE_DIRTY | NFS_INODE_DIRTY_DENTRY);
 	return NFS_ERROR_NONE;
 }
 
@@ -399,8 +682,19 @@ int ret = NFS_ERROR_NONE;
 	nfs_drop_inode(to_dentry->inode);				  /* 保证生成的inode被释放 */	
 	to_dentry->ino = from_inode->ino;				  /* 指向新的inode */
 	to_dentry->inode = from_inode;
+	from_inode->dentry = to_dentry;
+	if (NFS_IS_DIR(from_inode)) {
+		struct nfs_dentry* child;
+		for (child = from_inode->dentrys; child; child = child->brother) {
+			child->parent = to_dentry;
+		}
+	}
 	
 	nfs_drop_dentry(from_dentry->parent->inode, from_dentry);
+	nfs_mark_inode_dirty(to_dentry->parent->inode, NFS_INODE_DIRTY_DENTRY);
+	nfs_mark_inode_dirty(from_dentry->parent->inode, NFS_INODE_DIRTY | NFS_INODE_DIRTY_DENTRY);
+	nfs_dcache_invalidate(from);
+	nfs_dcache_invalidate(to);
 	return ret;
 }
 
@@ -414,9 +708,91 @@ int ret = NFS_ERROR_NONE;
  */
 int newfs_open(const char* path, struct fuse_file_info* fi) {
 	/* 选做 */
+	struct nfs_file* file = (struct nfs_file*)malloc(sizeof(struct nfs_file));
+
+	if (file == NULL) {
+		return -NFS_ERROR_NOSPACE;
+	}
+	nfs_ra_init(file);
+	fi->fh = (uint64_t)(uintptr_t)file;
 	return 0;
 }
 
+/**
+ * @brief 关闭文件，释放newfs_open中分配的打开文件状态；
+ * 写回已由close时的flush完成，这里不再重复
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_release(const char* path, struct fuse_file_info* fi) {
+	struct nfs_file* file = (struct nfs_file*)(uintptr_t)fi->fh;
+
+	if (file != NULL && file->bmap_inode != NULL) {
+		nfs_ext_rsv_drop(file->bmap_inode);		  /* 写完的文件不再需要预留窗口 */
+	}
+	free(file);
+	fi->fh = 0;
+	return 0;
+}
+
+/**
+ * @brief 写回一个文件或目录及其依赖的元数据
+ * 
+ * @param path 相对于挂载点的路径
+ * @return int 0成功，否则返回对应错误号
+ */
+static int newfs_writeback(const char* path) {
+	boolean	is_find, is_root;
+	struct nfs_dentry* dentry = nfs_lookup(path, &is_find, &is_root);
+
+	if (is_find == FALSE) {							  /* 已被删除，没有需要写回的内容 */
+		return NFS_ERROR_NONE;
+	}
+	return nfs_fsync_inode(dentry->inode);
+}
+
+/**
+ * @brief close时调用，写回该文件的修改
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_flush(const char* path, struct fuse_file_info* fi) {
+	(void)fi;
+	return newfs_writeback(path);
+}
+
+/**
+ * @brief 写回该文件的脏数据块、inode以及父目录项、位图，不做全量同步
+ * 
+ * @param path 相对于挂载点的路径
+ * @param datasync 非0时只需保证数据，这里与fsync相同处理(大小也在inode中)
+ * @param fi 文件信息
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+	(void)datasync;
+	(void)fi;
+	return newfs_writeback(path);
+}
+
+/**
+ * @brief 写回该目录的目录项、inode以及父目录项、位图
+ * 
+ * @param path 相对于挂载点的路径
+ * @param datasync 可忽略
+ * @param fi 文件信息
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_fsyncdir(const char* path, int datasync, struct fuse_file_info* fi) {
+	(void)datasync;
+	(void)fi;
+	return newfs_writeback(path);
+}
+
 /**
  * @brief 打开目录文件
  * 
@@ -441,6 +817,7 @@ int newfs_truncate(const char* path, off_t offset) {
 	boolean	is_find, is_root;
 	struct nfs_dentry* dentry = nfs_lookup(path, &is_find, &is_root);
 	struct nfs_inode*  inode;
+	int blk, bias;
 	
 	if (is_find == FALSE) {
 		return -NFS_ERROR_NOTFOUND;
@@ -452,11 +829,67 @@ int newfs_truncate(const char* path, off_t offset) {
 		return -NFS_ERROR_ISDIR;
 	}
 
+	if (NFS_IS_INLINE(inode)) {
+		if (offset > NFS_INLINE_MAX) {
+			if (nfs_inline_promote(inode) != NFS_ERROR_NONE) {
+				return -NFS_ERROR_NOSPACE;
+			}
+		}
+		else {										  /* 截短后的尾部清零，之后再变长时读到0 */
+			if (nfs_inline_load(inode) != NFS_ERROR_NONE) {
+				return -NFS_ERROR_IO;
+			}
+			if (offset < inode->size) {
+				memset(inode->data[0] + offset, 0, inode->size - offset);
+			}
+		}
+	}
+	else if (offset < inode->size) {				  /* 释放截掉的块，保留的最后一块清零尾部 */
+		bias = offset % NFS_BLOCK_SIZE;
+		blk  = NFS_BLK_OF(offset);
+		if (bias) {
+			if (nfs_file_load(NULL, inode, blk, blk + 1) != NFS_ERROR_NONE) {
+				return -NFS_ERROR_IO;
+			}
+			memset(inode->data[blk] + bias, 0, NFS_BLOCK_SIZE - bias);
+			if (nfs_bmap(inode, blk, FALSE) >= 0) {
+				nfs_mark_data_dirty(inode, blk);
+			}
+			blk++;
+		}
+		if (nfs_bmap_truncate(inode, blk) != NFS_ERROR_NONE) {
+			return -NFS_ERROR_IO;
+		}
+	}
 	inode->size = offset;
+	nfs_mark_inode_dirty(inode, NFS_INODE_DIRTY);
 
 	return NFS_ERROR_NONE;
 }
 
+/**
+ * @brief 文件系统容量统计，df使用
+ * 
+ * 空闲数由位图分配器在每次分配/释放时维护，这里不扫描位图
+ * 
+ * @param path 可忽略
+ * @param stbuf 返回统计
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_statfs(const char* path, struct statvfs* stbuf) {
+	(void)path;
+	memset(stbuf, 0, sizeof(struct statvfs));
+	stbuf->f_bsize   = NFS_BLOCK_SIZE;
+	stbuf->f_frsize  = NFS_BLOCK_SIZE;
+	stbuf->f_blocks  = nfs_super.max_data;
+	stbuf->f_bfree   = nfs_super.data_bm.nfree + nfs_ext_rsv_count();	/* 预留窗口中的块仍可分配 */
+	stbuf->f_bavail  = stbuf->f_bfree;
+	stbuf->f_files   = nfs_super.max_ino;
+	stbuf->f_ffree   = nfs_super.inode_bm.nfree;
+	stbuf->f_favail  = nfs_super.inode_bm.nfree;
+	stbuf->f_namemax = NFS_MAX_FILE_NAME - 1;
+	return NFS_ERROR_NONE;
+}
 
 /**
  * @brief 访问文件，因为读写文件时需要查看权限
@@ -507,6 +940,7 @@ int main(int argc, char **argv)
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 
 	nfs_options.device = strdup("/home/students/220110112/ddriver");
+	nfs_options.cache_blks = NFS_CACHE_DEFAULT_BLKS;
 
 	if (fuse_opt_parse(&args, &nfs_options, option_spec, NULL) == -1)
 		return -1;
@@ -0,0 +1,195 @@
+#include "../include/newfs.h"
+#include <endian.h>
+
+/******************************************************************************
+* SECTION: 位图分配器
+* map_inode与map_data共用，位图格式与磁盘相同(第i位为map[i/8]的第i%8位)：
+*   1) 按64位字扫描，用ctz找字内第一个空闲位
+*   2) next-fit: 从上次分配的位置之后继续找，找到末尾后绕回开头；
+*      调用者给出期望位置时从该位置找，使同一文件的块尽量连续
+*   3) 按下标置位/清位为O(1)，同时维护空闲计数，并按位图块记录脏标记，
+*      写回时只写修改过的块
+*******************************************************************************/
+#define NFS_BM_WORD_BITS        64
+
+static inline uint64_t nfs_bm_load(struct nfs_bitmap *bm, int word)
+{
+    uint64_t w;
+
+    memcpy(&w, bm->map + word * sizeof(uint64_t), sizeof(uint64_t));
+    return le64toh(w);
+}
+
+/**
+ * @brief 第word个字中有效位的掩码，最后一个字可能不满
+ */
+static inline uint64_t nfs_bm_valid(struct nfs_bitmap *bm, int word)
+{
+    int bits = bm->nbits - word * NFS_BM_WORD_BITS;
+
+    return bits >= NFS_BM_WORD_BITS ? ~0ULL : (1ULL << bits) - 1;
+}
+
+/**
+ * @brief 绑定位图内容并设置空闲计数
+ *
+ * @param bm
+ * @param map 位图内容，长度至少为nbits向上取整到64位
+ * @param nbits 有效位数
+ * @param nfree 已知的空闲位数(如super中持久化的计数)，< 0 或不合理时重新统计
+ */
+void nfs_bitmap_init(struct nfs_bitmap *bm, uint8_t *map, int nbits, int nfree)
+{
+    int words = (nbits + NFS_BM_WORD_BITS - 1) / NFS_BM_WORD_BITS;
+    int used = 0;
+    int i;
+
+    bm->map = map;
+    bm->nbits = nbits;
+    bm->hint = 0;
+    bm->dirty = 0;
+    if (nfree >= 0 && nfree <= nbits)
+    {
+        bm->nfree = nfree;
+        return;
+    }
+    for (i = 0; i < words; i++)
+    {
+        used += __builtin_popcountll(nfs_bm_load(bm, i) & nfs_bm_valid(bm, i));
+    }
+    bm->nfree = nbits - used;
+}
+
+/**
+ * @brief 分配一个空闲位并置位
+ *
+ * @param bm
+ * @return int 分配到的下标，没有空闲位时返回-NFS_ERROR_NOSPACE
+ */
+int nfs_bitmap_alloc(struct nfs_bitmap *bm)
+{
+    int words = (bm->nbits + NFS_BM_WORD_BITS - 1) / NFS_BM_WORD_BITS;
+    int start = bm->hint / NFS_BM_WORD_BITS;
+    uint64_t free_bits;
+    int i, word, idx;
+
+    if (bm->nfree <= 0)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    /* 多扫一次起始字，覆盖其中位于hint之前的位 */
+    for (i = 0; i <= words; i++)
+    {
+        word = (start + i) % words;
+        free_bits = ~nfs_bm_load(bm, word) & nfs_bm_valid(bm, word);
+        if (i == 0)
+        {   /* 起始字只看hint及之后的位 */
+            free_bits &= ~0ULL << (bm->hint % NFS_BM_WORD_BITS);
+        }
+        if (free_bits)
+        {
+            idx = word * NFS_BM_WORD_BITS + __builtin_ctzll(free_bits);
+            nfs_bitmap_set(bm, idx);
+            bm->hint = idx + 1 < bm->nbits ? idx + 1 : 0;
+            return idx;
+        }
+    }
+    return -NFS_ERROR_NOSPACE;
+}
+
+/**
+ * @brief 优先分配goal，goal已占用时从goal之后找最近的空闲位
+ *
+ * @param bm
+ * @param goal 期望的下标，如文件上一块之后的位置，< 0表示没有期望
+ * @return int 分配到的下标，没有空闲位时返回-NFS_ERROR_NOSPACE
+ */
+int nfs_bitmap_alloc_near(struct nfs_bitmap *bm, int goal)
+{
+    if (goal >= 0 && goal < bm->nbits)
+    {
+        if (!nfs_bitmap_test(bm, goal))
+        {
+            nfs_bitmap_set(bm, goal);
+            return goal;
+        }
+        bm->hint = goal;
+    }
+    return nfs_bitmap_alloc(bm);
+}
+
+/**
+ * @brief 同nfs_bitmap_alloc_near找到第一个空闲位，再向后连续分配，至多want个
+ *
+ * @param bm
+ * @param goal 期望的起始下标，< 0表示没有期望
+ * @param want
+ * @param got 返回分配到的个数，至少为1
+ * @return int 起始下标，没有空闲位时返回-NFS_ERROR_NOSPACE
+ */
+int nfs_bitmap_alloc_run(struct nfs_bitmap *bm, int goal, int want, int *got)
+{
+    int start = nfs_bitmap_alloc_near(bm, goal);
+    int n = 1;
+
+    if (start < 0)
+    {
+        return start;
+    }
+    while (n < want && start + n < bm->nbits && !nfs_bitmap_test(bm, start + n))
+    {
+        nfs_bitmap_set(bm, start + n);
+        n++;
+    }
+    bm->hint = start + n < bm->nbits ? start + n : 0;
+    *got = n;
+    return start;
+}
+
+/**
+ * @brief 置位，已置位时不做任何事
+ *
+ * @param bm
+ * @param idx
+ */
+void nfs_bitmap_set(struct nfs_bitmap *bm, int idx)
+{
+    if (!nfs_bitmap_test(bm, idx))
+    {
+        bm->map[idx / UINT8_BITS] |= (uint8_t)(0x1 << (idx % UINT8_BITS));
+        bm->nfree--;
+        bm->dirty |= NFS_BM_DIRTY_BIT(idx / (NFS_BLOCK_SIZE * UINT8_BITS));
+    }
+}
+
+/**
+ * @brief 清位，已清位时不做任何事
+ *
+ * @param bm
+ * @param idx
+ */
+void nfs_bitmap_free(struct nfs_bitmap *bm, int idx)
+{
+    if (idx < 0 || idx >= bm->nbits)
+    {
+        return;
+    }
+    if (nfs_bitmap_test(bm, idx))
+    {
+        bm->map[idx / UINT8_BITS] &= (uint8_t)(~(0x1 << (idx % UINT8_BITS)));
+        bm->nfree++;
+        bm->dirty |= NFS_BM_DIRTY_BIT(idx / (NFS_BLOCK_SIZE * UINT8_BITS));
+    }
+}
+
+/**
+ * @brief 测试某位是否已置位
+ *
+ * @param bm
+ * @param idx
+ * @return boolean
+ */
+boolean nfs_bitmap_test(struct nfs_bitmap *bm, int idx)
+{
+    return (bm->map[idx / UINT8_BITS] >> (idx % UINT8_BITS)) & 0x1;
+}
@@ -0,0 +1,557 @@
+#include "../include/newfs.h"
+
+extern struct nfs_super nfs_super;
+
+/******************************************************************************
+* SECTION: 块映射
+* 文件内块号到数据块号的映射分三段：
+*   1) 前NFS_DATA_PER_FILE块为inode中的直接指针
+*   2) 之后NFS_PTRS_PER_BLK块由一级间接块ind_blk映射
+*   3) 再之后由二级间接块dind_blk映射，其中每项指向一个一级间接块
+* 间接块第一次用到时读入并挂在inode上，修改后随inode写回，块号-1表示空洞
+* 每个打开的文件缓存上次查到的末级间接块，顺序读写时不必逐级查找
+* 新建的普通文件改用extent映射(见newfs_extent.c)，这里的入口按inode分派
+*******************************************************************************/
+static struct nfs_bmap_stat nfs_bmap_stat;
+static uint32_t nfs_bmap_gen;                         /* 用于分配inode->map_gen */
+
+/**
+ * @brief 取已装入的间接块，没有则从磁盘读入
+ *
+ * @param inode
+ * @param blk 间接块的数据块号
+ * @return struct nfs_mapbuf* 出错时返回NULL
+ */
+static struct nfs_mapbuf *nfs_bmap_get(struct nfs_inode *inode, int blk)
+{
+    struct nfs_mapbuf *buf;
+
+    for (buf = inode->maps; buf; buf = buf->next)
+    {
+        if (buf->blk == blk)
+        {
+            return buf;
+        }
+    }
+    buf = (struct nfs_mapbuf *)malloc(sizeof(struct nfs_mapbuf));
+    if (buf == NULL)
+    {
+        return NULL;
+    }
+    buf->ptrs = (int *)nfs_slab_alloc(NFS_SLAB_BLK);
+    if (buf->ptrs == NULL ||
+        nfs_driver_read(NFS_DATA_OFS(blk), (uint8_t *)buf->ptrs, NFS_BLOCK_SIZE) != NFS_ERROR_NONE)
+    {
+        NFS_DBG("[%s] can't load map blk %d, ino %d\n", __func__, blk, inode->ino);
+        nfs_slab_free(NFS_SLAB_BLK, buf->ptrs);
+        free(buf);
+        return NULL;
+    }
+    buf->blk = blk;
+    buf->dirty = FALSE;
+    buf->next = inode->maps;
+    inode->maps = buf;
+    nfs_bmap_stat.map_reads++;
+    return buf;
+}
+/**
+ * @brief 分配一个新的间接块，内容全为空洞
+ *
+ * @param inode
+ * @return struct nfs_mapbuf* 没有空闲块时返回NULL
+ */
+static struct nfs_mapbuf *nfs_bmap_new(struct nfs_inode *inode)
+{
+    struct nfs_mapbuf *buf;
+    int blk = nfs_alloc_data_blk();
+
+    if (blk < 0)
+    {
+        return NULL;
+    }
+    buf = (struct nfs_mapbuf *)malloc(sizeof(struct nfs_mapbuf));
+    if (buf == NULL || (buf->ptrs = (int *)nfs_slab_alloc(NFS_SLAB_BLK)) == NULL)
+    {
+        free(buf);
+        nfs_bitmap_free(&nfs_super.data_bm, blk);
+        return NULL;
+    }
+    memset(buf->ptrs, 0xff, NFS_BLOCK_SIZE);
+    buf->blk = blk;
+    buf->dirty = TRUE;
+    buf->next = inode->maps;
+    inode->maps = buf;
+    inode->blocks++;
+    nfs_mark_inode_dirty(inode, NFS_INODE_DIRTY | NFS_INODE_DIRTY_DATA);
+    return buf;
+}
+/**
+ * @brief 丢弃一个已装入的间接块，不释放其数据块
+ *
+ * @param inode
+ * @param buf
+ */
+static void nfs_bmap_forget(struct nfs_inode *inode, struct nfs_mapbuf *buf)
+{
+    struct nfs_mapbuf **pp;
+
+    for (pp = &inode->maps; *pp; pp = &(*pp)->next)
+    {
+        if (*pp == buf)
+        {
+            *pp = buf->next;
+            break;
+        }
+    }
+    nfs_slab_free(NFS_SLAB_BLK, buf->ptrs);
+    free(buf);
+}
+/**
+ * @brief 取ref所指的间接块，ref为-1且alloc时分配一个
+ *
+ * @param inode
+ * @param ref 指向间接块块号的位置: inode中的ind_blk/dind_blk或二级间接块中的一项
+ * @param owner ref所在的间接块，ref在inode中时为NULL
+ * @param alloc
+ * @param out 返回间接块，不分配时遇到空洞返回NULL
+ * @return int
+ */
+static int nfs_bmap_level(struct nfs_inode *inode, int *ref, struct nfs_mapbuf *owner,
+                          boolean alloc, struct nfs_mapbuf **out)
+{
+    *out = NULL;
+    if (*ref == -1)
+    {
+        if (!alloc)
+        {
+            return NFS_ERROR_NONE;
+        }
+        *out = nfs_bmap_new(inode);
+        if (*out == NULL)
+        {
+            return -NFS_ERROR_NOSPACE;
+        }
+        *ref = (*out)->blk;
+        if (owner)
+        {
+            owner->dirty = TRUE;
+        }
+        return NFS_ERROR_NONE;
+    }
+    *out = nfs_bmap_get(inode, *ref);
+    return *out ? NFS_ERROR_NONE : -NFS_ERROR_IO;
+}
+/**
+ * @brief 查找映射文件内块号lblk的末级间接块，lblk不小于NFS_DATA_PER_FILE
+ *
+ * @param inode
+ * @param lblk
+ * @param alloc 中间的间接块不存在时是否分配
+ * @param leaf 返回末级间接块，不分配时遇到空洞返回NULL
+ * @param base 返回leaf映射的第一个文件内块号
+ * @return int
+ */
+static int nfs_bmap_leaf(struct nfs_inode *inode, int lblk, boolean alloc,
+                         struct nfs_mapbuf **leaf, int *base)
+{
+    struct nfs_mapbuf *dind;
+    int idx, ret;
+
+    lblk -= NFS_DATA_PER_FILE;
+    if (lblk < NFS_PTRS_PER_BLK)
+    {
+        *base = NFS_DATA_PER_FILE;
+        return nfs_bmap_level(inode, &inode->ind_blk, NULL, alloc, leaf);
+    }
+    idx = (lblk - NFS_PTRS_PER_BLK) / NFS_PTRS_PER_BLK;
+    *base = NFS_DATA_PER_FILE + NFS_PTRS_PER_BLK + idx * NFS_PTRS_PER_BLK;
+    ret = nfs_bmap_level(inode, &inode->dind_blk, NULL, alloc, &dind);
+    if (ret != NFS_ERROR_NONE || dind == NULL)
+    {
+        *leaf = NULL;
+        return ret;
+    }
+    return nfs_bmap_level(inode, &dind->ptrs[idx], dind, alloc, leaf);
+}
+/**
+ * @brief 读取或分配一个映射项
+ *
+ * @param inode
+ * @param slot 映射项
+ * @param owner slot所在的间接块，直接指针时为NULL
+ * @param alloc
+ * @return int 数据块号，空洞返回-1
+ */
+static int nfs_bmap_slot(struct nfs_inode *inode, int *slot, struct nfs_mapbuf *owner, boolean alloc)
+{
+    int blk;
+
+    if (*slot != -1 || !alloc)
+    {
+        return *slot;
+    }
+    blk = nfs_alloc_data_blk();
+    if (blk < 0)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    *slot = blk;
+    inode->blocks++;
+    if (owner)
+    {
+        owner->dirty = TRUE;
+        nfs_mark_inode_dirty(inode, NFS_INODE_DIRTY | NFS_INODE_DIRTY_DATA);
+    }
+    else
+    {
+        nfs_mark_inode_dirty(inode, NFS_INODE_DIRTY);
+    }
+    return blk;
+}
+/**
+ * @brief 初始化inode的块映射，data等缓冲区数组在用到时才分配
+ *
+ * @param inode
+ * @param ind_blk
+ * @param dind_blk
+ * @param blocks
+ */
+void nfs_bmap_init(struct nfs_inode *inode, int ind_blk, int dind_blk, int blocks)
+{
+    inode->ind_blk = ind_blk;
+    inode->dind_blk = dind_blk;
+    inode->blocks = blocks;
+    inode->maps = NULL;
+    inode->map_gen = ++nfs_bmap_gen;
+    inode->data = NULL;
+    inode->data_ra = NULL;
+    inode->data_dirty = NULL;
+    inode->data_cap = 0;
+    nfs_ext_init(inode);
+}
+/**
+ * @brief 保证data、data_ra、data_dirty至少有nblks项，新增的项为0
+ *
+ * @param inode
+ * @param nblks
+ * @return int
+ */
+int nfs_file_reserve(struct nfs_inode *inode, int nblks)
+{
+    int cap = inode->data_cap ? inode->data_cap : NFS_DATA_PER_FILE;
+    uint8_t **data;
+    uint8_t *ra, *dirty;
+
+    if (nblks <= inode->data_cap)
+    {
+        return NFS_ERROR_NONE;
+    }
+    if (nblks > NFS_FILE_MAX_BLKS)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    while (cap < nblks)
+    {
+        cap *= 2;
+    }
+    cap = cap < NFS_FILE_MAX_BLKS ? cap : NFS_FILE_MAX_BLKS;
+
+    data = (uint8_t **)realloc(inode->data, cap * sizeof(uint8_t *));
+    if (data == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    inode->data = data;
+    ra = (uint8_t *)realloc(inode->data_ra, cap);
+    if (ra == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    inode->data_ra = ra;
+    dirty = (uint8_t *)realloc(inode->data_dirty, cap);
+    if (dirty == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    inode->data_dirty = dirty;
+
+    memset(inode->data + inode->data_cap, 0, (cap - inode->data_cap) * sizeof(uint8_t *));
+    memset(inode->data_ra + inode->data_cap, 0, cap - inode->data_cap);
+    memset(inode->data_dirty + inode->data_cap, 0, cap - inode->data_cap);
+    inode->data_cap = cap;
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 查找文件内块号对应的数据块号
+ *
+ * @param inode
+ * @param lblk 文件内块号，小于NFS_FILE_MAX_BLKS
+ * @param alloc 空洞处是否分配数据块(及所需的间接块)
+ * @return int 数据块号，不分配时空洞返回-1，出错返回负的错误号
+ */
+int nfs_bmap(struct nfs_inode *inode, int lblk, boolean alloc)
+{
+    return nfs_file_bmap(NULL, inode, lblk, alloc);
+}
+/**
+ * @brief 同nfs_bmap，经由打开文件缓存的末级间接块查找
+ *
+ * @param file 打开文件，NULL表示不使用缓存
+ * @param inode
+ * @param lblk
+ * @param alloc
+ * @return int
+ */
+int nfs_file_bmap(struct nfs_file *file, struct nfs_inode *inode, int lblk, boolean alloc)
+{
+    struct nfs_mapbuf *leaf;
+    int base, ret;
+
+    if (NFS_IS_EXTENT(inode))
+    {
+        return nfs_ext_map(file, inode, lblk, alloc);
+    }
+    if (lblk < NFS_DATA_PER_FILE)
+    {
+        return nfs_bmap_slot(inode, &inode->block_pointer[lblk], NULL, alloc);
+    }
+    if (file && file->bmap_buf && file->bmap_inode == inode && file->bmap_gen == inode->map_gen &&
+        lblk >= file->bmap_base && lblk < file->bmap_base + NFS_PTRS_PER_BLK)
+    {
+        nfs_bmap_stat.hits++;
+        return nfs_bmap_slot(inode, &file->bmap_buf->ptrs[lblk - file->bmap_base], file->bmap_buf, alloc);
+    }
+    nfs_bmap_stat.misses++;
+    ret = nfs_bmap_leaf(inode, lblk, alloc, &leaf, &base);
+    if (ret != NFS_ERROR_NONE)
+    {
+        return ret;
+    }
+    if (leaf == NULL)
+    {
+        return -1;
+    }
+    if (file)
+    {
+        file->bmap_inode = inode;
+        file->bmap_gen = inode->map_gen;
+        file->bmap_base = base;
+        file->bmap_buf = leaf;
+    }
+    return nfs_bmap_slot(inode, &leaf->ptrs[lblk - base], leaf, alloc);
+}
+/**
+ * @brief 写回修改过的间接块
+ *
+ * @param inode
+ * @return int
+ */
+int nfs_bmap_sync(struct nfs_inode *inode)
+{
+    struct nfs_mapbuf *buf;
+
+    if (NFS_IS_EXTENT(inode))
+    {
+        return nfs_ext_sync(inode);
+    }
+    for (buf = inode->maps; buf; buf = buf->next)
+    {
+        if (!buf->dirty)
+        {
+            continue;
+        }
+        if (nfs_driver_write(NFS_DATA_OFS(buf->blk), (uint8_t *)buf->ptrs,
+                             NFS_BLOCK_SIZE) != NFS_ERROR_NONE ||
+            nfs_driver_flush(NFS_DATA_OFS(buf->blk), NFS_BLOCK_SIZE) != NFS_ERROR_NONE)
+        {
+            NFS_DBG("[%s] io error\n", __func__);
+            return -NFS_ERROR_IO;
+        }
+        buf->dirty = FALSE;
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 释放一个数据块并将映射项置为空洞
+ */
+static void nfs_bmap_put(struct nfs_inode *inode, int *slot)
+{
+    if (*slot != -1)
+    {
+        nfs_bitmap_free(&nfs_super.data_bm, *slot);
+        *slot = -1;
+        inode->blocks--;
+    }
+}
+/**
+ * @brief 释放一级间接块中从第start项起映射的数据块，start <= 0时连同该间接块一起释放
+ *
+ * @param inode
+ * @param ref 指向间接块块号的位置
+ * @param owner ref所在的间接块，ref在inode中时为NULL
+ * @param start
+ * @return int
+ */
+static int nfs_bmap_trunc_ind(struct nfs_inode *inode, int *ref, struct nfs_mapbuf *owner, int start)
+{
+    struct nfs_mapbuf *buf;
+    int i;
+
+    if (*ref == -1 || start >= NFS_PTRS_PER_BLK)
+    {
+        return NFS_ERROR_NONE;
+    }
+    buf = nfs_bmap_get(inode, *ref);
+    if (buf == NULL)
+    {
+        return -NFS_ERROR_IO;
+    }
+    for (i = start > 0 ? start : 0; i < NFS_PTRS_PER_BLK; i++)
+    {
+        if (buf->ptrs[i] != -1)
+        {
+            nfs_bmap_put(inode, &buf->ptrs[i]);
+            buf->dirty = TRUE;
+        }
+    }
+    if (start <= 0)
+    {
+        nfs_bmap_forget(inode, buf);
+        nfs_bmap_put(inode, ref);
+        if (owner)
+        {
+            owner->dirty = TRUE;
+        }
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 释放文件第nblks块及之后的数据块与不再需要的间接块，丢弃对应的缓冲区
+ *
+ * @param inode
+ * @param nblks 保留的块数
+ * @return int
+ */
+int nfs_bmap_truncate(struct nfs_inode *inode, int nblks)
+{
+    struct nfs_mapbuf *dind;
+    int start, i;
+
+    nfs_ra_drain(inode);                              /* 在途的预读可能落在要释放的块上 */
+    if (NFS_IS_EXTENT(inode))
+    {
+        if (nfs_ext_truncate(inode, nblks) != NFS_ERROR_NONE)
+        {
+            return -NFS_ERROR_IO;
+        }
+        start = NFS_PTRS_PER_BLK * NFS_PTRS_PER_BLK;  /* 跳过间接块 */
+    }
+    else
+    {
+        for (i = nblks; i < NFS_DATA_PER_FILE; i++)
+        {
+            nfs_bmap_put(inode, &inode->block_pointer[i]);
+        }
+        if (nfs_bmap_trunc_ind(inode, &inode->ind_blk, NULL,
+                               nblks - NFS_DATA_PER_FILE) != NFS_ERROR_NONE)
+        {
+            return -NFS_ERROR_IO;
+        }
+        start = nblks - NFS_DATA_PER_FILE - NFS_PTRS_PER_BLK;
+    }
+    if (inode->dind_blk != -1 && start < NFS_PTRS_PER_BLK * NFS_PTRS_PER_BLK)
+    {
+        dind = nfs_bmap_get(inode, inode->dind_blk);
+        if (dind == NULL)
+        {
+            return -NFS_ERROR_IO;
+        }
+        for (i = 0; i < NFS_PTRS_PER_BLK; i++)
+        {
+            if (nfs_bmap_trunc_ind(inode, &dind->ptrs[i], dind,
+                                   start - i * NFS_PTRS_PER_BLK) != NFS_ERROR_NONE)
+            {
+                return -NFS_ERROR_IO;
+            }
+        }
+        if (start <= 0)
+        {
+            nfs_bmap_forget(inode, dind);
+            nfs_bmap_put(inode, &inode->dind_blk);
+        }
+    }
+
+    for (i = nblks > 0 ? nblks : 0; i < inode->data_cap; i++)
+    {
+        nfs_slab_free(NFS_SLAB_BLK, inode->data[i]);
+        inode->data[i] = NULL;
+        inode->data_ra[i] = FALSE;
+        inode->data_dirty[i] = FALSE;
+    }
+    inode->map_gen = ++nfs_bmap_gen;                  /* 打开文件缓存的间接块可能已被释放 */
+    nfs_mark_inode_dirty(inode, NFS_INODE_DIRTY | NFS_INODE_DIRTY_DATA);
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 释放inode的间接块与数据缓冲区，不改动磁盘上的映射
+ *
+ * @param inode
+ */
+void nfs_bmap_release(struct nfs_inode *inode)
+{
+    struct nfs_mapbuf *buf, *next;
+    int i;
+
+    nfs_ra_drain(inode);
+    for (buf = inode->maps; buf; buf = next)
+    {
+        next = buf->next;
+        nfs_slab_free(NFS_SLAB_BLK, buf->ptrs);
+        free(buf);
+    }
+    for (i = 0; i < inode->data_cap; i++)
+    {
+        nfs_slab_free(NFS_SLAB_BLK, inode->data[i]);
+    }
+    free(inode->data);
+    free(inode->data_ra);
+    free(inode->data_dirty);
+    nfs_ext_release(inode);
+    nfs_bmap_init(inode, inode->ind_blk, inode->dind_blk, inode->blocks);
+}
+/**
+ * @brief 释放以dentry为根的已读入inode的块映射与目录索引，卸载时在整体释放slab前调用
+ *
+ * @param dentry
+ */
+void nfs_bmap_release_all(struct nfs_dentry *dentry)
+{
+    struct nfs_dentry *child;
+
+    if (dentry->inode == NULL)
+    {
+        return;
+    }
+    if (NFS_IS_DIR(dentry->inode))
+    {
+        for (child = dentry->inode->dentrys; child; child = child->brother)
+        {
+            nfs_bmap_release_all(child);
+        }
+        nfs_dir_hash_free(dentry->inode);
+    }
+    nfs_bmap_release(dentry->inode);
+}
+/**
+ * @brief 打印块映射缓存命中统计
+ *
+ */
+void nfs_bmap_dump()
+{
+    uint64_t total = nfs_bmap_stat.hits + nfs_bmap_stat.misses;
+
+    NFS_DBG("[%s] indirect lookups %lu, hits %lu (%.2f%% hit), map blks read %lu\n",
+            __func__, (unsigned long)total, (unsigned long)nfs_bmap_stat.hits,
+            total ? 100.0 * nfs_bmap_stat.hits / total : 0.0,
+            (unsigned long)nfs_bmap_stat.map_reads);
+}
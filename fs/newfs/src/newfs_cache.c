@@ -0,0 +1,443 @@
+#include "../include/newfs.h"
+
+extern struct nfs_super nfs_super;
+
+/******************************************************************************
+* SECTION: 块缓存
+* 以逻辑块(NFS_BLOCK_SIZE)为单位缓存磁盘内容，写回(write-back)策略：
+*   1) 读写先查缓存，命中直接返回，未命中从磁盘装入
+*   2) 写只修改缓存并置DIRTY，淘汰或sync时才写回磁盘
+*   3) 淘汰采用LRU
+*******************************************************************************/
+static struct nfs_cache nfs_cache;
+
+static inline void nfs_lru_unlink(struct nfs_buf *buf)
+{
+    buf->lru_prev->lru_next = buf->lru_next;
+    buf->lru_next->lru_prev = buf->lru_prev;
+}
+
+static inline void nfs_lru_push_front(struct nfs_buf *buf)
+{
+    buf->lru_next = nfs_cache.lru.lru_next;
+    buf->lru_prev = &nfs_cache.lru;
+    nfs_cache.lru.lru_next->lru_prev = buf;
+    nfs_cache.lru.lru_next = buf;
+}
+
+static inline int nfs_hash_blk(int blk)
+{
+    return blk % nfs_cache.hash_sz;
+}
+
+static void nfs_hash_remove(struct nfs_buf *buf)
+{
+    struct nfs_buf **pprev = &nfs_cache.hash[nfs_hash_blk(buf->blk)];
+    while (*pprev)
+    {
+        if (*pprev == buf)
+        {
+            *pprev = buf->hash_next;
+            break;
+        }
+        pprev = &(*pprev)->hash_next;
+    }
+    buf->hash_next = NULL;
+}
+
+static struct nfs_buf *nfs_hash_find(int blk)
+{
+    struct nfs_buf *buf = nfs_cache.hash[nfs_hash_blk(blk)];
+    while (buf)
+    {
+        if (buf->blk == blk)
+        {
+            return buf;
+        }
+        buf = buf->hash_next;
+    }
+    return NULL;
+}
+
+/**
+ * @brief 将脏块写回磁盘
+ *
+ * @param buf
+ * @return int
+ */
+static int nfs_cache_writeback(struct nfs_buf *buf)
+{
+    if (!(buf->flag & NFS_FLAG_BUF_DIRTY))
+    {
+        return NFS_ERROR_NONE;
+    }
+    if (nfs_ioq_plugged())
+    {   /* 交给刷写队列排序合并后再下发 */
+        if (nfs_ioq_add(buf->blk, buf->data) != NFS_ERROR_NONE)
+        {
+            return -NFS_ERROR_IO;
+        }
+    }
+    else if (nfs_dev_write(NFS_BLKS_SZ(buf->blk), buf->data, NFS_BLOCK_SIZE) != NFS_ERROR_NONE)
+    {
+        NFS_DBG("[%s] io error, blk %d\n", __func__, buf->blk);
+        return -NFS_ERROR_IO;
+    }
+    buf->flag &= ~NFS_FLAG_BUF_DIRTY;
+    nfs_cache.writebacks++;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 获取逻辑块blk对应的缓存块，未命中时淘汰LRU尾部的块
+ *
+ * @param blk 逻辑块号
+ * @param load 未命中时是否需要从磁盘装入内容
+ * @return struct nfs_buf* 出错返回NULL
+ */
+static struct nfs_buf *nfs_cache_get(int blk, boolean load)
+{
+    struct nfs_buf *buf = nfs_hash_find(blk);
+    uint8_t *queued;
+
+    if (buf)
+    {
+        nfs_cache.hits++;
+        nfs_lru_unlink(buf);
+        nfs_lru_push_front(buf);
+        return buf;
+    }
+
+    nfs_cache.misses++;
+    buf = nfs_cache.lru.lru_prev; /* LRU尾部 */
+    if (buf->flag & NFS_FLAG_BUF_OCCUPY)
+    {
+        if (nfs_cache_writeback(buf) != NFS_ERROR_NONE)
+        {
+            return NULL;
+        }
+        nfs_hash_remove(buf);
+        buf->flag = 0;
+        nfs_cache.evictions++;
+    }
+
+    if (load)
+    {
+        queued = nfs_ioq_lookup(blk);
+        if (queued)
+        {   /* 该块已被淘汰但仍在刷写队列中，磁盘上的内容是旧的 */
+            memcpy(buf->data, queued, NFS_BLOCK_SIZE);
+        }
+        else if (nfs_dev_read(NFS_BLKS_SZ(blk), buf->data, NFS_BLOCK_SIZE) != NFS_ERROR_NONE)
+        {
+            NFS_DBG("[%s] io error, blk %d\n", __func__, blk);
+            return NULL;
+        }
+    }
+
+    buf->blk = blk;
+    buf->flag = NFS_FLAG_BUF_OCCUPY;
+    buf->hash_next = nfs_cache.hash[nfs_hash_blk(blk)];
+    nfs_cache.hash[nfs_hash_blk(blk)] = buf;
+    nfs_lru_unlink(buf);
+    nfs_lru_push_front(buf);
+    return buf;
+}
+
+/**
+ * @brief 丢弃缓存块，用于装入失败的块
+ *
+ * @param buf
+ */
+static void nfs_cache_invalidate(struct nfs_buf *buf)
+{
+    nfs_hash_remove(buf);
+    buf->flag = 0;
+    buf->blk = -1;
+    nfs_lru_unlink(buf);
+    buf->lru_prev = nfs_cache.lru.lru_prev;
+    buf->lru_next = &nfs_cache.lru;
+    nfs_cache.lru.lru_prev->lru_next = buf;
+    nfs_cache.lru.lru_prev = buf;
+}
+/**
+ * @brief 从blk起连续未缓存的块一次装入，顺序读/预读时减少设备请求数
+ *
+ * @param blk 第一个块，调用者已确认未命中
+ * @param max 最多装入的块数
+ * @param run 返回装入的缓存块
+ * @return int 装入的块数，0表示blk在刷写队列中需走单块路径，出错返回负数
+ */
+static int nfs_cache_load_run(int blk, int max, struct nfs_buf **run)
+{
+    struct iovec iov[NFS_RA_MAX_BLKS];
+    int n = 0;
+    int i;
+
+    /* 不超过容量的一半，保证装入时不会淘汰同一批的块 */
+    if (max > NFS_RA_MAX_BLKS)
+    {
+        max = NFS_RA_MAX_BLKS;
+    }
+    if (max > nfs_cache.capacity / 2)
+    {
+        max = nfs_cache.capacity / 2 > 0 ? nfs_cache.capacity / 2 : 1;
+    }
+    while (n < max && nfs_hash_find(blk + n) == NULL && nfs_ioq_lookup(blk + n) == NULL)
+    {
+        n++;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        run[i] = nfs_cache_get(blk + i, FALSE);
+        if (run[i] == NULL)
+        {
+            n = i;
+            break;
+        }
+        iov[i].iov_base = run[i]->data;
+        iov[i].iov_len = NFS_BLOCK_SIZE;
+    }
+    if (i < n || (n > 0 && ddriver_preadv(NFS_DRIVER(), iov, n, NFS_BLKS_SZ(blk)) != NFS_BLKS_SZ(n)))
+    {
+        NFS_DBG("[%s] io error, blk %d\n", __func__, blk);
+        for (i = 0; i < n; i++)
+        {
+            nfs_cache_invalidate(run[i]);
+        }
+        return -NFS_ERROR_IO;
+    }
+    return n;
+}
+/**
+ * @brief 初始化块缓存
+ *
+ * @param capacity 缓存块数，<= 0 则不启用缓存
+ * @return int
+ */
+int nfs_cache_init(int capacity)
+{
+    int i;
+
+    memset(&nfs_cache, 0, sizeof(struct nfs_cache));
+    nfs_cache.lru.lru_next = &nfs_cache.lru;
+    nfs_cache.lru.lru_prev = &nfs_cache.lru;
+    if (capacity <= 0)
+    {
+        return NFS_ERROR_NONE;
+    }
+
+    nfs_cache.hash_sz = capacity * 2 + 1;
+    nfs_cache.bufs = (struct nfs_buf *)calloc(capacity, sizeof(struct nfs_buf));
+    nfs_cache.hash = (struct nfs_buf **)calloc(nfs_cache.hash_sz, sizeof(struct nfs_buf *));
+    /* 按IO单元对齐，写回时可直接交给设备而无需中转 */
+    if (posix_memalign((void **)&nfs_cache.pool, NFS_IO_SZ(), NFS_BLKS_SZ(capacity)) != 0)
+    {
+        nfs_cache.pool = NULL;
+    }
+    if (!nfs_cache.bufs || !nfs_cache.pool || !nfs_cache.hash)
+    {
+        nfs_cache_destroy();
+        return -NFS_ERROR_NOSPACE;
+    }
+
+    for (i = 0; i < capacity; i++)
+    {
+        nfs_cache.bufs[i].blk = -1;
+        nfs_cache.bufs[i].data = nfs_cache.pool + NFS_BLKS_SZ(i);
+        nfs_lru_push_front(&nfs_cache.bufs[i]);
+    }
+    nfs_cache.capacity = capacity;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 是否启用了块缓存
+ *
+ * @return boolean
+ */
+boolean nfs_cache_enabled()
+{
+    return nfs_cache.capacity > 0;
+}
+
+/**
+ * @brief 块在缓存中时拷贝其内容，绕过缓存读入的块据此取得尚未写回的修改
+ *
+ * @param blk 逻辑块号
+ * @param out_content NFS_BLOCK_SIZE大小
+ * @return boolean 块在缓存中
+ */
+boolean nfs_cache_peek(int blk, uint8_t *out_content)
+{
+    struct nfs_buf *buf;
+
+    if (!nfs_cache_enabled() || (buf = nfs_hash_find(blk)) == NULL)
+    {
+        return FALSE;
+    }
+    memcpy(out_content, buf->data, NFS_BLOCK_SIZE);
+    return TRUE;
+}
+
+/**
+ * @brief 经缓存读，offset与size不需要对齐
+ *
+ * @param offset
+ * @param out_content
+ * @param size
+ * @return int
+ */
+int nfs_cache_read(int offset, uint8_t *out_content, int size)
+{
+    struct nfs_buf *run[NFS_RA_MAX_BLKS];
+    struct nfs_buf *buf;
+    int nrun = 0, irun = 0;
+    int bias, len, blk;
+
+    while (size > 0)
+    {
+        bias = offset % NFS_BLOCK_SIZE;
+        len = NFS_BLOCK_SIZE - bias < size ? NFS_BLOCK_SIZE - bias : size;
+        blk = NFS_BLK_OF(offset);
+        if (irun == nrun)
+        {   /* 未命中时把后续连续未命中的块一起装入 */
+            irun = 0;
+            nrun = nfs_hash_find(blk) ? 0 : nfs_cache_load_run(blk, NFS_BLK_OF(offset + size - 1) + 1 - blk, run);
+            if (nrun < 0)
+            {
+                return -NFS_ERROR_IO;
+            }
+        }
+        buf = irun < nrun ? run[irun++] : nfs_cache_get(blk, TRUE);
+        if (buf == NULL)
+        {
+            return -NFS_ERROR_IO;
+        }
+        memcpy(out_content, buf->data + bias, len);
+        out_content += len;
+        offset += len;
+        size -= len;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 经缓存写，只修改缓存块并置脏
+ *
+ * @param offset
+ * @param in_content
+ * @param size
+ * @return int
+ */
+int nfs_cache_write(int offset, uint8_t *in_content, int size)
+{
+    struct nfs_buf *buf;
+    int bias, len;
+
+    while (size > 0)
+    {
+        bias = offset % NFS_BLOCK_SIZE;
+        len = NFS_BLOCK_SIZE - bias < size ? NFS_BLOCK_SIZE - bias : size;
+        /* 整块覆盖时无需先从磁盘装入 */
+        buf = nfs_cache_get(NFS_BLK_OF(offset), len != NFS_BLOCK_SIZE);
+        if (buf == NULL)
+        {
+            return -NFS_ERROR_IO;
+        }
+        memcpy(buf->data + bias, in_content, len);
+        buf->flag |= NFS_FLAG_BUF_DIRTY;
+        in_content += len;
+        offset += len;
+        size -= len;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 将所有脏块写回磁盘，经刷写队列按块号顺序合并下发
+ *
+ * @return int
+ */
+int nfs_cache_sync()
+{
+    int i;
+    int ret = NFS_ERROR_NONE;
+
+    nfs_ioq_plug();
+    for (i = 0; i < nfs_cache.capacity; i++)
+    {
+        if (nfs_cache_writeback(&nfs_cache.bufs[i]) != NFS_ERROR_NONE)
+        {
+            ret = -NFS_ERROR_IO;
+        }
+    }
+    if (nfs_ioq_unplug() != NFS_ERROR_NONE)
+    {
+        ret = -NFS_ERROR_IO;
+    }
+    return ret;
+}
+
+/**
+ * @brief 写回一个脏缓存块，不在缓存中或不脏时什么也不做；
+ * fsync只写回属于该文件的块，不必像nfs_cache_sync那样扫描整个缓存
+ *
+ * @param blk 逻辑块号
+ * @return int
+ */
+int nfs_cache_sync_blk(int blk)
+{
+    struct nfs_buf *buf;
+
+    if (!nfs_cache_enabled() || (buf = nfs_hash_find(blk)) == NULL)
+    {
+        return NFS_ERROR_NONE;
+    }
+    return nfs_cache_writeback(buf);
+}
+
+/**
+ * @brief 释放块缓存，调用前需先nfs_cache_sync
+ *
+ */
+void nfs_cache_destroy()
+{
+    free(nfs_cache.bufs);
+    free(nfs_cache.pool);
+    free(nfs_cache.hash);
+    nfs_cache.bufs = NULL;
+    nfs_cache.pool = NULL;
+    nfs_cache.hash = NULL;
+    nfs_cache.capacity = 0;
+}
+
+/**
+ * @brief 打印缓存命中统计，用于调整缓存容量
+ *
+ */
+void nfs_cache_dump()
+{
+    uint64_t total = nfs_cache.hits + nfs_cache.misses;
+
+    NFS_DBG("[%s] capacity %d blks, hits %lu, misses %lu (%.2f%% hit), evictions %lu, writebacks %lu\n",
+            __func__, nfs_cache.capacity,
+            (unsigned long)nfs_cache.hits, (unsigned long)nfs_cache.misses,
+            total ? 100.0 * nfs_cache.hits / total : 0.0,
+            (unsigned long)nfs_cache.evictions, (unsigned long)nfs_cache.writebacks);
+}
+
+/**
+ * @brief 获取缓存统计计数
+ *
+ * @param hits
+ * @param misses
+ * @param evictions
+ */
+void nfs_cache_stat(uint64_t *hits, uint64_t *misses, uint64_t *evictions)
+{
+    *hits = nfs_cache.hits;
+    *misses = nfs_cache.misses;
+    *evictions = nfs_cache.evictions;
+}
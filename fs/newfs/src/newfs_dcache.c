@@ -0,0 +1,270 @@
+#include "../include/newfs.h"
+
+/******************************************************************************
+* SECTION: 路径缓存
+* FUSE传入的都是绝对路径，按完整路径缓存nfs_resolve的结果：
+*   1) 正项: 路径 -> 目录项及其父目录项
+*   2) 负项: 路径不存在，记录错误号与最后一个存在的目录项 (touch、cp会先探测不存在的文件名)
+*   3) 创建、删除、重命名时使该路径及其下所有路径失效
+*   4) 项数固定，淘汰采用LRU
+*******************************************************************************/
+static struct nfs_dcache nfs_dcache;
+
+static inline void nfs_dcache_lru_unlink(struct nfs_dcache_ent *ent)
+{
+    ent->lru_prev->lru_next = ent->lru_next;
+    ent->lru_next->lru_prev = ent->lru_prev;
+}
+
+static inline void nfs_dcache_lru_push_front(struct nfs_dcache_ent *ent)
+{
+    ent->lru_next = nfs_dcache.lru.lru_next;
+    ent->lru_prev = &nfs_dcache.lru;
+    nfs_dcache.lru.lru_next->lru_prev = ent;
+    nfs_dcache.lru.lru_next = ent;
+}
+
+static inline void nfs_dcache_lru_push_back(struct nfs_dcache_ent *ent)
+{
+    ent->lru_prev = nfs_dcache.lru.lru_prev;
+    ent->lru_next = &nfs_dcache.lru;
+    nfs_dcache.lru.lru_prev->lru_next = ent;
+    nfs_dcache.lru.lru_prev = ent;
+}
+
+static void nfs_dcache_hash_remove(struct nfs_dcache_ent *ent)
+{
+    struct nfs_dcache_ent **pprev = &nfs_dcache.hash[ent->hash % nfs_dcache.hash_sz];
+    while (*pprev)
+    {
+        if (*pprev == ent)
+        {
+            *pprev = ent->hash_next;
+            break;
+        }
+        pprev = &(*pprev)->hash_next;
+    }
+    ent->hash_next = NULL;
+}
+
+static struct nfs_dcache_ent *nfs_dcache_find(const char *path, int len, uint32_t hash)
+{
+    struct nfs_dcache_ent *ent = nfs_dcache.hash[hash % nfs_dcache.hash_sz];
+    while (ent)
+    {
+        if (ent->hash == hash && ent->len == len && memcmp(ent->path, path, len) == 0)
+        {
+            return ent;
+        }
+        ent = ent->hash_next;
+    }
+    return NULL;
+}
+
+/**
+ * @brief 丢弃一项，放到LRU尾部优先重用
+ *
+ * @param ent
+ */
+static void nfs_dcache_drop(struct nfs_dcache_ent *ent)
+{
+    nfs_dcache_hash_remove(ent);
+    ent->len = 0;
+    ent->dentry = NULL;
+    ent->parent = NULL;
+    nfs_dcache_lru_unlink(ent);
+    nfs_dcache_lru_push_back(ent);
+    nfs_dcache.invalidations++;
+}
+
+/**
+ * @brief 初始化路径缓存
+ *
+ * @param capacity 缓存项数，<= 0 则不启用
+ * @return int
+ */
+int nfs_dcache_init(int capacity)
+{
+    int i;
+
+    memset(&nfs_dcache, 0, sizeof(struct nfs_dcache));
+    nfs_dcache.lru.lru_next = &nfs_dcache.lru;
+    nfs_dcache.lru.lru_prev = &nfs_dcache.lru;
+    if (capacity <= 0)
+    {
+        return NFS_ERROR_NONE;
+    }
+
+    nfs_dcache.hash_sz = capacity * 2 + 1;
+    nfs_dcache.ents = (struct nfs_dcache_ent *)calloc(capacity, sizeof(struct nfs_dcache_ent));
+    nfs_dcache.hash = (struct nfs_dcache_ent **)calloc(nfs_dcache.hash_sz, sizeof(struct nfs_dcache_ent *));
+    if (!nfs_dcache.ents || !nfs_dcache.hash)
+    {
+        nfs_dcache_destroy();
+        return -NFS_ERROR_NOSPACE;
+    }
+    for (i = 0; i < capacity; i++)
+    {
+        nfs_dcache_lru_push_front(&nfs_dcache.ents[i]);
+    }
+    nfs_dcache.capacity = capacity;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 查找路径缓存
+ *
+ * @param path 绝对路径
+ * @param nd 命中时填入缓存的解析结果，name指向path内部
+ * @return boolean 是否命中
+ */
+boolean nfs_dcache_lookup(const char *path, struct nfs_nameidata *nd)
+{
+    struct nfs_dcache_ent *ent;
+    int len;
+
+    if (nfs_dcache.capacity == 0)
+    {
+        return FALSE;
+    }
+    len = strlen(path);
+    if (len >= NFS_DCACHE_PATH_MAX)
+    {
+        return FALSE;
+    }
+    ent = nfs_dcache_find(path, len, nfs_name_hash(path, len));
+    if (ent == NULL)
+    {
+        nfs_dcache.misses++;
+        return FALSE;
+    }
+    if (ent->err)
+    {
+        nfs_dcache.neg_hits++;
+    }
+    else
+    {
+        nfs_dcache.hits++;
+    }
+    nfs_dcache_lru_unlink(ent);
+    nfs_dcache_lru_push_front(ent);
+
+    nd->err = ent->err;
+    nd->is_find = ent->err == NFS_ERROR_NONE;
+    nd->is_root = FALSE;                        /* 根目录不缓存 */
+    nd->dentry = ent->dentry;
+    nd->parent = ent->parent;
+    nd->name = ent->name_ofs >= 0 ? path + ent->name_ofs : NULL;
+    nd->len = ent->name_len;
+    return TRUE;
+}
+
+/**
+ * @brief 记录一次nfs_resolve的结果，只应对规范路径调用
+ *
+ * @param path 绝对路径
+ * @param nd 解析结果
+ */
+void nfs_dcache_insert(const char *path, const struct nfs_nameidata *nd)
+{
+    struct nfs_dcache_ent *ent;
+    int len;
+    uint32_t hash;
+
+    if (nfs_dcache.capacity == 0 || nd->is_root || nd->dentry == NULL)
+    {
+        return;
+    }
+    len = strlen(path);
+    if (len >= NFS_DCACHE_PATH_MAX)
+    {
+        return;
+    }
+    hash = nfs_name_hash(path, len);
+    ent = nfs_dcache_find(path, len, hash);
+    if (ent == NULL)
+    {
+        ent = nfs_dcache.lru.lru_prev; /* LRU尾部 */
+        if (ent->len > 0)
+        {
+            nfs_dcache_hash_remove(ent);
+        }
+        memcpy(ent->path, path, len + 1);
+        ent->len = len;
+        ent->hash = hash;
+        ent->hash_next = nfs_dcache.hash[hash % nfs_dcache.hash_sz];
+        nfs_dcache.hash[hash % nfs_dcache.hash_sz] = ent;
+    }
+    ent->err = nd->err;
+    ent->dentry = nd->dentry;
+    ent->parent = nd->parent;
+    ent->name_ofs = nd->name ? nd->name - path : -1;
+    ent->name_len = nd->len;
+    nfs_dcache_lru_unlink(ent);
+    nfs_dcache_lru_push_front(ent);
+}
+
+/**
+ * @brief 使path及其下所有路径失效，在创建、删除、重命名path之前或之后调用
+ *
+ * @param path 绝对路径
+ */
+void nfs_dcache_invalidate(const char *path)
+{
+    struct nfs_dcache_ent *ent;
+    int len = strlen(path);
+    int i;
+
+    if (nfs_dcache.capacity == 0)
+    {
+        return;
+    }
+    if (len >= NFS_DCACHE_PATH_MAX)
+    {   /* 下面不会有缓存项 */
+        return;
+    }
+    ent = nfs_dcache_find(path, len, nfs_name_hash(path, len));
+    if (ent)
+    {
+        nfs_dcache_drop(ent);
+    }
+    for (i = 0; i < nfs_dcache.capacity; i++)
+    {
+        ent = &nfs_dcache.ents[i];
+        if (ent->len > len && ent->path[len] == '/' && memcmp(ent->path, path, len) == 0)
+        {
+            nfs_dcache_drop(ent);
+        }
+    }
+}
+
+/**
+ * @brief 释放路径缓存
+ *
+ */
+void nfs_dcache_destroy()
+{
+    free(nfs_dcache.ents);
+    free(nfs_dcache.hash);
+    nfs_dcache.ents = NULL;
+    nfs_dcache.hash = NULL;
+    nfs_dcache.capacity = 0;
+    nfs_dcache.lru.lru_next = &nfs_dcache.lru;
+    nfs_dcache.lru.lru_prev = &nfs_dcache.lru;
+}
+
+/**
+ * @brief 打印路径缓存统计
+ *
+ */
+void nfs_dcache_dump()
+{
+    uint64_t total = nfs_dcache.hits + nfs_dcache.neg_hits + nfs_dcache.misses;
+
+    NFS_DBG("[%s] capacity %d, hits %lu, negative hits %lu, misses %lu (%.2f%% hit), invalidations %lu\n",
+            __func__, nfs_dcache.capacity,
+            (unsigned long)nfs_dcache.hits, (unsigned long)nfs_dcache.neg_hits,
+            (unsigned long)nfs_dcache.misses,
+            total ? 100.0 * (nfs_dcache.hits + nfs_dcache.neg_hits) / total : 0.0,
+            (unsigned long)nfs_dcache.invalidations);
+}
@@ -0,0 +1,352 @@
+#include "../include/newfs.h"
+
+extern struct nfs_super nfs_super;
+
+/******************************************************************************
+* SECTION: 目录索引
+* 每个内存中的目录inode带一张 文件名 -> 子dentry 的哈希表：
+*   1) 第一次按名查找时由dentrys链表建立，之后由nfs_alloc_dentry/nfs_drop_dentry维护
+*   2) 表项数超过桶数时桶数翻倍
+*   3) dentrys链表仍保留，只用于readdir、sync等有序遍历
+*******************************************************************************/
+static inline int nfs_dir_bucket(struct nfs_inode *inode, const char *name, int len)
+{
+    return nfs_name_hash(name, len) & (inode->dhash_sz - 1);
+}
+
+/**
+ * @brief 将桶数扩为hash_sz并重新散列
+ *
+ * @param inode
+ * @param hash_sz 2的幂
+ * @return int
+ */
+static int nfs_dir_hash_resize(struct nfs_inode *inode, int hash_sz)
+{
+    struct nfs_dentry **hash = (struct nfs_dentry **)calloc(hash_sz, sizeof(struct nfs_dentry *));
+    struct nfs_dentry **old = inode->dhash;
+    struct nfs_dentry *dentry, *next;
+    int old_sz = inode->dhash_sz;
+    int i, b;
+
+    if (hash == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    inode->dhash = hash;
+    inode->dhash_sz = hash_sz;
+    for (i = 0; i < old_sz; i++)
+    {
+        for (dentry = old[i]; dentry; dentry = next)
+        {
+            next = dentry->hash_next;
+            b = nfs_dir_bucket(inode, dentry->fname, strlen(dentry->fname));
+            dentry->hash_next = hash[b];
+            hash[b] = dentry;
+        }
+    }
+    free(old);
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 由dentrys链表建立目录索引
+ *
+ * @param inode 目录inode
+ * @return int
+ */
+static int nfs_dir_hash_build(struct nfs_inode *inode)
+{
+    struct nfs_dentry *dentry;
+    int hash_sz = NFS_DIR_HASH_MIN;
+    int b;
+
+    while (hash_sz < inode->dir_cnt)
+    {
+        hash_sz <<= 1;
+    }
+    inode->dhash = (struct nfs_dentry **)calloc(hash_sz, sizeof(struct nfs_dentry *));
+    if (inode->dhash == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    inode->dhash_sz = hash_sz;
+    inode->dhash_cnt = 0;
+    for (dentry = inode->dentrys; dentry; dentry = dentry->brother)
+    {
+        b = nfs_dir_bucket(inode, dentry->fname, strlen(dentry->fname));
+        dentry->hash_next = inode->dhash[b];
+        inode->dhash[b] = dentry;
+        inode->dhash_cnt++;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 在目录中按名查找子目录项
+ *
+ * @param inode 目录inode
+ * @param name 文件名，不要求以'\0'结尾
+ * @param len 文件名长度
+ * @return struct nfs_dentry* 找不到返回NULL
+ */
+struct nfs_dentry *nfs_dir_find(struct nfs_inode *inode, const char *name, int len)
+{
+    struct nfs_dentry *dentry;
+
+    if (len >= NFS_MAX_FILE_NAME)
+    {
+        return NULL;
+    }
+    if (inode->dhash == NULL && nfs_dir_hash_build(inode) != NFS_ERROR_NONE)
+    {   /* 建表失败时退回顺序查找 */
+        for (dentry = inode->dentrys; dentry; dentry = dentry->brother)
+        {
+            if (memcmp(dentry->fname, name, len) == 0 && dentry->fname[len] == '\0')
+            {
+                return dentry;
+            }
+        }
+        return NULL;
+    }
+    for (dentry = inode->dhash[nfs_dir_bucket(inode, name, len)]; dentry; dentry = dentry->hash_next)
+    {
+        if (memcmp(dentry->fname, name, len) == 0 && dentry->fname[len] == '\0')
+        {
+            return dentry;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 目录新增子目录项后更新索引，索引尚未建立时不做任何事
+ *
+ * @param inode 目录inode
+ * @param dentry
+ */
+void nfs_dir_hash_insert(struct nfs_inode *inode, struct nfs_dentry *dentry)
+{
+    int b;
+
+    if (inode->dhash == NULL)
+    {
+        return;
+    }
+    if (inode->dhash_cnt >= inode->dhash_sz &&
+        nfs_dir_hash_resize(inode, inode->dhash_sz << 1) != NFS_ERROR_NONE)
+    {   /* 扩容失败则丢弃索引，下次查找时重建 */
+        nfs_dir_hash_free(inode);
+        return;
+    }
+    b = nfs_dir_bucket(inode, dentry->fname, strlen(dentry->fname));
+    dentry->hash_next = inode->dhash[b];
+    inode->dhash[b] = dentry;
+    inode->dhash_cnt++;
+}
+
+/**
+ * @brief 目录删除子目录项后更新索引
+ *
+ * @param inode 目录inode
+ * @param dentry
+ */
+void nfs_dir_hash_remove(struct nfs_inode *inode, struct nfs_dentry *dentry)
+{
+    struct nfs_dentry **pprev;
+
+    if (inode->dhash == NULL)
+    {
+        return;
+    }
+    pprev = &inode->dhash[nfs_dir_bucket(inode, dentry->fname, strlen(dentry->fname))];
+    while (*pprev)
+    {
+        if (*pprev == dentry)
+        {
+            *pprev = dentry->hash_next;
+            inode->dhash_cnt--;
+            break;
+        }
+        pprev = &(*pprev)->hash_next;
+    }
+    dentry->hash_next = NULL;
+}
+
+/**
+ * @brief 释放目录索引
+ *
+ * @param inode 目录inode
+ */
+void nfs_dir_hash_free(struct nfs_inode *inode)
+{
+    free(inode->dhash);
+    inode->dhash = NULL;
+    inode->dhash_sz = 0;
+    inode->dhash_cnt = 0;
+}
+
+/******************************************************************************
+* SECTION: 目录块格式
+* 目录块以nfs_dirblk_d开头，之后是变长的nfs_dirent_d记录(类似ext2)：
+*   1) 每条记录按名字长度4字节对齐，rec_len为到下一条记录的距离
+*   2) 记录不跨块，块内最后一条记录的rec_len延伸到块尾
+*   3) 写回时按dentrys链表顺序重新排列整个目录，读入时保持同样的顺序
+* 旧格式的块以定长nfs_dentry_d开头，第一个字节是非空文件名，而新格式块的第一个字节为0，
+* 因此逐块判断格式，旧格式的目录照常读入，下次写回时转换为新格式
+*******************************************************************************/
+/**
+ * @brief 按新格式排列目录，计算需要的块数
+ *
+ * @param inode 目录inode
+ * @return int
+ */
+int nfs_dir_blks(struct nfs_inode *inode)
+{
+    struct nfs_dentry *dentry;
+    int blks = 0;
+    int pos = NFS_BLOCK_SIZE;
+    int rec;
+
+    for (dentry = inode->dentrys; dentry; dentry = dentry->brother)
+    {
+        rec = NFS_DIRENT_REC_LEN(strlen(dentry->fname));
+        if (pos + rec > NFS_BLOCK_SIZE)
+        {
+            blks++;
+            pos = sizeof(struct nfs_dirblk_d);
+        }
+        pos += rec;
+    }
+    return blks;
+}
+
+/**
+ * @brief 新建子目录项并接到dentrys链表尾部
+ */
+static void nfs_dir_link(struct nfs_inode *inode, struct nfs_dentry ***tail,
+                         const char *name, int len, NFS_FILE_TYPE ftype, int ino)
+{
+    struct nfs_dentry *dentry = new_dentry_len(name, len, ftype);
+
+    dentry->parent = inode->dentry;
+    dentry->ino = ino;
+    **tail = dentry;
+    *tail = &dentry->brother;
+    inode->dir_cnt++;
+}
+
+/**
+ * @brief 读入目录的dir_cnt个目录项，新旧两种格式的块都可以读
+ *
+ * @param inode 目录inode，dentrys须为空
+ * @param dir_cnt 磁盘上记录的目录项数
+ * @return int
+ */
+int nfs_dir_read(struct nfs_inode *inode, int dir_cnt)
+{
+    uint32_t buf[NFS_BLOCK_SIZE / sizeof(uint32_t)];
+    uint8_t *blk_buf = (uint8_t *)buf;
+    struct nfs_dirblk_d *hdr = (struct nfs_dirblk_d *)buf;
+    struct nfs_dentry **tail = &inode->dentrys;
+    struct nfs_dentry_d *dentry_d;
+    struct nfs_dirent_d *ent;
+    int blk, pos, i;
+
+    for (blk = 0; dir_cnt > 0 && blk < NFS_DATA_PER_FILE; blk++)
+    {
+        if (nfs_driver_read(NFS_DATA_OFS(inode->block_pointer[blk]), blk_buf,
+                            NFS_BLOCK_SIZE) != NFS_ERROR_NONE)
+        {
+            NFS_DBG("[%s] io error\n", __func__);
+            return -NFS_ERROR_IO;
+        }
+        if (hdr->zero != 0)
+        {   /* 旧格式: 每块DENTRY_PER_BLOCK()个定长目录项 */
+            for (i = 0; dir_cnt > 0 && i < DENTRY_PER_BLOCK(); i++, dir_cnt--)
+            {
+                dentry_d = (struct nfs_dentry_d *)(blk_buf + i * sizeof(struct nfs_dentry_d));
+                nfs_dir_link(inode, &tail, dentry_d->fname, strnlen(dentry_d->fname, NFS_MAX_FILE_NAME - 1),
+                             dentry_d->ftype, dentry_d->ino);
+            }
+            continue;
+        }
+        if (hdr->version != NFS_DIRENT_VERSION)
+        {
+            NFS_DBG("[%s] ino %d: unknown dir block version %d\n", __func__, inode->ino, hdr->version);
+            return -NFS_ERROR_IO;
+        }
+        for (pos = sizeof(struct nfs_dirblk_d); dir_cnt > 0 && pos < NFS_BLOCK_SIZE; pos += ent->rec_len)
+        {
+            ent = (struct nfs_dirent_d *)(blk_buf + pos);
+            if (ent->rec_len < sizeof(struct nfs_dirent_d) || pos + ent->rec_len > NFS_BLOCK_SIZE ||
+                sizeof(struct nfs_dirent_d) + ent->name_len > ent->rec_len || ent->name_len >= NFS_MAX_FILE_NAME)
+            {
+                NFS_DBG("[%s] ino %d: corrupt dir block %d\n", __func__, inode->ino, blk);
+                return -NFS_ERROR_IO;
+            }
+            if (ent->name_len == 0)
+            {   /* 空记录 */
+                continue;
+            }
+            nfs_dir_link(inode, &tail, ent->name, ent->name_len, ent->ftype, ent->ino);
+            dir_cnt--;
+        }
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 按新格式写回整个目录，每块一次写
+ *
+ * @param inode 目录inode，块须已由nfs_alloc_dentry分配
+ * @return int
+ */
+int nfs_dir_write(struct nfs_inode *inode)
+{
+    uint32_t buf[NFS_BLOCK_SIZE / sizeof(uint32_t)];
+    uint8_t *blk_buf = (uint8_t *)buf;
+    struct nfs_dirblk_d *hdr = (struct nfs_dirblk_d *)buf;
+    struct nfs_dentry *dentry = inode->dentrys;
+    struct nfs_dirent_d *ent;
+    int blk, pos, len, rec;
+
+    for (blk = 0; dentry; blk++)
+    {
+        if (blk >= NFS_DATA_PER_FILE || inode->block_pointer[blk] == -1)
+        {
+            NFS_DBG("[%s] ino %d: dir block %d not allocated\n", __func__, inode->ino, blk);
+            return -NFS_ERROR_IO;
+        }
+        memset(buf, 0, NFS_BLOCK_SIZE);
+        hdr->zero = 0;
+        hdr->version = NFS_DIRENT_VERSION;
+        pos = sizeof(struct nfs_dirblk_d);
+        ent = NULL;
+        while (dentry)
+        {
+            len = strlen(dentry->fname);
+            rec = NFS_DIRENT_REC_LEN(len);
+            if (pos + rec > NFS_BLOCK_SIZE)
+            {
+                break;
+            }
+            ent = (struct nfs_dirent_d *)(blk_buf + pos);
+            ent->ino = dentry->ino;
+            ent->rec_len = rec;
+            ent->name_len = len;
+            ent->ftype = dentry->ftype;
+            memcpy(ent->name, dentry->fname, len);
+            pos += rec;
+            dentry = dentry->brother;
+        }
+        ent->rec_len += NFS_BLOCK_SIZE - pos;      /* 最后一条记录延伸到块尾 */
+        if (nfs_driver_write(NFS_DATA_OFS(inode->block_pointer[blk]), blk_buf,
+                             NFS_BLOCK_SIZE) != NFS_ERROR_NONE ||
+            nfs_driver_flush(NFS_DATA_OFS(inode->block_pointer[blk]), NFS_BLOCK_SIZE) != NFS_ERROR_NONE)
+        {
+            return -NFS_ERROR_IO;
+        }
+    }
+    return NFS_ERROR_NONE;
+}
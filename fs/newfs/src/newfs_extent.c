@@ -0,0 +1,666 @@
+#include "../include/newfs.h"
+
+extern struct nfs_super nfs_super;
+
+/******************************************************************************
+* SECTION: extent映射
+* 新建的普通文件用extent映射数据块，一个extent为一段文件内连续且磁盘上也连续的块：
+*   1) 前NFS_EXT_IN_INODE个extent存放在inode中块指针的位置，其余依次存入extent块链
+*   2) extent按文件内块号递增排列，查找为二分；打开文件记录上次查到的extent，
+*      顺序读写时直接命中
+*   3) 分配时以前一个extent的延续位置为目标，顺序写的文件只形成少数几个extent，
+*      读写时整段合并为一次传输
+*******************************************************************************/
+static struct nfs_ext_stat nfs_ext_stat;
+
+/******************************************************************************
+* SECTION: 预留窗口
+* 多个文件交替追加写时，各自以"前一块之后"为目标逐块分配会把空闲空间切成
+* 交错的单块，每个文件都退化为大量单块extent。为此给追加写的文件预先占用
+* 一段连续的空闲块：
+*   1) 目标位置恰为窗口起点时直接取用；窗口用完后在其后建立大一倍的窗口，
+*      直到NFS_EXT_RSV_MAX
+*   2) 窗口只在内存中，写位图时暂时归还(nfs_ext_rsv_hide)；截断、释放inode、
+*      关闭文件时归还剩余部分，槽满时换出最久未用的窗口
+*   3) 位图中没有空闲块时先归还所有窗口再分配
+*******************************************************************************/
+static struct nfs_ext_rsv nfs_ext_rsv[NFS_EXT_RSV_SLOTS];
+static uint64_t nfs_ext_rsv_clock = 0;
+
+/**
+ * @brief 把窗口中尚未用掉的块还给位图
+ *
+ * @param rsv
+ */
+static void nfs_ext_rsv_put(struct nfs_ext_rsv *rsv)
+{
+    int i;
+
+    for (i = 0; i < rsv->len; i++)
+    {
+        nfs_bitmap_free(&nfs_super.data_bm, rsv->start + i);
+    }
+    rsv->len = 0;
+}
+/**
+ * @brief 不经窗口分配一个数据块，空闲块都在窗口中时先归还所有窗口
+ *
+ * @param goal
+ * @return int
+ */
+static int nfs_ext_alloc_blk(int goal)
+{
+    int blk = nfs_bitmap_alloc_near(&nfs_super.data_bm, goal);
+
+    if (blk < 0 && nfs_ext_rsv_count() > 0)
+    {
+        nfs_ext_rsv_drop(NULL);
+        blk = nfs_bitmap_alloc_near(&nfs_super.data_bm, goal);
+    }
+    return blk;
+}
+/**
+ * @brief 为inode分配一个数据块：目标恰为窗口起点时取自窗口，窗口用完或还没有
+ * 窗口时在目标处建立新窗口，其他情况(如填空洞)直接分配
+ *
+ * @param inode
+ * @param goal 期望的块号，< 0表示没有期望
+ * @return int
+ */
+static int nfs_ext_rsv_alloc(struct nfs_inode *inode, int goal)
+{
+    struct nfs_ext_rsv *rsv = NULL;
+    struct nfs_ext_rsv *victim = &nfs_ext_rsv[0];
+    int size = NFS_EXT_RSV_MIN;
+    int i, blk, got;
+
+    for (i = 0; i < NFS_EXT_RSV_SLOTS && rsv == NULL; i++)
+    {
+        if (nfs_ext_rsv[i].inode == inode)
+        {
+            rsv = &nfs_ext_rsv[i];
+        }
+        else if (victim->inode != NULL &&
+                 (nfs_ext_rsv[i].inode == NULL || nfs_ext_rsv[i].used < victim->used))
+        {
+            victim = &nfs_ext_rsv[i];
+        }
+    }
+    if (rsv != NULL)
+    {
+        if (goal >= 0 && goal != rsv->start)
+        {
+            return nfs_ext_alloc_blk(goal);
+        }
+        rsv->used = ++nfs_ext_rsv_clock;
+        if (rsv->len > 0)
+        {
+            rsv->len--;
+            nfs_ext_stat.rsv_hits++;
+            return rsv->start++;
+        }
+        size = rsv->size * 2 < NFS_EXT_RSV_MAX ? rsv->size * 2 : NFS_EXT_RSV_MAX;
+    }
+    else
+    {
+        rsv = victim;
+        nfs_ext_rsv_put(rsv);
+        rsv->inode = inode;
+        rsv->used = ++nfs_ext_rsv_clock;
+    }
+
+    blk = nfs_bitmap_alloc_run(&nfs_super.data_bm, goal, size, &got);
+    if (blk < 0)
+    {
+        rsv->inode = NULL;
+        return nfs_ext_alloc_blk(goal);
+    }
+    rsv->start = blk + 1;
+    rsv->len = got - 1;
+    rsv->size = size;
+    nfs_ext_stat.rsv_windows++;
+    return blk;
+}
+/**
+ * @brief 归还inode的预留窗口，inode为NULL时归还所有窗口
+ *
+ * @param inode 只作比较，可以是已释放的inode
+ */
+void nfs_ext_rsv_drop(struct nfs_inode *inode)
+{
+    int i;
+
+    for (i = 0; i < NFS_EXT_RSV_SLOTS; i++)
+    {
+        if (nfs_ext_rsv[i].inode != NULL && (inode == NULL || nfs_ext_rsv[i].inode == inode))
+        {
+            nfs_ext_rsv_put(&nfs_ext_rsv[i]);
+            nfs_ext_rsv[i].inode = NULL;
+        }
+    }
+}
+/**
+ * @brief 写位图前暂时归还所有窗口(hide为TRUE)，写完后重新占用，不改变位图的脏标记
+ *
+ * @param hide
+ */
+void nfs_ext_rsv_hide(boolean hide)
+{
+    uint64_t dirty = nfs_super.data_bm.dirty;
+    int i, j;
+
+    for (i = 0; i < NFS_EXT_RSV_SLOTS; i++)
+    {
+        for (j = 0; nfs_ext_rsv[i].inode != NULL && j < nfs_ext_rsv[i].len; j++)
+        {
+            if (hide)
+            {
+                nfs_bitmap_free(&nfs_super.data_bm, nfs_ext_rsv[i].start + j);
+            }
+            else
+            {
+                nfs_bitmap_set(&nfs_super.data_bm, nfs_ext_rsv[i].start + j);
+            }
+        }
+    }
+    nfs_super.data_bm.dirty = dirty;
+}
+/**
+ * @brief 预留窗口中尚未用掉的块数，这些块在位图中已置位但仍算空闲
+ *
+ * @return int
+ */
+int nfs_ext_rsv_count()
+{
+    int cnt = 0;
+    int i;
+
+    for (i = 0; i < NFS_EXT_RSV_SLOTS; i++)
+    {
+        cnt += nfs_ext_rsv[i].inode != NULL ? nfs_ext_rsv[i].len : 0;
+    }
+    return cnt;
+}
+
+/**
+ * @brief 保证ext数组至少能放cnt个extent
+ *
+ * @param inode
+ * @param cnt
+ * @return int
+ */
+static int nfs_ext_reserve(struct nfs_inode *inode, int cnt)
+{
+    int cap = inode->ext_cap ? inode->ext_cap : NFS_EXT_IN_INODE;
+    struct nfs_extent *ext;
+
+    if (cnt <= inode->ext_cap)
+    {
+        return NFS_ERROR_NONE;
+    }
+    while (cap < cnt)
+    {
+        cap *= 2;
+    }
+    ext = (struct nfs_extent *)realloc(inode->ext, cap * sizeof(struct nfs_extent));
+    if (ext == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    inode->ext = ext;
+    inode->ext_cap = cap;
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 装入extent块链中的extent，之后ext数组中的ext_cnt项全部有效
+ *
+ * @param inode
+ * @return int
+ */
+static int nfs_ext_load(struct nfs_inode *inode)
+{
+    struct nfs_extblk_d *hdr;
+    struct nfs_extent_d *ext_d;
+    uint8_t *buf;
+    int *chain;
+    int blk = inode->ext_blk;
+    int n = NFS_EXT_IN_INODE;
+    int nchain = 0;
+    int i;
+
+    if (inode->ext_loaded)
+    {
+        return NFS_ERROR_NONE;
+    }
+    chain = (int *)malloc(((inode->ext_cnt - n) / NFS_EXT_PER_BLK + 1) * sizeof(int));
+    buf = (uint8_t *)nfs_slab_alloc(NFS_SLAB_BLK);
+    if (chain == NULL || buf == NULL || nfs_ext_reserve(inode, inode->ext_cnt) != NFS_ERROR_NONE)
+    {
+        free(chain);
+        nfs_slab_free(NFS_SLAB_BLK, buf);
+        return -NFS_ERROR_NOSPACE;
+    }
+    hdr = (struct nfs_extblk_d *)buf;
+    ext_d = (struct nfs_extent_d *)(hdr + 1);
+    while (blk != -1 && n < inode->ext_cnt)
+    {
+        if (nfs_driver_read(NFS_DATA_OFS(blk), buf, NFS_BLOCK_SIZE) != NFS_ERROR_NONE ||
+            hdr->cnt > (uint32_t)NFS_EXT_PER_BLK || n + (int)hdr->cnt > inode->ext_cnt)
+        {
+            NFS_DBG("[%s] bad extent blk %d, ino %d\n", __func__, blk, inode->ino);
+            break;
+        }
+        chain[nchain++] = blk;
+        for (i = 0; i < (int)hdr->cnt; i++, n++)
+        {
+            inode->ext[n].lblk = ext_d[i].lblk;
+            inode->ext[n].pblk = ext_d[i].pblk;
+            inode->ext[n].len = ext_d[i].len;
+        }
+        blk = hdr->next;
+    }
+    nfs_slab_free(NFS_SLAB_BLK, buf);
+    if (n != inode->ext_cnt)
+    {
+        free(chain);
+        return -NFS_ERROR_IO;
+    }
+    free(inode->ext_chain);
+    inode->ext_chain = chain;
+    inode->ext_nchain = nchain;
+    inode->ext_loaded = TRUE;
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 按extent数增减extent块，新增的块在需要时才分配
+ *
+ * @param inode
+ * @return int
+ */
+static int nfs_ext_fit_chain(struct nfs_inode *inode)
+{
+    int need = inode->ext_cnt <= NFS_EXT_IN_INODE ? 0 :
+               (inode->ext_cnt - NFS_EXT_IN_INODE + NFS_EXT_PER_BLK - 1) / NFS_EXT_PER_BLK;
+    int *chain;
+    int blk;
+
+    while (inode->ext_nchain > need)
+    {
+        nfs_bitmap_free(&nfs_super.data_bm, inode->ext_chain[--inode->ext_nchain]);
+        inode->blocks--;
+    }
+    while (inode->ext_nchain < need)
+    {
+        chain = (int *)realloc(inode->ext_chain, (inode->ext_nchain + 1) * sizeof(int));
+        if (chain == NULL)
+        {
+            return -NFS_ERROR_NOSPACE;
+        }
+        inode->ext_chain = chain;
+        blk = nfs_ext_alloc_blk(inode->ext_nchain ? chain[inode->ext_nchain - 1] + 1 : -1);
+        if (blk < 0)
+        {
+            return -NFS_ERROR_NOSPACE;
+        }
+        chain[inode->ext_nchain++] = blk;
+        inode->blocks++;
+    }
+    inode->ext_blk = inode->ext_nchain ? inode->ext_chain[0] : -1;
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 在下标idx处插入extent
+ *
+ * @param inode
+ * @param idx
+ * @param lblk
+ * @param pblk
+ * @return int
+ */
+static int nfs_ext_insert(struct nfs_inode *inode, int idx, int lblk, int pblk)
+{
+    if (nfs_ext_reserve(inode, inode->ext_cnt + 1) != NFS_ERROR_NONE)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    inode->ext_cnt++;
+    if (nfs_ext_fit_chain(inode) != NFS_ERROR_NONE)
+    {
+        inode->ext_cnt--;
+        nfs_ext_fit_chain(inode);
+        return -NFS_ERROR_NOSPACE;
+    }
+    memmove(&inode->ext[idx + 1], &inode->ext[idx], (inode->ext_cnt - 1 - idx) * sizeof(struct nfs_extent));
+    inode->ext[idx].lblk = lblk;
+    inode->ext[idx].pblk = pblk;
+    inode->ext[idx].len = 1;
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 找到起始块号不大于lblk的最后一个extent
+ *
+ * @param inode
+ * @param lblk
+ * @return int 下标，没有时返回-1
+ */
+static int nfs_ext_find(struct nfs_inode *inode, int lblk)
+{
+    int lo = 0, hi = inode->ext_cnt - 1, mid;
+
+    while (lo <= hi)
+    {
+        mid = (lo + hi) / 2;
+        if (inode->ext[mid].lblk <= lblk)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+    return hi;
+}
+/**
+ * @brief 为文件内块号lblk分配数据块，尽量接在前一个extent之后
+ *
+ * @param inode
+ * @param lblk 尚未映射的块号
+ * @param prev 起始块号不大于lblk的最后一个extent，-1表示没有
+ * @param idx 返回映射lblk的extent下标
+ * @return int 数据块号
+ */
+static int nfs_ext_alloc(struct nfs_inode *inode, int lblk, int prev, int *idx)
+{
+    struct nfs_extent *e = inode->ext;
+    int next = prev + 1;
+    int goal = -1;
+    int blk;
+
+    if (prev >= 0)
+    {
+        goal = e[prev].pblk + (lblk - e[prev].lblk);
+    }
+    else if (next < inode->ext_cnt && e[next].pblk >= e[next].lblk - lblk)
+    {
+        goal = e[next].pblk - (e[next].lblk - lblk);
+    }
+    blk = nfs_ext_rsv_alloc(inode, goal);
+    if (blk < 0)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+
+    if (prev >= 0 && lblk == e[prev].lblk + e[prev].len && blk == e[prev].pblk + e[prev].len)
+    {
+        e[prev].len++;
+        if (next < inode->ext_cnt && e[next].lblk == lblk + 1 && e[next].pblk == blk + 1)
+        {   /* 填上两个extent之间的空洞，合并 */
+            e[prev].len += e[next].len;
+            memmove(&e[next], &e[next + 1], (inode->ext_cnt - next - 1) * sizeof(struct nfs_extent));
+            inode->ext_cnt--;
+            nfs_ext_fit_chain(inode);
+        }
+        *idx = prev;
+        nfs_ext_stat.extended++;
+    }
+    else if (next < inode->ext_cnt && e[next].lblk == lblk + 1 && e[next].pblk == blk + 1)
+    {
+        e[next].lblk--;
+        e[next].pblk--;
+        e[next].len++;
+        *idx = next;
+        nfs_ext_stat.extended++;
+    }
+    else
+    {
+        if (nfs_ext_insert(inode, next, lblk, blk) != NFS_ERROR_NONE)
+        {
+            nfs_bitmap_free(&nfs_super.data_bm, blk);
+            return -NFS_ERROR_NOSPACE;
+        }
+        *idx = next;
+        nfs_ext_stat.inserted++;
+    }
+    inode->blocks++;
+    inode->ext_dirty = TRUE;
+    nfs_mark_inode_dirty(inode, NFS_INODE_DIRTY | NFS_INODE_DIRTY_DATA);
+    return blk;
+}
+/**
+ * @brief 初始化为没有extent的文件
+ *
+ * @param inode
+ */
+void nfs_ext_init(struct nfs_inode *inode)
+{
+    inode->ext = NULL;
+    inode->ext_cnt = 0;
+    inode->ext_cap = 0;
+    inode->ext_blk = -1;
+    inode->ext_chain = NULL;
+    inode->ext_nchain = 0;
+    inode->ext_loaded = TRUE;
+    inode->ext_dirty = FALSE;
+}
+/**
+ * @brief 从磁盘inode取得extent，extent块中的extent在第一次查找时才装入
+ *
+ * @param inode
+ * @param inode_d
+ * @return int
+ */
+int nfs_ext_read(struct nfs_inode *inode, struct nfs_inode_d *inode_d)
+{
+    int n = inode_d->ext_cnt < NFS_EXT_IN_INODE ? inode_d->ext_cnt : NFS_EXT_IN_INODE;
+    int i;
+
+    nfs_ext_init(inode);
+    if (nfs_ext_reserve(inode, n) != NFS_ERROR_NONE)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    for (i = 0; i < n; i++)
+    {
+        inode->ext[i].lblk = inode_d->ext[i].lblk;
+        inode->ext[i].pblk = inode_d->ext[i].pblk;
+        inode->ext[i].len = inode_d->ext[i].len;
+    }
+    inode->ext_cnt = inode_d->ext_cnt;
+    inode->ext_blk = inode_d->ext_blk;
+    inode->ext_loaded = inode->ext_cnt <= NFS_EXT_IN_INODE;
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 将inode中存放的extent填入磁盘inode
+ *
+ * @param inode
+ * @param inode_d
+ */
+void nfs_ext_fill(struct nfs_inode *inode, struct nfs_inode_d *inode_d)
+{
+    int i;
+
+    memset(inode_d->ext, 0, sizeof(inode_d->ext));
+    for (i = 0; i < inode->ext_cnt && i < NFS_EXT_IN_INODE; i++)
+    {
+        inode_d->ext[i].lblk = inode->ext[i].lblk;
+        inode_d->ext[i].pblk = inode->ext[i].pblk;
+        inode_d->ext[i].len = inode->ext[i].len;
+    }
+    inode_d->ext_blk = inode->ext_blk;
+    inode_d->ext_cnt = inode->ext_cnt;
+}
+/**
+ * @brief 查找文件内块号对应的数据块号，语义同nfs_file_bmap
+ *
+ * @param file 打开文件，NULL表示不使用其记录的extent
+ * @param inode extent文件
+ * @param lblk
+ * @param alloc
+ * @return int
+ */
+int nfs_ext_map(struct nfs_file *file, struct nfs_inode *inode, int lblk, boolean alloc)
+{
+    struct nfs_extent *e;
+    int idx = -1;
+    int h;
+
+    if (nfs_ext_load(inode) != NFS_ERROR_NONE)
+    {
+        return -NFS_ERROR_IO;
+    }
+    nfs_ext_stat.lookups++;
+    e = inode->ext;
+    if (file && file->bmap_inode == inode)
+    {   /* 先看上次的extent及其后一个 */
+        for (h = file->bmap_ext; h <= file->bmap_ext + 1 && h < inode->ext_cnt; h++)
+        {
+            if (h >= 0 && lblk >= e[h].lblk && lblk < e[h].lblk + e[h].len)
+            {
+                idx = h;
+                nfs_ext_stat.hint_hits++;
+                break;
+            }
+        }
+    }
+    if (idx < 0)
+    {
+        idx = nfs_ext_find(inode, lblk);
+        if (idx < 0 || lblk >= e[idx].lblk + e[idx].len)
+        {   /* 空洞 */
+            if (!alloc)
+            {
+                return -1;
+            }
+            h = nfs_ext_alloc(inode, lblk, idx, &idx);
+            if (h >= 0 && file)
+            {
+                file->bmap_inode = inode;
+                file->bmap_ext = idx;
+            }
+            return h;
+        }
+    }
+    if (file)
+    {
+        file->bmap_inode = inode;
+        file->bmap_ext = idx;
+    }
+    return e[idx].pblk + (lblk - e[idx].lblk);
+}
+/**
+ * @brief 释放文件第nblks块及之后的数据块，以及不再需要的extent块
+ *
+ * @param inode
+ * @param nblks
+ * @return int
+ */
+int nfs_ext_truncate(struct nfs_inode *inode, int nblks)
+{
+    struct nfs_extent *e;
+    int keep, i;
+
+    nfs_ext_rsv_drop(inode);
+    if (nfs_ext_load(inode) != NFS_ERROR_NONE)
+    {
+        return -NFS_ERROR_IO;
+    }
+    while (inode->ext_cnt > 0)
+    {
+        e = &inode->ext[inode->ext_cnt - 1];
+        if (e->lblk + e->len <= nblks)
+        {
+            break;
+        }
+        keep = nblks > e->lblk ? nblks - e->lblk : 0;
+        for (i = keep; i < e->len; i++)
+        {
+            nfs_bitmap_free(&nfs_super.data_bm, e->pblk + i);
+        }
+        inode->blocks -= e->len - keep;
+        e->len = keep;
+        if (keep == 0)
+        {
+            inode->ext_cnt--;
+        }
+        inode->ext_dirty = TRUE;
+    }
+    return nfs_ext_fit_chain(inode);
+}
+/**
+ * @brief 写回extent块链
+ *
+ * @param inode
+ * @return int
+ */
+int nfs_ext_sync(struct nfs_inode *inode)
+{
+    struct nfs_extblk_d *hdr;
+    struct nfs_extent_d *ext_d;
+    uint8_t *buf;
+    int n = NFS_EXT_IN_INODE;
+    int c, i;
+
+    if (!inode->ext_dirty || inode->ext_nchain == 0)
+    {
+        inode->ext_dirty = FALSE;
+        return NFS_ERROR_NONE;
+    }
+    buf = (uint8_t *)nfs_slab_zalloc(NFS_SLAB_BLK);
+    if (buf == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    hdr = (struct nfs_extblk_d *)buf;
+    ext_d = (struct nfs_extent_d *)(hdr + 1);
+    for (c = 0; c < inode->ext_nchain; c++)
+    {
+        hdr->next = c + 1 < inode->ext_nchain ? inode->ext_chain[c + 1] : -1;
+        hdr->cnt = 0;
+        for (i = 0; i < NFS_EXT_PER_BLK && n < inode->ext_cnt; i++, n++)
+        {
+            ext_d[i].lblk = inode->ext[n].lblk;
+            ext_d[i].pblk = inode->ext[n].pblk;
+            ext_d[i].len = inode->ext[n].len;
+            hdr->cnt++;
+        }
+        if (nfs_driver_write(NFS_DATA_OFS(inode->ext_chain[c]), buf, NFS_BLOCK_SIZE) != NFS_ERROR_NONE ||
+            nfs_driver_flush(NFS_DATA_OFS(inode->ext_chain[c]), NFS_BLOCK_SIZE) != NFS_ERROR_NONE)
+        {
+            NFS_DBG("[%s] io error\n", __func__);
+            nfs_slab_free(NFS_SLAB_BLK, buf);
+            return -NFS_ERROR_IO;
+        }
+    }
+    nfs_slab_free(NFS_SLAB_BLK, buf);
+    inode->ext_dirty = FALSE;
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 释放内存中的extent，不改动磁盘
+ *
+ * @param inode
+ */
+void nfs_ext_release(struct nfs_inode *inode)
+{
+    nfs_ext_rsv_drop(inode);
+    free(inode->ext);
+    free(inode->ext_chain);
+    inode->ext = NULL;
+    inode->ext_chain = NULL;
+    inode->ext_cap = 0;
+    inode->ext_nchain = 0;
+}
+/**
+ * @brief 打印extent统计
+ *
+ */
+void nfs_ext_dump()
+{
+    NFS_DBG("[%s] lookups %lu, hint hits %lu, blks appended to extent %lu, new extents %lu, "
+            "reserve windows %lu (%lu blks taken)\n",
+            __func__, (unsigned long)nfs_ext_stat.lookups, (unsigned long)nfs_ext_stat.hint_hits,
+            (unsigned long)nfs_ext_stat.extended, (unsigned long)nfs_ext_stat.inserted,
+            (unsigned long)nfs_ext_stat.rsv_windows, (unsigned long)nfs_ext_stat.rsv_hits);
+}
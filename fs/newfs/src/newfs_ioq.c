@@ -0,0 +1,355 @@
+#include "../include/newfs.h"
+
+extern struct nfs_super nfs_super;
+
+/******************************************************************************
+* SECTION: 刷写队列 (电梯调度)
+* plug期间写回的脏块先拷贝入队，unplug或队满时统一派发：
+*   1) 按块号排序，从上次磁头位置起单向扫描到末尾，再绕回开头 (C-SCAN)
+*   2) 块号连续的请求合并为一次多IO单元的pwritev
+* 避免按目录树遍历顺序写回时磁头在inode区与数据区之间反复跳转
+* 队列按块号哈希索引，入队与查找都是O(1)；未启用块缓存时plug期间的
+* 写也经nfs_ioq_write入队，读经nfs_ioq_overlay看到尚未下发的内容，
+* 绕过队列直接写盘的范围经nfs_ioq_refresh更新队列中的旧内容
+*******************************************************************************/
+static struct nfs_ioq nfs_ioq;
+
+static inline int nfs_ioq_hash(int blk)
+{
+    return (int)((uint32_t)blk * 2654435761u) & nfs_ioq.hash_mask;
+}
+
+/**
+ * @brief 清空哈希索引，派发后调用
+ */
+static void nfs_ioq_hash_reset()
+{
+    memset(nfs_ioq.hash, 0xff, (nfs_ioq.hash_mask + 1) * sizeof(int));
+}
+
+static int nfs_ioq_cmp(const void *a, const void *b)
+{
+    return ((const struct nfs_ioq_req *)a)->blk - ((const struct nfs_ioq_req *)b)->blk;
+}
+
+/**
+ * @brief 将reqs[start, end)中块号连续的请求合并下发
+ *
+ * @param start
+ * @param end
+ * @return int
+ */
+static int nfs_ioq_dispatch_range(int start, int end)
+{
+    struct iovec iov[NFS_IOQ_DEPTH];
+    int run_start = start;
+    int i, n;
+
+    while (run_start < end)
+    {
+        n = 0;
+        i = run_start;
+        do
+        {
+            iov[n].iov_base = nfs_ioq.reqs[i].data;
+            iov[n].iov_len = NFS_BLOCK_SIZE;
+            n++;
+            i++;
+        } while (i < end && nfs_ioq.reqs[i].blk == nfs_ioq.reqs[i - 1].blk + 1);
+
+        if (ddriver_pwritev(NFS_DRIVER(), iov, n, NFS_BLKS_SZ(nfs_ioq.reqs[run_start].blk)) != NFS_BLKS_SZ(n))
+        {
+            NFS_DBG("[%s] io error, blk %d\n", __func__, nfs_ioq.reqs[run_start].blk);
+            return -NFS_ERROR_IO;
+        }
+        nfs_ioq.dispatched++;
+        nfs_ioq.head_blk = nfs_ioq.reqs[i - 1].blk + 1;
+        run_start = i;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 初始化刷写队列
+ *
+ * @param depth 最多暂存的块数
+ * @return int
+ */
+int nfs_ioq_init(int depth)
+{
+    int i;
+    int buckets = 1;
+
+    memset(&nfs_ioq, 0, sizeof(struct nfs_ioq));
+    if (depth > NFS_IOQ_DEPTH)
+    {
+        depth = NFS_IOQ_DEPTH;
+    }
+    while (buckets < depth)
+    {
+        buckets <<= 1;
+    }
+    nfs_ioq.reqs = (struct nfs_ioq_req *)calloc(depth, sizeof(struct nfs_ioq_req));
+    nfs_ioq.pool = (uint8_t *)malloc(NFS_BLKS_SZ(depth));
+    nfs_ioq.hash = (int *)malloc(buckets * sizeof(int));
+    if (!nfs_ioq.reqs || !nfs_ioq.pool || !nfs_ioq.hash)
+    {
+        nfs_ioq_destroy();
+        return -NFS_ERROR_NOSPACE;
+    }
+    nfs_ioq.hash_mask = buckets - 1;
+    nfs_ioq_hash_reset();
+    for (i = 0; i < depth; i++)
+    {
+        nfs_ioq.reqs[i].data = nfs_ioq.pool + NFS_BLKS_SZ(i);
+    }
+    nfs_ioq.depth = depth;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 是否处于plug状态，此时写回应调用nfs_ioq_add入队
+ *
+ * @return boolean
+ */
+boolean nfs_ioq_plugged()
+{
+    return nfs_ioq.plugged > 0 && nfs_ioq.depth > 0;
+}
+
+/**
+ * @brief 开始收集写请求，可嵌套
+ *
+ */
+void nfs_ioq_plug()
+{
+    nfs_ioq.plugged++;
+}
+
+/**
+ * @brief 结束收集，最外层unplug时派发队列中所有请求
+ *
+ * @return int
+ */
+int nfs_ioq_unplug()
+{
+    if (nfs_ioq.plugged > 0 && --nfs_ioq.plugged == 0)
+    {
+        return nfs_ioq_dispatch();
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 查找队列中尚未下发的块
+ *
+ * @param blk
+ * @return uint8_t* 块内容，不在队列中返回NULL
+ */
+uint8_t *nfs_ioq_lookup(int blk)
+{
+    int i;
+
+    if (nfs_ioq.cnt == 0)
+    {
+        return NULL;
+    }
+    for (i = nfs_ioq.hash[nfs_ioq_hash(blk)]; i >= 0; i = nfs_ioq.reqs[i].hash_next)
+    {
+        if (nfs_ioq.reqs[i].blk == blk)
+        {
+            return nfs_ioq.reqs[i].data;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 整块写请求入队，同一块重复入队时覆盖旧内容，队满时先派发
+ *
+ * @param blk 逻辑块号
+ * @param data 块内容，入队时拷贝
+ * @return int
+ */
+int nfs_ioq_add(int blk, uint8_t *data)
+{
+    uint8_t *slot = nfs_ioq_lookup(blk);
+
+    if (slot == NULL)
+    {
+        if (nfs_ioq.cnt == nfs_ioq.depth && nfs_ioq_dispatch() != NFS_ERROR_NONE)
+        {
+            return -NFS_ERROR_IO;
+        }
+        nfs_ioq.reqs[nfs_ioq.cnt].blk = blk;
+        nfs_ioq.reqs[nfs_ioq.cnt].hash_next = nfs_ioq.hash[nfs_ioq_hash(blk)];
+        nfs_ioq.hash[nfs_ioq_hash(blk)] = nfs_ioq.cnt;
+        slot = nfs_ioq.reqs[nfs_ioq.cnt].data;
+        nfs_ioq.cnt++;
+    }
+    memcpy(slot, data, NFS_BLOCK_SIZE);
+    nfs_ioq.queued++;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 按字节范围写入队列(未启用块缓存时plug期间使用)
+ * 整块覆盖的直接入队；部分覆盖的块先取队列中或磁盘上的旧内容再合并
+ *
+ * @param offset
+ * @param in_content
+ * @param size
+ * @return int
+ */
+int nfs_ioq_write(int offset, uint8_t *in_content, int size)
+{
+    uint8_t blk_buf[NFS_BLOCK_SIZE];
+    uint8_t *queued;
+    int blk, bias, len;
+
+    while (size > 0)
+    {
+        blk = NFS_BLK_OF(offset);
+        bias = offset - NFS_BLKS_SZ(blk);
+        len = NFS_BLOCK_SIZE - bias < size ? NFS_BLOCK_SIZE - bias : size;
+        if ((queued = nfs_ioq_lookup(blk)) != NULL)
+        {   /* 已在队列中，原地修改 */
+            memcpy(queued + bias, in_content, len);
+            nfs_ioq.queued++;
+        }
+        else if (len == NFS_BLOCK_SIZE)
+        {
+            if (nfs_ioq_add(blk, in_content) != NFS_ERROR_NONE)
+            {
+                return -NFS_ERROR_IO;
+            }
+        }
+        else
+        {   /* 部分覆盖，先读出旧内容 */
+            if (nfs_dev_read(NFS_BLKS_SZ(blk), blk_buf, NFS_BLOCK_SIZE) != NFS_ERROR_NONE)
+            {
+                return -NFS_ERROR_IO;
+            }
+            memcpy(blk_buf + bias, in_content, len);
+            if (nfs_ioq_add(blk, blk_buf) != NFS_ERROR_NONE)
+            {
+                return -NFS_ERROR_IO;
+            }
+        }
+        offset += len;
+        in_content += len;
+        size -= len;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 从磁盘读出的范围中，用队列里尚未下发的块覆盖旧内容
+ *
+ * @param offset
+ * @param out_content 已从磁盘读出的内容
+ * @param size
+ */
+void nfs_ioq_overlay(int offset, uint8_t *out_content, int size)
+{
+    uint8_t *queued;
+    int blk, bias, len;
+
+    while (nfs_ioq.cnt > 0 && size > 0)
+    {
+        blk = NFS_BLK_OF(offset);
+        bias = offset - NFS_BLKS_SZ(blk);
+        len = NFS_BLOCK_SIZE - bias < size ? NFS_BLOCK_SIZE - bias : size;
+        if ((queued = nfs_ioq_lookup(blk)) != NULL)
+        {
+            memcpy(out_content, queued + bias, len);
+        }
+        offset += len;
+        out_content += len;
+        size -= len;
+    }
+}
+
+/**
+ * @brief 绕过队列直接写盘后调用，更新队列中尚未下发的同一块，避免派发时旧内容覆盖新内容
+ *
+ * @param offset
+ * @param in_content 已写盘的内容
+ * @param size
+ */
+void nfs_ioq_refresh(int offset, const uint8_t *in_content, int size)
+{
+    uint8_t *queued;
+    int blk, bias, len;
+
+    while (nfs_ioq.cnt > 0 && size > 0)
+    {
+        blk = NFS_BLK_OF(offset);
+        bias = offset - NFS_BLKS_SZ(blk);
+        len = NFS_BLOCK_SIZE - bias < size ? NFS_BLOCK_SIZE - bias : size;
+        if ((queued = nfs_ioq_lookup(blk)) != NULL)
+        {
+            memcpy(queued + bias, in_content, len);
+        }
+        offset += len;
+        in_content += len;
+        size -= len;
+    }
+}
+
+/**
+ * @brief 按C-SCAN顺序派发队列中所有请求
+ *
+ * @return int
+ */
+int nfs_ioq_dispatch()
+{
+    int pivot = 0;
+    int ret;
+
+    if (nfs_ioq.cnt == 0)
+    {
+        return NFS_ERROR_NONE;
+    }
+    qsort(nfs_ioq.reqs, nfs_ioq.cnt, sizeof(struct nfs_ioq_req), nfs_ioq_cmp);
+    while (pivot < nfs_ioq.cnt && nfs_ioq.reqs[pivot].blk < nfs_ioq.head_blk)
+    {
+        pivot++;
+    }
+
+    /* 先从磁头位置向高地址扫描，再绕回低地址 */
+    ret = nfs_ioq_dispatch_range(pivot, nfs_ioq.cnt);
+    if (ret == NFS_ERROR_NONE)
+    {
+        ret = nfs_ioq_dispatch_range(0, pivot);
+    }
+    nfs_ioq.cnt = 0;
+    nfs_ioq_hash_reset();
+    return ret;
+}
+
+/**
+ * @brief 释放刷写队列，调用前需先派发
+ *
+ */
+void nfs_ioq_destroy()
+{
+    free(nfs_ioq.reqs);
+    free(nfs_ioq.pool);
+    free(nfs_ioq.hash);
+    nfs_ioq.reqs = NULL;
+    nfs_ioq.pool = NULL;
+    nfs_ioq.hash = NULL;
+    nfs_ioq.depth = 0;
+    nfs_ioq.cnt = 0;
+}
+
+/**
+ * @brief 打印队列合并统计
+ *
+ */
+void nfs_ioq_dump()
+{
+    NFS_DBG("[%s] queued %lu blks, dispatched %lu writes\n", __func__,
+            (unsigned long)nfs_ioq.queued, (unsigned long)nfs_ioq.dispatched);
+}
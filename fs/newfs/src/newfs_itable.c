@@ -0,0 +1,125 @@
+#include "../include/newfs.h"
+
+extern struct nfs_super nfs_super;
+
+/******************************************************************************
+* SECTION: inode表块缓冲
+* 新格式中一个inode表块存放NFS_BLOCK_SIZE / NFS_INODE_SIZE个inode，inode表
+* 总以整块读写：
+*   1) 缓冲最近访问的一个inode表块，读相邻inode(如ls -l)时不再重复读盘
+*   2) 写inode只修改缓冲中的槽，换块或nfs_itable_flush时整块写回一次，
+*      同一块中的多个脏inode合并为一次写
+* 旧镜像每个inode占一块，同样经由这里读写
+*******************************************************************************/
+static uint32_t nfs_itable_buf[NFS_BLOCK_SIZE / sizeof(uint32_t)];
+static int nfs_itable_blk = -1;                        /* 缓冲的是inode表中的第几块，-1表示空 */
+static boolean nfs_itable_dirty = FALSE;
+static struct nfs_itable_stat nfs_itable_stat;
+
+/**
+ * @brief 清空缓冲，挂载时调用
+ */
+void nfs_itable_init()
+{
+    nfs_itable_blk = -1;
+    nfs_itable_dirty = FALSE;
+    memset(&nfs_itable_stat, 0, sizeof(nfs_itable_stat));
+}
+
+/**
+ * @brief 写回缓冲的inode表块
+ *
+ * @return int
+ */
+int nfs_itable_flush()
+{
+    if (!nfs_itable_dirty)
+    {
+        return NFS_ERROR_NONE;
+    }
+    if (nfs_driver_write(NFS_ITABLE_OFS(nfs_itable_blk),
+                         (uint8_t *)nfs_itable_buf, NFS_BLOCK_SIZE) != NFS_ERROR_NONE ||
+        nfs_driver_flush(NFS_ITABLE_OFS(nfs_itable_blk), NFS_BLOCK_SIZE) != NFS_ERROR_NONE)
+    {
+        NFS_DBG("[%s] io error, blk %d\n", __func__, nfs_itable_blk);
+        return -NFS_ERROR_IO;
+    }
+    nfs_itable_dirty = FALSE;
+    nfs_itable_stat.flushes++;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 取得ino在缓冲中的inode槽，必要时先写回旧块再读入所在的块
+ * 返回的指针在下一次调用nfs_itable_get之前有效
+ *
+ * @param ino
+ * @param dirty 调用者将修改该槽，之后由nfs_itable_flush写回
+ * @return uint8_t* inode槽，读写出错时返回NULL
+ */
+uint8_t *nfs_itable_get(int ino, boolean dirty)
+{
+    int blk = ino / NFS_INODES_PER_BLK();
+
+    if (blk == nfs_itable_blk)
+    {
+        nfs_itable_stat.hits++;
+    }
+    else
+    {
+        if (nfs_itable_flush() != NFS_ERROR_NONE)
+        {
+            return NULL;
+        }
+        nfs_itable_blk = -1;
+        if (nfs_driver_read(NFS_ITABLE_OFS(blk),
+                            (uint8_t *)nfs_itable_buf, NFS_BLOCK_SIZE) != NFS_ERROR_NONE)
+        {
+            NFS_DBG("[%s] io error, blk %d\n", __func__, blk);
+            return NULL;
+        }
+        nfs_itable_blk = blk;
+        nfs_itable_stat.loads++;
+    }
+    nfs_itable_dirty |= dirty;
+    return (uint8_t *)nfs_itable_buf + (ino % NFS_INODES_PER_BLK()) * nfs_super.inode_size;
+}
+
+/**
+ * @brief 从inode槽取出nfs_inode_d，旧镜像跳过ino/size之后的target_path
+ *
+ * @param slot nfs_itable_get返回的inode槽
+ * @param inode_d
+ */
+void nfs_itable_load(const uint8_t *slot, struct nfs_inode_d *inode_d)
+{
+    int head = offsetof(struct nfs_inode_d, dir_cnt);
+
+    memcpy(inode_d, slot, head);
+    memcpy((uint8_t *)inode_d + head, slot + head + NFS_INODE_D_PAD(), sizeof(struct nfs_inode_d) - head);
+}
+
+/**
+ * @brief 把nfs_inode_d按槽的格式写入inode槽，旧镜像的target_path清零
+ *
+ * @param slot nfs_itable_get(ino, TRUE)返回的inode槽
+ * @param inode_d
+ */
+void nfs_itable_store(uint8_t *slot, const struct nfs_inode_d *inode_d)
+{
+    int head = offsetof(struct nfs_inode_d, dir_cnt);
+
+    memcpy(slot, inode_d, head);
+    memset(slot + head, 0, NFS_INODE_D_PAD());
+    memcpy(slot + head + NFS_INODE_D_PAD(), (const uint8_t *)inode_d + head, sizeof(struct nfs_inode_d) - head);
+}
+
+void nfs_itable_dump()
+{
+    uint64_t total = nfs_itable_stat.hits + nfs_itable_stat.loads;
+
+    NFS_DBG("[%s] %d inodes per blk, loads %lu, hits %lu (%.2f%% hit), flushes %lu\n",
+            __func__, NFS_INODES_PER_BLK(), (unsigned long)nfs_itable_stat.loads,
+            (unsigned long)nfs_itable_stat.hits, total ? 100.0 * nfs_itable_stat.hits / total : 0.0,
+            (unsigned long)nfs_itable_stat.flushes);
+}
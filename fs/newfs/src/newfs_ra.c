@@ -0,0 +1,429 @@
+#include "../include/newfs.h"
+
+extern struct nfs_super nfs_super;
+
+/******************************************************************************
+* SECTION: 文件数据装入与顺序预读
+* 每个打开的文件记录上次读结束的位置，本次读从该位置开始即视为顺序读：
+*   1) 顺序读时在读到的块之后再装入一个预读窗口，窗口从NFS_RA_MIN_BLKS起
+*      每次翻倍，直到NFS_RA_MAX_BLKS
+*   2) 读者接近已预读位置(剩余不足半个窗口)时才发起下一次预读，预读以批为单位
+*   3) 随机读时窗口清零，只同步装入读到的块
+* 磁盘上连续的块直接分散读入各自的块缓冲区(每次至多NFS_RA_MAX_BLKS块)，
+* 块号经由打开文件缓存的间接块查找
+* 预读的块经ddriver_submit异步读入，与读者处理已读到的数据重叠，data_ra标为
+* NFS_RA_INFLIGHT；读到这些块或截断文件时再等待其完成并交给inode
+*******************************************************************************/
+static struct nfs_ra_stat nfs_ra_stat;
+static struct nfs_ra_req nfs_ra_reqs[NFS_RA_ASYNC_REQS];
+static int nfs_ra_inflight = 0;
+
+/**
+ * @brief 异步预读完成，把缓冲区交给inode
+ * 读失败的块留给之后的同步读；期间已被写入的块以内存中的内容为准，
+ * 读盘之后仍留在块缓存或刷写队列中的修改覆盖到读出的内容上
+ *
+ * @param rreq
+ */
+static void nfs_ra_complete(struct nfs_ra_req *rreq)
+{
+    struct nfs_inode *inode = rreq->inode;
+    boolean ok = rreq->req.res == (int)rreq->req.size;
+    uint8_t *buf;
+    int i, blk;
+
+    for (i = 0; i < rreq->cnt; i++)
+    {
+        blk = rreq->blk + i;
+        buf = (uint8_t *)rreq->iov[i].iov_base;
+        if (!ok || inode->data[blk] != NULL)
+        {
+            nfs_slab_free(NFS_SLAB_BLK, buf);
+            inode->data_ra[blk] = FALSE;
+            continue;
+        }
+        nfs_cache_peek(NFS_BLK_OF(NFS_DATA_OFS(rreq->pblk + i)), buf);
+        nfs_ioq_overlay(NFS_DATA_OFS(rreq->pblk + i), buf, NFS_BLOCK_SIZE);
+        inode->data[blk] = buf;
+        inode->data_ra[blk] = TRUE;
+        nfs_ra_stat.prefetched++;
+    }
+    rreq->inode = NULL;
+    nfs_ra_inflight--;
+}
+
+/**
+ * @brief 收割已完成的异步预读
+ *
+ * @param block 没有完成的请求时是否等待
+ * @return int 收割的请求数，出错返回负数
+ */
+static int nfs_ra_collect(boolean block)
+{
+    struct ddriver_req *done[NFS_RA_ASYNC_REQS];
+    int n, i;
+
+    n = block ? ddriver_wait(NFS_DRIVER(), done, 1, NFS_RA_ASYNC_REQS)
+              : ddriver_poll(NFS_DRIVER(), done, NFS_RA_ASYNC_REQS);
+    for (i = 0; i < n; i++)
+    {
+        nfs_ra_complete((struct nfs_ra_req *)done[i]->priv);
+    }
+    return n;
+}
+
+/**
+ * @brief 异步读入磁盘上连续的run块，作为inode从blk起的预读
+ *
+ * @param inode
+ * @param blk
+ * @param pblk
+ * @param run
+ * @return int 提交的块数，没有空闲请求或缓冲区时返回0，由调用者同步读
+ */
+static int nfs_ra_submit(struct nfs_inode *inode, int blk, int pblk, int run)
+{
+    struct nfs_ra_req *rreq = NULL;
+    struct ddriver_req *req;
+    int i;
+
+    for (i = 0; i < NFS_RA_ASYNC_REQS && rreq == NULL; i++)
+    {
+        if (nfs_ra_reqs[i].inode == NULL)
+        {
+            rreq = &nfs_ra_reqs[i];
+        }
+    }
+    if (rreq == NULL)
+    {
+        return 0;
+    }
+    for (i = 0; i < run; i++)
+    {
+        rreq->iov[i].iov_base = nfs_slab_alloc(NFS_SLAB_BLK);
+        rreq->iov[i].iov_len = NFS_BLOCK_SIZE;
+        if (rreq->iov[i].iov_base == NULL)
+        {
+            run = i;
+            break;
+        }
+    }
+    req = &rreq->req;
+    memset(req, 0, sizeof(struct ddriver_req));
+    req->op = DDRIVER_OP_READ;
+    req->offset = NFS_DATA_OFS(pblk);
+    req->vec = rreq->iov;
+    req->nvec = run;
+    req->priv = rreq;
+    if (run == 0 || ddriver_submit(NFS_DRIVER(), &req, 1) != 1)
+    {
+        for (i = 0; i < run; i++)
+        {
+            nfs_slab_free(NFS_SLAB_BLK, rreq->iov[i].iov_base);
+        }
+        return 0;
+    }
+    rreq->inode = inode;
+    rreq->blk = blk;
+    rreq->pblk = pblk;
+    rreq->cnt = run;
+    memset(inode->data_ra + blk, NFS_RA_INFLIGHT, run);
+    nfs_ra_inflight++;
+    nfs_ra_stat.async++;
+    return run;
+}
+
+/**
+ * @brief 等待覆盖inode第blk块的异步预读完成
+ *
+ * @param inode
+ * @param blk
+ * @return int
+ */
+static int nfs_ra_wait(struct nfs_inode *inode, int blk)
+{
+    struct nfs_ra_req *rreq = NULL;
+    int i;
+
+    for (i = 0; i < NFS_RA_ASYNC_REQS && rreq == NULL; i++)
+    {
+        if (nfs_ra_reqs[i].inode == inode && blk >= nfs_ra_reqs[i].blk &&
+            blk < nfs_ra_reqs[i].blk + nfs_ra_reqs[i].cnt)
+        {
+            rreq = &nfs_ra_reqs[i];
+        }
+    }
+    if (rreq == NULL)
+    {
+        inode->data_ra[blk] = FALSE;
+        return NFS_ERROR_NONE;
+    }
+    nfs_ra_stat.waits++;
+    while (rreq->inode != NULL)
+    {
+        if (nfs_ra_collect(TRUE) <= 0)
+        {
+            return -NFS_ERROR_IO;
+        }
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 装入[start, end)中尚未装入的块，块号不小于ra_from的视为预读
+ *
+ * @param file 打开文件，NULL表示不使用其块映射缓存
+ * @param inode
+ * @param start
+ * @param end
+ * @param ra_from
+ * @return int
+ */
+static int nfs_ra_fill(struct nfs_file *file, struct nfs_inode *inode, int start, int end, int ra_from)
+{
+    struct iovec iov[NFS_RA_MAX_BLKS];
+    int blk = start;
+    int pblk, next, run, i;
+
+    if (nfs_file_reserve(inode, end) != NFS_ERROR_NONE)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    if (NFS_IS_INLINE(inode) && start == 0 && end > 0)
+    {   /* 内联文件只有第0块，读inode槽内的数据 */
+        if (nfs_inline_load(inode) != NFS_ERROR_NONE)
+        {
+            return -NFS_ERROR_IO;
+        }
+        blk = 1;
+    }
+    while (blk < end)
+    {
+        if (inode->data[blk] != NULL)
+        {
+            blk++;
+            continue;
+        }
+        if (inode->data_ra[blk] == NFS_RA_INFLIGHT)
+        {   /* 读到的块等待其预读完成，预读范围内的不重复提交 */
+            if (blk >= ra_from)
+            {
+                blk++;
+            }
+            else if (nfs_ra_wait(inode, blk) != NFS_ERROR_NONE)
+            {
+                return -NFS_ERROR_IO;
+            }
+            continue;
+        }
+        pblk = nfs_file_bmap(file, inode, blk, FALSE);
+        if (pblk < -1)
+        {
+            return -NFS_ERROR_IO;
+        }
+        if (pblk == -1)
+        {   /* 尚未分配数据块，内容为0 */
+            inode->data[blk] = (uint8_t *)nfs_slab_zalloc(NFS_SLAB_BLK);
+            if (inode->data[blk] == NULL)
+            {
+                return -NFS_ERROR_NOSPACE;
+            }
+            blk++;
+            continue;
+        }
+
+        run = 1;
+        while (blk + run < end && run < NFS_RA_MAX_BLKS && inode->data[blk + run] == NULL &&
+               inode->data_ra[blk + run] != NFS_RA_INFLIGHT && (blk >= ra_from || blk + run < ra_from))
+        {   /* 读到的块与预读的块分开读，前者同步、后者异步 */
+            next = nfs_file_bmap(file, inode, blk + run, FALSE);
+            if (next != pblk + run)
+            {
+                break;
+            }
+            run++;
+        }
+        if (blk >= ra_from && (i = nfs_ra_submit(inode, blk, pblk, run)) > 0)
+        {
+            blk += i;
+            continue;
+        }
+        for (i = 0; i < run; i++)
+        {
+            iov[i].iov_base = nfs_slab_alloc(NFS_SLAB_BLK);
+            iov[i].iov_len = NFS_BLOCK_SIZE;
+            if (iov[i].iov_base == NULL)
+            {
+                run = i;
+                break;
+            }
+        }
+        if (run == 0 || nfs_driver_readv(NFS_DATA_OFS(pblk), iov, run) != NFS_ERROR_NONE)
+        {
+            NFS_DBG("[%s] can't load, ino %d blk %d\n", __func__, inode->ino, blk);
+            for (i = 0; i < run; i++)
+            {
+                nfs_slab_free(NFS_SLAB_BLK, iov[i].iov_base);
+            }
+            return -NFS_ERROR_IO;
+        }
+        for (i = 0; i < run; i++)
+        {
+            inode->data[blk + i] = (uint8_t *)iov[i].iov_base;
+            if (blk + i >= ra_from)
+            {
+                inode->data_ra[blk + i] = TRUE;
+                nfs_ra_stat.prefetched++;
+            }
+        }
+        blk += run;
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 初始化打开文件的预读状态
+ *
+ * @param file
+ */
+void nfs_ra_init(struct nfs_file *file)
+{
+    memset(file, 0, sizeof(struct nfs_file));
+}
+/**
+ * @brief 同步装入[blk_start, blk_end)，不预读，供写文件时使用
+ *
+ * @param file 打开文件，可为NULL
+ * @param inode
+ * @param blk_start
+ * @param blk_end
+ * @return int
+ */
+int nfs_file_load(struct nfs_file *file, struct nfs_inode *inode, int blk_start, int blk_end)
+{
+    return nfs_ra_fill(file, inode, blk_start, blk_end, blk_end);
+}
+/**
+ * @brief 读文件前调用，保证读到的块已装入，顺序读时向后预读
+ *
+ * @param file 打开文件的预读状态，NULL表示不预读
+ * @param inode
+ * @param offset 读起始位置
+ * @param size 读字节数，不超过文件末尾
+ * @return int
+ */
+int nfs_ra_read(struct nfs_file *file, struct nfs_inode *inode, int offset, int size)
+{
+    int blk_start = NFS_BLK_OF(offset);
+    int blk_end = NFS_BLK_OF(offset + size - 1) + 1;
+    int nblks = NFS_ROUND_UP(inode->size, NFS_BLOCK_SIZE) / NFS_BLOCK_SIZE;
+    int ra_start = blk_end;
+    int ra_end = blk_end;
+    int blk;
+
+    if (nblks > NFS_FILE_MAX_BLKS)
+    {
+        nblks = NFS_FILE_MAX_BLKS;
+    }
+    if (nfs_file_reserve(inode, blk_end) != NFS_ERROR_NONE)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    if (nfs_ra_inflight > 0 && nfs_ra_collect(FALSE) < 0)
+    {
+        return -NFS_ERROR_IO;
+    }
+    for (blk = blk_start; blk < blk_end; blk++)
+    {
+        if (inode->data_ra[blk] == NFS_RA_INFLIGHT && nfs_ra_wait(inode, blk) != NFS_ERROR_NONE)
+        {
+            return -NFS_ERROR_IO;
+        }
+        if (inode->data_ra[blk])
+        {
+            inode->data_ra[blk] = FALSE;
+            nfs_ra_stat.hits++;
+        }
+        else if (inode->data[blk] == NULL && !NFS_IS_INLINE(inode) &&
+                 nfs_file_bmap(file, inode, blk, FALSE) >= 0)
+        {
+            nfs_ra_stat.misses++;
+        }
+    }
+
+    if (file != NULL)
+    {
+        if (offset == file->ra_pos)
+        {
+            if (file->ra_size == 0)
+            {
+                file->ra_size = NFS_RA_MIN_BLKS;
+                file->ra_end = blk_end;
+            }
+            if (blk_end + file->ra_size / 2 >= file->ra_end)
+            {   /* 读者接近已预读的位置，发起下一次预读 */
+                ra_start = blk_end > file->ra_end ? blk_end : file->ra_end;
+                ra_end = blk_end + file->ra_size < nblks ? blk_end + file->ra_size : nblks;
+                if (ra_start < ra_end)
+                {
+                    nfs_ra_stat.windows++;
+                    file->ra_end = ra_end;
+                }
+                if (file->ra_size < NFS_RA_MAX_BLKS)
+                {
+                    file->ra_size *= 2;
+                }
+            }
+        }
+        else
+        {   /* 随机读，停止预读 */
+            file->ra_size = 0;
+            file->ra_end = 0;
+        }
+        file->ra_pos = offset + size;
+    }
+
+    if (ra_start > blk_end)
+    {   /* 读到的块与预读窗口不相邻，分开装入 */
+        if (nfs_ra_fill(file, inode, blk_start, blk_end, blk_end) != NFS_ERROR_NONE)
+        {
+            return -NFS_ERROR_IO;
+        }
+        blk_start = ra_start;
+    }
+    return nfs_ra_fill(file, inode, blk_start, ra_end > blk_end ? ra_end : blk_end, blk_end);
+}
+/**
+ * @brief 等待inode(NULL表示所有文件)在途的异步预读完成，截断、释放文件与卸载前调用
+ *
+ * @param inode
+ */
+void nfs_ra_drain(struct nfs_inode *inode)
+{
+    int i;
+
+    for (i = 0; i < NFS_RA_ASYNC_REQS; i++)
+    {
+        while (nfs_ra_reqs[i].inode != NULL && (inode == NULL || nfs_ra_reqs[i].inode == inode))
+        {
+            if (nfs_ra_collect(TRUE) <= 0)
+            {
+                NFS_DBG("[%s] can't reap readahead, ino %d\n", __func__, nfs_ra_reqs[i].inode->ino);
+                return;
+            }
+        }
+    }
+}
+/**
+ * @brief 打印预读命中统计
+ *
+ */
+void nfs_ra_dump()
+{
+    uint64_t total = nfs_ra_stat.hits + nfs_ra_stat.misses;
+
+    NFS_DBG("[%s] windows %lu, prefetched %lu blks (%lu async reqs, %lu waits), hits %lu, misses %lu (%.2f%% hit)\n",
+            __func__, (unsigned long)nfs_ra_stat.windows, (unsigned long)nfs_ra_stat.prefetched,
+            (unsigned long)nfs_ra_stat.async, (unsigned long)nfs_ra_stat.waits,
+            (unsigned long)nfs_ra_stat.hits, (unsigned long)nfs_ra_stat.misses,
+            total ? 100.0 * nfs_ra_stat.hits / total : 0.0);
+}
@@ -0,0 +1,182 @@
+#include "../include/newfs.h"
+
+/******************************************************************************
+* SECTION: 对象分配器
+* dentry、inode与文件数据块缓冲区各用一个slab：
+*   1) 每次向malloc申请一整块(chunk)，切成同样大小的对象挂入空闲链表
+*   2) 释放的对象回到所属slab的空闲链表，不还给malloc
+*   3) 卸载时整块释放所有chunk，不必逐个遍历目录树
+*******************************************************************************/
+static struct nfs_slab nfs_slabs[NFS_SLAB_NR];
+
+static void nfs_slab_setup(int type, const char *name, int obj_size, int per_chunk)
+{
+    struct nfs_slab *slab = &nfs_slabs[type];
+
+    memset(slab, 0, sizeof(struct nfs_slab));
+    slab->name = name;
+    slab->obj_size = NFS_ROUND_UP(obj_size, sizeof(uint64_t)); /* 对象按8字节对齐，且放得下空闲链表指针 */
+    slab->per_chunk = per_chunk;
+}
+
+/**
+ * @brief 申请一个chunk，将其中的对象全部挂入空闲链表
+ *
+ * @param slab
+ * @return int
+ */
+static int nfs_slab_grow(struct nfs_slab *slab)
+{
+    struct nfs_slab_chunk *chunk;
+    uint8_t *obj;
+    int i;
+
+    chunk = (struct nfs_slab_chunk *)malloc(sizeof(struct nfs_slab_chunk) +
+                                            (size_t)slab->obj_size * slab->per_chunk);
+    if (chunk == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    chunk->next = slab->chunks;
+    slab->chunks = chunk;
+    slab->nr_chunks++;
+    for (i = slab->per_chunk - 1; i >= 0; i--)
+    {   /* 倒序入链，分配时按地址递增取出 */
+        obj = (uint8_t *)chunk->objs + (size_t)i * slab->obj_size;
+        *(void **)obj = slab->free_list;
+        slab->free_list = obj;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 初始化各slab，chunk在第一次分配时才申请
+ *
+ */
+void nfs_slab_init()
+{
+    nfs_slab_setup(NFS_SLAB_DENTRY, "dentry", sizeof(struct nfs_dentry), NFS_SLAB_DENTRY_PER_CHUNK);
+    nfs_slab_setup(NFS_SLAB_INODE, "inode", sizeof(struct nfs_inode), NFS_SLAB_INODE_PER_CHUNK);
+    nfs_slab_setup(NFS_SLAB_BLK, "data blk", NFS_BLOCK_SIZE, NFS_SLAB_BLK_PER_CHUNK);
+}
+
+/**
+ * @brief 分配一个对象，内容未初始化
+ *
+ * @param type NFS_SLAB_*
+ * @return void* 内存不足时返回NULL
+ */
+void *nfs_slab_alloc(int type)
+{
+    struct nfs_slab *slab = &nfs_slabs[type];
+    void *obj;
+
+    if (slab->free_list == NULL && nfs_slab_grow(slab) != NFS_ERROR_NONE)
+    {
+        return NULL;
+    }
+    obj = slab->free_list;
+    slab->free_list = *(void **)obj;
+    slab->allocs++;
+    slab->in_use++;
+    if (slab->in_use > slab->peak)
+    {
+        slab->peak = slab->in_use;
+    }
+    return obj;
+}
+
+/**
+ * @brief 分配一个清零的对象
+ *
+ * @param type NFS_SLAB_*
+ * @return void*
+ */
+void *nfs_slab_zalloc(int type)
+{
+    void *obj = nfs_slab_alloc(type);
+
+    if (obj)
+    {
+        memset(obj, 0, nfs_slabs[type].obj_size);
+    }
+    return obj;
+}
+
+/**
+ * @brief 将对象还给所属slab，obj为NULL时不做任何事
+ *
+ * @param type NFS_SLAB_*
+ * @param obj
+ */
+void nfs_slab_free(int type, void *obj)
+{
+    struct nfs_slab *slab = &nfs_slabs[type];
+
+    if (obj == NULL)
+    {
+        return;
+    }
+    *(void **)obj = slab->free_list;
+    slab->free_list = obj;
+    slab->frees++;
+    slab->in_use--;
+}
+
+/**
+ * @brief 释放所有slab的全部chunk，之前分配的对象全部失效
+ *
+ */
+void nfs_slab_destroy()
+{
+    struct nfs_slab_chunk *chunk, *next;
+    int type;
+
+    for (type = 0; type < NFS_SLAB_NR; type++)
+    {
+        for (chunk = nfs_slabs[type].chunks; chunk; chunk = next)
+        {
+            next = chunk->next;
+            free(chunk);
+        }
+        nfs_slabs[type].chunks = NULL;
+        nfs_slabs[type].free_list = NULL;
+        nfs_slabs[type].nr_chunks = 0;
+        nfs_slabs[type].in_use = 0;
+    }
+}
+
+/**
+ * @brief 查询一个slab的使用情况
+ *
+ * @param type NFS_SLAB_*
+ * @param in_use 正在使用的对象数
+ * @param peak 使用对象数的峰值
+ * @param chunks 已申请的chunk数
+ */
+void nfs_slab_stat(int type, uint64_t *in_use, uint64_t *peak, uint64_t *chunks)
+{
+    *in_use = nfs_slabs[type].in_use;
+    *peak = nfs_slabs[type].peak;
+    *chunks = nfs_slabs[type].nr_chunks;
+}
+
+/**
+ * @brief 打印各slab统计
+ *
+ */
+void nfs_slab_dump()
+{
+    struct nfs_slab *slab;
+    int type;
+
+    for (type = 0; type < NFS_SLAB_NR; type++)
+    {
+        slab = &nfs_slabs[type];
+        NFS_DBG("[%s] %-8s obj %d B, in use %lu, peak %lu, allocs %lu, frees %lu, chunks %d (%lu KB)\n",
+                __func__, slab->name, slab->obj_size,
+                (unsigned long)slab->in_use, (unsigned long)slab->peak,
+                (unsigned long)slab->allocs, (unsigned long)slab->frees, slab->nr_chunks,
+                (unsigned long)slab->nr_chunks * slab->per_chunk * slab->obj_size / 1024);
+    }
+}
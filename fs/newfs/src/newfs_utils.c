@@ -4,103 +4,441 @@ extern struct nfs_super nfs_super;
 extern struct custom_options nfs_options;
 
 /**
- * @brief 获取文件名
+ * @brief 初始化路径分量迭代器，不拷贝路径
  *
+ * @param it
  * @param path
- * @return char*
  */
-char *nfs_get_fname(const char *path)
+void nfs_path_iter_init(struct nfs_path_iter *it, const char *path)
 {
-    char ch = '/';
-    char *q = strrchr(path, ch) + 1;
-    return q;
+    it->path = path;
+    it->cur = path;
+    it->name = NULL;
+    it->len = 0;
+    it->canon = TRUE;
 }
 /**
- * @brief 计算路径的层级
- * exm: /av/c/d/f
- * -> lvl = 4
- * @param path
- * @return int
+ * @brief 取下一个分量，跳过连续的'/'
+ * exm: //av/./c/ -> "av" "." "c"
+ *
+ * @param it
+ * @return boolean 没有更多分量时返回FALSE
+ */
+boolean nfs_path_next(struct nfs_path_iter *it)
+{
+    const char *p = it->cur;
+    int slashes = 0;
+
+    while (*p == '/')
+    {
+        p++;
+        slashes++;
+    }
+    if (*p == '\0')
+    {   /* 只有根目录"/"可以以'/'结尾 */
+        if (slashes > 0 && p - slashes != it->path)
+        {
+            it->canon = FALSE;
+        }
+        it->cur = p;
+        return FALSE;
+    }
+    it->name = p;
+    while (*p != '\0' && *p != '/')
+    {
+        p++;
+    }
+    it->len = p - it->name;
+    it->cur = p;
+    if (slashes != 1 || (it->name[0] == '.' && (it->len == 1 || (it->len == 2 && it->name[1] == '.'))))
+    {
+        it->canon = FALSE;
+    }
+    return TRUE;
+}
+/**
+ * @brief 当前分量是否为最后一个(其后最多还有若干'/')
+ *
+ * @param it
+ * @return boolean
  */
-int nfs_calc_lvl(const char *path)
+boolean nfs_path_is_last(const struct nfs_path_iter *it)
 {
-    // char* path_cpy = (char *)malloc(strlen(path));
-    // strcpy(path_cpy, path);
-    char *str = path;
-    int lvl = 0;
-    if (strcmp(path, "/") == 0)
+    const char *p = it->cur;
+
+    while (*p == '/')
     {
-        return lvl;
+        p++;
     }
-    while (*str != NULL)
+    return *p == '\0';
+}
+static pthread_key_t  nfs_scratch_key;
+static pthread_once_t nfs_scratch_once = PTHREAD_ONCE_INIT;
+
+static void nfs_scratch_key_init()
+{
+    pthread_key_create(&nfs_scratch_key, free);
+}
+/**
+ * @brief 获取本线程的暂存缓冲区，大小为两个IO单元，按IO单元对齐
+ * 只用于首尾不对齐的IO单元，首次使用时分配，线程退出时释放
+ *
+ * @return uint8_t*
+ */
+static uint8_t *nfs_scratch_buf()
+{
+    uint8_t *scratch;
+
+    pthread_once(&nfs_scratch_once, nfs_scratch_key_init);
+    scratch = (uint8_t *)pthread_getspecific(nfs_scratch_key);
+    if (scratch == NULL)
     {
-        if (*str == '/')
+        if (posix_memalign((void **)&scratch, NFS_IO_SZ(), 2 * NFS_IO_SZ()) != 0)
         {
-            lvl++;
+            return NULL;
         }
-        str++;
+        pthread_setspecific(nfs_scratch_key, scratch);
     }
-    return lvl;
+    return scratch;
 }
 /**
- * @brief 驱动读
+ * @brief 直接读设备，绕过块缓存
+ * offset与size都对齐时直接读入out_content；否则只有首尾IO单元经暂存区中转，
+ * 中间部分仍直接读入out_content，整个范围一次preadv完成
+ * 使用定位IO，不依赖设备的磁盘头位置，多线程可并发调用
  *
  * @param offset
  * @param out_content
  * @param size
  * @return int
  */
-int nfs_driver_read(int offset, uint8_t *out_content, int size)
+int nfs_dev_read(int offset, uint8_t *out_content, int size)
 {
     int offset_aligned = NFS_ROUND_DOWN(offset, NFS_IO_SZ());
     int bias = offset - offset_aligned;
     int size_aligned = NFS_ROUND_UP((size + bias), NFS_IO_SZ());
-    uint8_t *temp_content = (uint8_t *)malloc(size_aligned);
-    uint8_t *cur = temp_content;
-    // lseek(NFS_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(NFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        // read(NFS_DRIVER(), cur, NFS_IO_SZ());
-        ddriver_read(NFS_DRIVER(), cur, NFS_IO_SZ());
-        cur += NFS_IO_SZ();
-        size_aligned -= NFS_IO_SZ();
-    }
-    memcpy(out_content, temp_content + bias, size);
-    free(temp_content);
+    int tail = (bias + size) % NFS_IO_SZ();      /* 末尾IO单元中有效的字节数 */
+    int head_len = bias ? NFS_IO_SZ() - bias : 0;
+    struct iovec iov[3];
+    int iovcnt = 0;
+    uint8_t *scratch;
+
+    if (bias == 0 && tail == 0)
+    {   /* 快速路径: 无需中转 */
+        if (ddriver_pread(NFS_DRIVER(), (char *)out_content, size, offset_aligned) != size)
+        {
+            return -NFS_ERROR_IO;
+        }
+        return NFS_ERROR_NONE;
+    }
+
+    scratch = nfs_scratch_buf();
+    if (scratch == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    if (size_aligned == NFS_IO_SZ())
+    {   /* 首尾是同一个IO单元 */
+        if (ddriver_pread(NFS_DRIVER(), (char *)scratch, NFS_IO_SZ(), offset_aligned) != NFS_IO_SZ())
+        {
+            return -NFS_ERROR_IO;
+        }
+        memcpy(out_content, scratch + bias, size);
+        return NFS_ERROR_NONE;
+    }
+
+    if (bias)
+    {
+        iov[iovcnt].iov_base = scratch;
+        iov[iovcnt++].iov_len = NFS_IO_SZ();
+    }
+    if (size - head_len - tail > 0)
+    {
+        iov[iovcnt].iov_base = out_content + head_len;
+        iov[iovcnt++].iov_len = size - head_len - tail;
+    }
+    if (tail)
+    {
+        iov[iovcnt].iov_base = scratch + NFS_IO_SZ();
+        iov[iovcnt++].iov_len = NFS_IO_SZ();
+    }
+    if (ddriver_preadv(NFS_DRIVER(), iov, iovcnt, offset_aligned) != size_aligned)
+    {
+        return -NFS_ERROR_IO;
+    }
+    memcpy(out_content, scratch + bias, head_len);
+    memcpy(out_content + size - tail, scratch + NFS_IO_SZ(), tail);
     return NFS_ERROR_NONE;
 }
 /**
- * @brief 驱动写
+ * @brief 直接写设备，绕过块缓存
+ * 只有首尾未被完整覆盖的IO单元需要先读出再合并(read-modify-write)，
+ * 被完整覆盖的IO单元直接从in_content写入，整个范围一次pwritev完成
  *
  * @param offset
  * @param in_content
  * @param size
  * @return int
  */
-int nfs_driver_write(int offset, uint8_t *in_content, int size)
+int nfs_dev_write(int offset, uint8_t *in_content, int size)
 {
     int offset_aligned = NFS_ROUND_DOWN(offset, NFS_IO_SZ());
     int bias = offset - offset_aligned;
     int size_aligned = NFS_ROUND_UP((size + bias), NFS_IO_SZ());
-    uint8_t *temp_content = (uint8_t *)malloc(size_aligned);
-    uint8_t *cur = temp_content;
-    nfs_driver_read(offset_aligned, temp_content, size_aligned);
-    memcpy(temp_content + bias, in_content, size);
+    int tail_aligned = offset_aligned + size_aligned - NFS_IO_SZ();
+    int tail = (bias + size) % NFS_IO_SZ();      /* 末尾IO单元中被覆盖的字节数 */
+    int head_len = bias ? NFS_IO_SZ() - bias : 0;
+    struct iovec iov[3];
+    int iovcnt = 0;
+    uint8_t *scratch;
+
+    if (bias == 0 && tail == 0)
+    {   /* 快速路径: 无需中转 */
+        if (ddriver_pwrite(NFS_DRIVER(), (char *)in_content, size, offset_aligned) != size)
+        {
+            return -NFS_ERROR_IO;
+        }
+        return NFS_ERROR_NONE;
+    }
+
+    scratch = nfs_scratch_buf();
+    if (scratch == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    if (size_aligned == NFS_IO_SZ())
+    {   /* 首尾是同一个IO单元 */
+        if (nfs_dev_read(offset_aligned, scratch, NFS_IO_SZ()) != NFS_ERROR_NONE)
+        {
+            return -NFS_ERROR_IO;
+        }
+        memcpy(scratch + bias, in_content, size);
+        if (ddriver_pwrite(NFS_DRIVER(), (char *)scratch, NFS_IO_SZ(), offset_aligned) != NFS_IO_SZ())
+        {
+            return -NFS_ERROR_IO;
+        }
+        return NFS_ERROR_NONE;
+    }
+
+    if (bias)
+    {   /* 首个IO单元只写了一部分 */
+        if (nfs_dev_read(offset_aligned, scratch, NFS_IO_SZ()) != NFS_ERROR_NONE)
+        {
+            return -NFS_ERROR_IO;
+        }
+        memcpy(scratch + bias, in_content, head_len);
+        iov[iovcnt].iov_base = scratch;
+        iov[iovcnt++].iov_len = NFS_IO_SZ();
+    }
+    if (size - head_len - tail > 0)
+    {
+        iov[iovcnt].iov_base = in_content + head_len;
+        iov[iovcnt++].iov_len = size - head_len - tail;
+    }
+    if (tail)
+    {   /* 末尾IO单元只写了一部分 */
+        if (nfs_dev_read(tail_aligned, scratch + NFS_IO_SZ(), NFS_IO_SZ()) != NFS_ERROR_NONE)
+        {
+            return -NFS_ERROR_IO;
+        }
+        memcpy(scratch + NFS_IO_SZ(), in_content + size - tail, tail);
+        iov[iovcnt].iov_base = scratch + NFS_IO_SZ();
+        iov[iovcnt++].iov_len = NFS_IO_SZ();
+    }
+
+    if (ddriver_pwritev(NFS_DRIVER(), iov, iovcnt, offset_aligned) != size_aligned)
+    {
+        return -NFS_ERROR_IO;
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 驱动读，启用块缓存时经缓存读，否则读盘后叠加刷写队列中的块
+ *
+ * @param offset
+ * @param out_content
+ * @param size
+ * @return int
+ */
+int nfs_driver_read(int offset, uint8_t *out_content, int size)
+{
+    if (nfs_cache_enabled())
+    {
+        return nfs_cache_read(offset, out_content, size);
+    }
+    if (nfs_dev_read(offset, out_content, size) != NFS_ERROR_NONE)
+    {
+        return -NFS_ERROR_IO;
+    }
+    nfs_ioq_overlay(offset, out_content, size);    /* plug期间刚写的块还在刷写队列中 */
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 驱动分散读，读入iov各段；不经块缓存且对齐IO单元时一次preadv完成
+ *
+ * @param offset
+ * @param iov 各段长度为IO单元的整数倍时走快速路径
+ * @param iovcnt
+ * @return int
+ */
+int nfs_driver_readv(int offset, const struct iovec *iov, int iovcnt)
+{
+    boolean aligned = !nfs_cache_enabled() && offset % NFS_IO_SZ() == 0;
+    int size = 0;
+    int i;
 
-    // lseek(NFS_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(NFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
+    for (i = 0; i < iovcnt; i++)
+    {
+        aligned = aligned && iov[i].iov_len % NFS_IO_SZ() == 0;
+        size += iov[i].iov_len;
+    }
+    if (aligned)
+    {
+        if (ddriver_preadv(NFS_DRIVER(), iov, iovcnt, offset) != size)
+        {
+            return -NFS_ERROR_IO;
+        }
+        for (i = 0; i < iovcnt; offset += iov[i].iov_len, i++)
+        {
+            nfs_ioq_overlay(offset, (uint8_t *)iov[i].iov_base, iov[i].iov_len);
+        }
+        return NFS_ERROR_NONE;
+    }
+    for (i = 0; i < iovcnt; offset += iov[i].iov_len, i++)
+    {
+        if (nfs_driver_read(offset, (uint8_t *)iov[i].iov_base, iov[i].iov_len) != NFS_ERROR_NONE)
+        {
+            return -NFS_ERROR_IO;
+        }
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 驱动写，启用块缓存时只写入缓存，淘汰或sync时写回；
+ * 不启用缓存时plug期间写入刷写队列
+ *
+ * @param offset
+ * @param in_content
+ * @param size
+ * @return int
+ */
+int nfs_driver_write(int offset, uint8_t *in_content, int size)
+{
+    if (nfs_cache_enabled())
     {
-        // write(NFS_DRIVER(), cur, NFS_IO_SZ());
-        ddriver_write(NFS_DRIVER(), cur, NFS_IO_SZ());
-        cur += NFS_IO_SZ();
-        size_aligned -= NFS_IO_SZ();
+        return nfs_cache_write(offset, in_content, size);
+    }
+    if (nfs_ioq_plugged())
+    {   /* 不经缓存时同样交给刷写队列排序合并 */
+        return nfs_ioq_write(offset, in_content, size);
     }
+    return nfs_dev_write(offset, in_content, size);
+}
+/**
+ * @brief 驱动聚集写，写出iov各段；不经块缓存且对齐IO单元时直接一次pwritev完成，
+ * plug期间也不再拷贝入刷写队列(调用者已把磁盘上连续的块合并成一段)
+ *
+ * @param offset
+ * @param iov 各段长度为IO单元的整数倍时走快速路径
+ * @param iovcnt
+ * @return int
+ */
+int nfs_driver_writev(int offset, const struct iovec *iov, int iovcnt)
+{
+    boolean aligned = !nfs_cache_enabled() && offset % NFS_IO_SZ() == 0;
+    int size = 0;
+    int i;
 
-    free(temp_content);
+    for (i = 0; i < iovcnt; i++)
+    {
+        aligned = aligned && iov[i].iov_len % NFS_IO_SZ() == 0;
+        size += iov[i].iov_len;
+    }
+    if (aligned)
+    {
+        if (ddriver_pwritev(NFS_DRIVER(), iov, iovcnt, offset) != size)
+        {
+            return -NFS_ERROR_IO;
+        }
+        for (i = 0; i < iovcnt; offset += iov[i].iov_len, i++)
+        {
+            nfs_ioq_refresh(offset, (uint8_t *)iov[i].iov_base, iov[i].iov_len);
+        }
+        return NFS_ERROR_NONE;
+    }
+    for (i = 0; i < iovcnt; offset += iov[i].iov_len, i++)
+    {
+        if (nfs_driver_write(offset, (uint8_t *)iov[i].iov_base, iov[i].iov_len) != NFS_ERROR_NONE)
+        {
+            return -NFS_ERROR_IO;
+        }
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 启用块缓存时立即写回覆盖[offset, offset + size)的脏缓存块(plug期间进入刷写队列)，
+ * 写回路径写出的元数据与数据由此各自落盘，不依赖nfs_cache_sync全量写回
+ *
+ * @param offset
+ * @param size
+ * @return int
+ */
+int nfs_driver_flush(int offset, int size)
+{
+    int blk;
+
+    if (!nfs_cache_enabled() || size <= 0)
+    {
+        return NFS_ERROR_NONE;
+    }
+    for (blk = NFS_BLK_OF(offset); blk <= NFS_BLK_OF(offset + size - 1); blk++)
+    {
+        if (nfs_cache_sync_blk(blk) != NFS_ERROR_NONE)
+        {
+            return -NFS_ERROR_IO;
+        }
+    }
     return NFS_ERROR_NONE;
 }
+/**
+ * @brief 新建一个内存目录项
+ *
+ * @param fname 文件名，不要求以'\0'结尾
+ * @param len 文件名长度
+ * @param ftype
+ * @return struct nfs_dentry*
+ */
+struct nfs_dentry *new_dentry_len(const char *fname, int len, NFS_FILE_TYPE ftype)
+{
+    struct nfs_dentry *dentry = (struct nfs_dentry *)nfs_slab_zalloc(NFS_SLAB_DENTRY);
+
+    memcpy(dentry->fname, fname, len);
+    dentry->ftype = ftype;
+    dentry->ino = -1;
+    return dentry;
+}
+struct nfs_dentry *new_dentry(const char *fname, NFS_FILE_TYPE ftype)
+{
+    return new_dentry_len(fname, strlen(fname), ftype);
+}
+/**
+ * @brief 释放new_dentry得到的目录项
+ *
+ * @param dentry
+ */
+void free_dentry(struct nfs_dentry *dentry)
+{
+    nfs_slab_free(NFS_SLAB_DENTRY, dentry);
+}
+/**
+ * @brief 分配一个数据块，占用数据位图
+ *
+ * @return int 数据块号，没有空闲块时返回-NFS_ERROR_NOSPACE
+ */
+int nfs_alloc_data_blk()
+{
+    return nfs_bitmap_alloc(&nfs_super.data_bm);
+}
 /**
  * @brief 将denry插入到inode中，采用头插法
  *
@@ -110,240 +448,481 @@ int nfs_driver_write(int offset, uint8_t *in_content, int size)
  */
 int nfs_alloc_dentry(struct nfs_inode *inode, struct nfs_dentry *dentry)
 {
-    if (inode->dentrys == NULL)
+    int blks, i;
+
+    dentry->brother = inode->dentrys;
+    inode->dentrys = dentry;
+    inode->dir_cnt++;
+
+    /* 目录项变长，按排列后需要的块数分配，从磁盘读入或删除后保留的块不重新分配 */
+    blks = nfs_dir_blks(inode);
+    for (i = 0; i < blks && i < NFS_DATA_PER_FILE; i++)
     {
-        inode->dentrys = dentry;
+        if (inode->block_pointer[i] == -1)
+        {
+            inode->block_pointer[i] = nfs_alloc_data_blk();
+            if (inode->block_pointer[i] < 0)
+            {
+                inode->block_pointer[i] = -1;
+                blks = NFS_DATA_PER_FILE + 1;
+                continue;
+            }
+            inode->blocks++;
+        }
+    }
+    if (blks > NFS_DATA_PER_FILE)
+    {   /* 目录已满 */
+        inode->dentrys = dentry->brother;
+        dentry->brother = NULL;
+        inode->dir_cnt--;
+        return -NFS_ERROR_NOSPACE;
+    }
+    nfs_dir_hash_insert(inode, dentry);
+    return inode->dir_cnt;
+}
+/**
+ * @brief 将dentry从inode的dentrys中取出
+ *
+ * @param inode 一个目录的索引结点
+ * @param dentry 该目录下的一个目录项
+ * @return int
+ */
+int nfs_drop_dentry(struct nfs_inode *inode, struct nfs_dentry *dentry)
+{
+    boolean is_find = FALSE;
+    struct nfs_dentry *dentry_cursor;
+    dentry_cursor = inode->dentrys;
+
+    if (dentry_cursor == dentry)
+    {
+        inode->dentrys = dentry->brother;
+        is_find = TRUE;
     }
     else
     {
-        dentry->brother = inode->dentrys;
-        inode->dentrys = dentry;
+        while (dentry_cursor)
+        {
+            if (dentry_cursor->brother == dentry)
+            {
+                dentry_cursor->brother = dentry->brother;
+                is_find = TRUE;
+                break;
+            }
+            dentry_cursor = dentry_cursor->brother;
+        }
+    }
+    if (!is_find)
+    {
+        return -NFS_ERROR_NOTFOUND;
     }
+    nfs_dir_hash_remove(inode, dentry);
+    inode->dir_cnt--;
+    return inode->dir_cnt;
+}
+/**
+ * @brief 分配一个inode，占用位图
+ *
+ * @param dentry 该dentry指向分配的inode
+ * @return nfs_inode 没有空闲inode时返回NULL
+ */
+struct nfs_inode *nfs_alloc_inode(struct nfs_dentry *dentry)
+{
+    struct nfs_inode *inode;
+    int ino_cursor = nfs_bitmap_alloc(&nfs_super.inode_bm); /* 占用inode位图 */
+
+    if (ino_cursor < 0)
+        return NULL;
 
+    inode = (struct nfs_inode *)nfs_slab_alloc(NFS_SLAB_INODE);
+    if (inode == NULL)
+    {
+        nfs_bitmap_free(&nfs_super.inode_bm, ino_cursor);
+        return NULL;
+    }
+    inode->ino = ino_cursor;
+    inode->size = 0;
 
-    int byte_cursor  = 0;
-    int bit_cursor  = 0;
-    int data_cursor  = 0;
-    boolean  is_find_free_entry = FALSE; 
+    /* dentry指向inode */
+    dentry->inode = inode;
+    dentry->ino = inode->ino;
+    /* inode指回dentry */
+    inode->dentry = dentry;
 
+    inode->dir_cnt = 0;
+    inode->dentrys = NULL;
+    inode->dhash = NULL;
+    inode->dhash_sz = 0;
+    inode->dhash_cnt = 0;
+    inode->dirty = 0;
+    inode->dirty_next = NULL;
+    inode->dirty_pprev = NULL;
 
-    // 计算当前目录项是否达到了块的最大容量
-    int index = inode->dir_cnt;
-    int alloc = inode->dir_cnt %  DENTRY_PER_BLOCK(); // 当前目录项在块中的位置
+    for (int i =0;i<NFS_DATA_PER_FILE;i++){
+        inode->block_pointer[i] = -1;
+    }
+    nfs_bmap_init(inode, -1, -1, 0);                  /* 数据块在第一次读写时才分配 */
+    inode->flags = NFS_IS_REG(inode) ? NFS_INODE_F_INLINE | NFS_INODE_F_EXTENTS : 0; /* 新文件从内联开始 */
+    nfs_mark_inode_dirty(inode, NFS_INODE_DIRTY | NFS_INODE_DIRTY_NEW); /* 新inode尚未落盘 */
 
-    if(alloc == 0){
-    for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(nfs_super.map_data_blks);
-         byte_cursor++)
+    return inode;
+}
+/**
+ * @brief 标记inode需要写回，并挂入脏链表
+ *
+ * @param inode
+ * @param flags NFS_INODE_DIRTY_*
+ */
+void nfs_mark_inode_dirty(struct nfs_inode *inode, int flags)
+{
+    inode->dirty |= flags;
+    if (inode->dirty_pprev == NULL)
     {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-            if((nfs_super.map_data[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-                                                      /* 当前ino_cursor位置空闲 */
-                nfs_super.map_data[byte_cursor] |= (0x1 << bit_cursor);
-                is_find_free_entry = TRUE;           
-                break;
-            }
-            data_cursor++;
+        inode->dirty_next = nfs_super.dirty_list;
+        if (nfs_super.dirty_list)
+        {
+            nfs_super.dirty_list->dirty_pprev = &inode->dirty_next;
         }
-        if (is_find_free_entry) {
-            break;
+        nfs_super.dirty_list = inode;
+        inode->dirty_pprev = &nfs_super.dirty_list;
+    }
+}
+/**
+ * @brief 标记文件的一个数据块需要写回
+ *
+ * @param inode
+ * @param blk 文件内块号
+ */
+void nfs_mark_data_dirty(struct nfs_inode *inode, int blk)
+{
+    inode->data_dirty[blk] = TRUE;
+    nfs_mark_inode_dirty(inode, NFS_INODE_DIRTY_DATA);
+}
+/**
+ * @brief 清除脏标记并移出脏链表，inode被释放前必须调用
+ *
+ * @param inode
+ */
+void nfs_clear_inode_dirty(struct nfs_inode *inode)
+{
+    if (inode->dirty_pprev)
+    {
+        *inode->dirty_pprev = inode->dirty_next;
+        if (inode->dirty_next)
+        {
+            inode->dirty_next->dirty_pprev = inode->dirty_pprev;
         }
     }
-     inode->block_pointer[index] = data_cursor;
+    inode->dirty_next = NULL;
+    inode->dirty_pprev = NULL;
+    inode->dirty = 0;
+    if (inode->data_dirty)
+    {
+        memset(inode->data_dirty, 0, inode->data_cap);
     }
-    
+}
+/**
+ * @brief 装入内联数据到data[0]，只读size字节，其余为0
+ *
+ * @param inode 内联文件
+ * @return int
+ */
+int nfs_inline_load(struct nfs_inode *inode)
+{
+    uint8_t *slot;
 
-    inode->dir_cnt++;
-    return inode->dir_cnt;
+    if (nfs_file_reserve(inode, 1) != NFS_ERROR_NONE)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    if (inode->data[0] != NULL)
+    {
+        return NFS_ERROR_NONE;
+    }
+    inode->data[0] = (uint8_t *)nfs_slab_zalloc(NFS_SLAB_BLK);
+    if (inode->data[0] == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    if (inode->size > 0)
+    {
+        if ((slot = nfs_itable_get(inode->ino, FALSE)) == NULL)
+        {
+            NFS_DBG("[%s] io error, ino %d\n", __func__, inode->ino);
+            return -NFS_ERROR_IO;
+        }
+        memcpy(inode->data[0], slot + NFS_INODE_D_SIZE(), inode->size);
+    }
+    return NFS_ERROR_NONE;
 }
 /**
- * @brief 将dentry从inode的dentrys中取出
+ * @brief 内联文件超过NFS_INLINE_MAX时转为普通文件，内联数据成为第0块
+ *
+ * @param inode 内联文件
+ * @return int
+ */
+int nfs_inline_promote(struct nfs_inode *inode)
+{
+    if (nfs_inline_load(inode) != NFS_ERROR_NONE)
+    {
+        return -NFS_ERROR_IO;
+    }
+    if (nfs_bmap(inode, 0, TRUE) < 0)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    inode->flags &= ~NFS_INODE_F_INLINE;
+    nfs_mark_data_dirty(inode, 0);
+    nfs_mark_inode_dirty(inode, NFS_INODE_DIRTY);
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 写回文件的脏数据块，磁盘上连续的脏块合并为一次写，每次最多NFS_WB_MAX_BLKS块
+ *
+ * @param inode
+ * @return int
+ */
+static int nfs_sync_data(struct nfs_inode *inode)
+{
+    struct nfs_file cursor;                           /* 按块号顺序查找，借用打开文件的映射缓存 */
+    struct iovec iov[NFS_WB_MAX_BLKS];
+    int blk, run, ret = NFS_ERROR_NONE;
+
+    nfs_ra_init(&cursor);
+    for (int i = 0; i < inode->data_cap && ret == NFS_ERROR_NONE; i += run)
+    {
+        run = 1;
+        if (!inode->data_dirty[i] || inode->data[i] == NULL ||
+            (blk = nfs_file_bmap(&cursor, inode, i, FALSE)) < 0)
+        {
+            continue;
+        }
+        while (run < NFS_WB_MAX_BLKS && i + run < inode->data_cap &&
+               inode->data_dirty[i + run] && inode->data[i + run] != NULL &&
+               nfs_file_bmap(&cursor, inode, i + run, FALSE) == blk + run)
+        {
+            run++;
+        }
+        for (int j = 0; j < run; j++)
+        {   /* 直接从各块缓冲区聚集写出 */
+            iov[j].iov_base = inode->data[i + j];
+            iov[j].iov_len = NFS_BLOCK_SIZE;
+        }
+        ret = nfs_driver_writev(NFS_DATA_OFS(blk), iov, run);
+        if (ret == NFS_ERROR_NONE)
+        {
+            ret = nfs_driver_flush(NFS_DATA_OFS(blk), NFS_BLKS_SZ(run));
+        }
+    }
+    if (ret != NFS_ERROR_NONE)
+    {
+        NFS_DBG("[%s] io error, ino %d\n", __func__, inode->ino);
+        return -NFS_ERROR_IO;
+    }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 将一个inode的脏部分写回磁盘: inode本身、目录项、脏数据块，不递归
+ *
+ * @param inode
+ * @return int
+ */
+int nfs_sync_inode(struct nfs_inode *inode)
+{
+    struct nfs_inode_d inode_d_buf;
+    struct nfs_inode_d *inode_d = &inode_d_buf;
+    int ino = inode->ino;
+    struct nfs_dentry *child;
+    uint8_t *slot;
+
+    if (inode->dirty & (NFS_INODE_DIRTY | (NFS_IS_INLINE(inode) ? NFS_INODE_DIRTY_DATA : 0)))
+    {
+        inode_d->ino = ino;
+        inode_d->size = inode->size;
+        inode_d->ftype = inode->dentry->ftype;
+        inode_d->dir_cnt = inode->dir_cnt;
+        if (NFS_IS_EXTENT(inode))
+        {
+            nfs_ext_fill(inode, inode_d);
+        }
+        else
+        {
+            for (int i = 0; i < NFS_DATA_PER_FILE; i++)
+            {
+                inode_d->block_pointer[i] = inode->block_pointer[i];
+            }
+            inode_d->ind_blk = inode->ind_blk;
+            inode_d->dind_blk = inode->dind_blk;
+        }
+        inode_d->blocks = inode->blocks;
+        inode_d->flags = inode->flags | NFS_INODE_F_BMAP;
+        if ((slot = nfs_itable_get(ino, TRUE)) == NULL)   /* 写入inode表块缓冲，整块写回 */
+        {
+            NFS_DBG("[%s] io error\n", __func__);
+            return -NFS_ERROR_IO;
+        }
+        nfs_itable_store(slot, inode_d);
+        if (NFS_IS_INLINE(inode) && inode->data_cap > 0 && inode->data[0] != NULL)
+        {   /* 内联数据与inode一次写回；未装入时磁盘上的内容不变 */
+            memcpy(slot + NFS_INODE_D_SIZE(), inode->data[0], inode->size);
+        }
+    }
+
+    if (NFS_IS_DIR(inode) && (inode->dirty & NFS_INODE_DIRTY_DENTRY))
+    {
+        for (child = inode->dentrys; child; child = child->brother)
+        {   /* 目录块列出所有子项，从未写回的子inode须一起落盘，否则崩溃后其inode槽无效 */
+            if (child->inode && (child->inode->dirty & NFS_INODE_DIRTY_NEW) &&
+                nfs_sync_inode(child->inode) != NFS_ERROR_NONE)
+            {
+                return -NFS_ERROR_IO;
+            }
+        }
+        if (nfs_dir_write(inode) != NFS_ERROR_NONE)
+        {
+            return -NFS_ERROR_IO;
+        }
+    }
+    else if (NFS_IS_REG(inode) && (inode->dirty & NFS_INODE_DIRTY_DATA))
+    { /* 只写被修改过的数据块 */
+        if (nfs_sync_data(inode) != NFS_ERROR_NONE)
+        {
+            return -NFS_ERROR_IO;
+        }
+        if (nfs_bmap_sync(inode) != NFS_ERROR_NONE)
+        {
+            return -NFS_ERROR_IO;
+        }
+    }
+    nfs_clear_inode_dirty(inode);
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 写回脏链表上的所有inode，开销只与修改量有关
  *
- * @param inode 一个目录的索引结点
- * @param dentry 该目录下的一个目录项
  * @return int
  */
-int nfs_drop_dentry(struct nfs_inode *inode, struct nfs_dentry *dentry)
+int nfs_sync_dirty()
 {
-    boolean is_find = FALSE;
-    struct nfs_dentry *dentry_cursor;
-    dentry_cursor = inode->dentrys;
-
-    if (dentry_cursor == dentry)
-    {
-        inode->dentrys = dentry->brother;
-        is_find = TRUE;
-    }
-    else
+    while (nfs_super.dirty_list)
     {
-        while (dentry_cursor)
+        if (nfs_sync_inode(nfs_super.dirty_list) != NFS_ERROR_NONE)
         {
-            if (dentry_cursor->brother == dentry)
-            {
-                dentry_cursor->brother = dentry->brother;
-                is_find = TRUE;
-                break;
-            }
-            dentry_cursor = dentry_cursor->brother;
+            return -NFS_ERROR_IO;
         }
     }
-    if (!is_find)
-    {
-        return -NFS_ERROR_NOTFOUND;
-    }
-    inode->dir_cnt--;
-    return inode->dir_cnt;
+    return nfs_itable_flush();
 }
 /**
- * @brief 分配一个inode，占用位图
+ * @brief 写回位图中修改过的块
  *
- * @param dentry 该dentry指向分配的inode
- * @return nfs_inode
+ * @param bm
+ * @param offset 位图在磁盘上的位置
+ * @param blks 位图占用的块数
+ * @return int
  */
-struct nfs_inode *nfs_alloc_inode(struct nfs_dentry *dentry)
+static int nfs_sync_bitmap(struct nfs_bitmap *bm, int offset, int blks)
 {
-    // printf("allocate once!\n");
-    struct nfs_inode *inode;
-    int byte_cursor = 0;
-    int bit_cursor = 0;
-    int ino_cursor = 0;
-    boolean is_find_free_entry = FALSE;
-    /* 检查位图是否有空位 */
-    for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(nfs_super.map_inode_blks);
-         byte_cursor++)
+    for (int i = 0; i < blks; i++)
     {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++)
+        if (!(bm->dirty & NFS_BM_DIRTY_BIT(i)))
         {
-            if ((nfs_super.map_inode[byte_cursor] & (0x1 << bit_cursor)) == 0)
-            {
-                /* 当前ino_cursor位置空闲 */
-                nfs_super.map_inode[byte_cursor] |= (0x1 << bit_cursor);
-                is_find_free_entry = TRUE;
-                break;
-            }
-            ino_cursor++;
+            continue;
         }
-        if (is_find_free_entry)
+        if (nfs_driver_write(offset + NFS_BLKS_SZ(i), bm->map + NFS_BLKS_SZ(i), NFS_BLOCK_SIZE) != NFS_ERROR_NONE ||
+            nfs_driver_flush(offset + NFS_BLKS_SZ(i), NFS_BLOCK_SIZE) != NFS_ERROR_NONE)
         {
-            break;
+            return -NFS_ERROR_IO;
         }
     }
+    return NFS_ERROR_NONE;
+}
+/**
+ * @brief 位图有修改时写回超级块(含空闲计数)与位图中修改过的块，之后位图回到干净状态
+ *
+ * @return int
+ */
+int nfs_sync_super()
+{
+    struct nfs_super_d nfs_super_d;
+    int ret = NFS_ERROR_NONE;
 
-    if (!is_find_free_entry || ino_cursor == nfs_super.max_ino)
-        return -NFS_ERROR_NOSPACE;
-
-    inode = (struct nfs_inode *)malloc(sizeof(struct nfs_inode));
-    inode->ino = ino_cursor;
-    inode->size = 0;
+    if (!nfs_super.inode_bm.dirty && !nfs_super.data_bm.dirty)
+    {   /* 位图未变时超级块与位图都不必重写 */
+        return NFS_ERROR_NONE;
+    }
+    nfs_ext_rsv_hide(TRUE);                       /* 预留窗口只在内存中，不落盘 */
+    nfs_super_d.magic_num = NFS_MAGIC_NUM;
+    nfs_super_d.map_inode_blks = nfs_super.map_inode_blks;
+    nfs_super_d.map_inode_offset = nfs_super.map_inode_offset;
+    nfs_super_d.sz_usage = nfs_super.sz_usage;
 
-    /* dentry指向inode */
-    dentry->inode = inode;
-    dentry->ino = inode->ino;
-    /* inode指回dentry */
-    inode->dentry = dentry;
+    nfs_super_d.inode_offset = nfs_super.inode_offset;
+    nfs_super_d.map_data_blks = nfs_super.map_data_blks;
+    nfs_super_d.map_data_offset = nfs_super.map_data_offset;
+    nfs_super_d.data_offset = nfs_super.data_offset;
 
-    inode->dir_cnt = 0;
-    inode->dentrys = NULL;
+    nfs_super_d.flags = NFS_SUPER_F_COUNTERS | NFS_SUPER_F_GEOMETRY |
+                        (nfs_super.inode_legacy ? 0 : NFS_SUPER_F_ISIZE);   /* 旧镜像的inode槽格式不变 */
+    nfs_super_d.free_inodes = nfs_super.inode_bm.nfree;
+    nfs_super_d.free_blks = nfs_super.data_bm.nfree;
+    nfs_super_d.max_ino = nfs_super.max_ino;
+    nfs_super_d.max_data = nfs_super.max_data;
+    nfs_super_d.inode_size = nfs_super.inode_size;
 
-    for (int i =0;i<NFS_DATA_PER_FILE;i++){
-        inode->block_pointer[i] = -1;
+    if (nfs_driver_write(NFS_SUPER_OFS, (uint8_t *)&nfs_super_d,
+                         sizeof(struct nfs_super_d)) != NFS_ERROR_NONE ||
+        nfs_driver_flush(NFS_SUPER_OFS, sizeof(struct nfs_super_d)) != NFS_ERROR_NONE ||
+        nfs_sync_bitmap(&nfs_super.inode_bm, nfs_super_d.map_inode_offset,
+                        nfs_super_d.map_inode_blks) != NFS_ERROR_NONE ||
+        nfs_sync_bitmap(&nfs_super.data_bm, nfs_super_d.map_data_offset,
+                        nfs_super_d.map_data_blks) != NFS_ERROR_NONE)
+    {
+        ret = -NFS_ERROR_IO;
     }
-    if (NFS_IS_REG(inode))
+    nfs_ext_rsv_hide(FALSE);
+    if (ret == NFS_ERROR_NONE)
     {
-        for (int i = 0; i < NFS_DATA_PER_FILE; i++)
-        {
-            inode->data[i] = (uint8_t *)malloc(NFS_BLOCK_SIZE);
-        }
+        nfs_super.inode_bm.dirty = 0;
+        nfs_super.data_bm.dirty = 0;
     }
-
-    return inode;
+    return ret;
 }
 /**
- * @brief 将内存inode及其下方结构全部刷回磁盘
+ * @brief 写回一个文件或目录：自身的脏inode、脏数据块/目录项，
+ * 以及它所依赖的元数据(各级脏父目录的目录项、位图中修改过的块与超级块)；
+ * 只写回这些块在缓存中的副本，不触及其他inode的脏块
  *
  * @param inode
  * @return int
  */
-int nfs_sync_inode(struct nfs_inode *inode)
+int nfs_fsync_inode(struct nfs_inode *inode)
 {
-    struct nfs_inode_d inode_d;
-    struct nfs_dentry *dentry_cursor;
-    struct nfs_dentry_d dentry_d;
-    int ino = inode->ino;
-    inode_d.ino = ino;
-    inode_d.size = inode->size;
-    memcpy(inode_d.target_path, inode->target_path, NFS_MAX_FILE_NAME);
-    inode_d.ftype = inode->dentry->ftype;
-    inode_d.dir_cnt = inode->dir_cnt;
-    int offset;
+    struct nfs_dentry *parent;
+    int ret = NFS_ERROR_NONE;
 
-    for (int i = 0; i < NFS_DATA_PER_FILE; i++)
-    {
-        inode_d.block_pointer[i] = inode->block_pointer[i];
+    nfs_ioq_plug();
+    while (inode)
+    {   /* 新建的文件要等到各级父目录的目录项落盘后才可见 */
+        if (inode->dirty && nfs_sync_inode(inode) != NFS_ERROR_NONE)
+        {
+            ret = -NFS_ERROR_IO;
+        }
+        parent = inode->dentry->parent;
+        inode = parent ? parent->inode : NULL;
     }
-
-    /* 先写inode本身 */
-    if (nfs_driver_write(NFS_INO_OFS(ino), (uint8_t *)&inode_d,
-                         sizeof(struct nfs_inode_d)) != NFS_ERROR_NONE)
+    if (nfs_itable_flush() != NFS_ERROR_NONE)
     {
-        NFS_DBG("[%s] io error\n", __func__);
-        return -NFS_ERROR_IO;
+        ret = -NFS_ERROR_IO;
     }
-
-// 判断 inode 是否为目录
-if (NFS_IS_DIR(inode)) {
-    struct nfs_dentry *dentry_cursor = inode->dentrys;  // 目录项游标
-    int dir_cnt = inode->dir_cnt;                      // 剩余目录项计数
-    int offset, block_end;
-
-    // 使用 for 循环遍历每个块
-    for (int block_index = 0; dir_cnt > 0 && block_index < NFS_DATA_PER_FILE; block_index++) {
-        // 当前块的起始偏移和结束偏移
-        offset = NFS_DATA_OFS(inode->block_pointer[block_index]);
-        block_end = NFS_DATA_OFS(inode->block_pointer[block_index] + 1);
-
-        // 遍历当前块中的目录项
-        while (dir_cnt > 0 && (offset + sizeof(struct nfs_dentry_d)) < block_end) {
-            if (dentry_cursor == NULL) {
-                NFS_DBG("[%s] dentry cursor is NULL\n", __func__);
-                return -NFS_ERROR_IO;
-            }
-
-            // 拷贝目录项数据到目标结构体
-            memcpy(dentry_d.fname, dentry_cursor->fname, MAX_NAME_LEN);
-            dentry_d.ftype = dentry_cursor->ftype;
-            dentry_d.ino = dentry_cursor->ino;
-
-            // 写入目录项数据到驱动
-            if (nfs_driver_write(offset, (uint8_t *)&dentry_d, sizeof(struct nfs_dentry_d)) != NFS_ERROR_NONE) {
-                return -NFS_ERROR_IO;
-            }
-
-            // 如果目录项有 inode，进行同步
-            if (dentry_cursor->inode != NULL) {
-                nfs_sync_inode(dentry_cursor->inode);
-            }
-
-            // 更新偏移量和剩余目录项计数
-            offset += sizeof(struct nfs_dentry_d);
-            dir_cnt--;
-            dentry_cursor = dentry_cursor->brother;  // 移动到下一个目录项
-        }
+    if (nfs_sync_super() != NFS_ERROR_NONE)
+    {
+        ret = -NFS_ERROR_IO;
     }
-}
-    else if (NFS_IS_REG(inode))
-    { /* 如果当前inode是文件，那么数据是文件内容，直接写即可 */
-        for (int i = 0; i < NFS_DATA_PER_FILE; i++)
-        {
-            if(inode->block_pointer[i] != -1){
-            if (nfs_driver_write(NFS_DATA_OFS(inode->block_pointer[i]), inode->data[i],
-                                 NFS_BLOCK_SIZE) != NFS_ERROR_NONE)
-            {
-                NFS_DBG("[%s] io error\n", __func__);
-                return -NFS_ERROR_IO;
-            }}
-        }
+    if (nfs_ioq_unplug() != NFS_ERROR_NONE)
+    {
+        ret = -NFS_ERROR_IO;
     }
-    return NFS_ERROR_NONE;
+    return ret;
 }
 /**
  * @brief 删除内存中的一个inode
@@ -379,11 +958,6 @@ int nfs_drop_inode(struct nfs_inode *inode)
     struct nfs_dentry *dentry_to_free;
     struct nfs_inode *inode_cursor;
 
-    int byte_cursor = 0;
-    int bit_cursor = 0;
-    int ino_cursor = 0;
-    boolean is_find = FALSE;
-
     if (inode == nfs_super.root_dentry->inode)
     {
         return NFS_ERROR_INVAL;
@@ -396,58 +970,58 @@ int nfs_drop_inode(struct nfs_inode *inode)
         while (dentry_cursor)
         {
             inode_cursor = dentry_cursor->inode;
-            nfs_drop_inode(inode_cursor);
-            nfs_drop_dentry(inode, dentry_cursor);
-            dentry_to_free = dentry_cursor;
-            dentry_cursor = dentry_cursor->brother;
-            free(dentry_to_free);
-        }
-
-        for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(nfs_super.map_inode_blks);
-             byte_cursor++) /* 调整inodemap */
-        {
-            for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++)
-            {
-                if (ino_cursor == inode->ino)
-                {
-                    nfs_super.map_inode[byte_cursor] &= (uint8_t)(~(0x1 << bit_cursor));
-                    is_find = TRUE;
-                    break;
-                }
-                ino_cursor++;
+            if (inode_cursor == NULL)
+            {   /* 尚未读入的子节点也要释放其位图 */
+                inode_cursor = nfs_read_inode(dentry_cursor, dentry_cursor->ino);
+                dentry_cursor->inode = inode_cursor;
             }
-            if (is_find == TRUE)
+            if (inode_cursor)
             {
-                break;
+                nfs_drop_inode(inode_cursor);
             }
+            nfs_drop_dentry(inode, dentry_cursor);
+            dentry_to_free = dentry_cursor;
+            dentry_cursor = dentry_cursor->brother;
+            free_dentry(dentry_to_free);
         }
+        nfs_dir_hash_free(inode);
+        nfs_bmap_truncate(inode, 0);                  /* 调整datamap */
+        nfs_bmap_release(inode);
+        nfs_bitmap_free(&nfs_super.inode_bm, inode->ino); /* 调整inodemap */
+        nfs_clear_inode_dirty(inode);
+        nfs_slab_free(NFS_SLAB_INODE, inode);
     }
     else if (NFS_IS_REG(inode) || NFS_IS_SYM_LINK(inode))
     {
-        for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(nfs_super.map_inode_blks);
-             byte_cursor++) /* 调整inodemap */
-        {
-            for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++)
-            {
-                if (ino_cursor == inode->ino)
-                {
-                    nfs_super.map_inode[byte_cursor] &= (uint8_t)(~(0x1 << bit_cursor));
-                    is_find = TRUE;
-                    break;
-                }
-                ino_cursor++;
-            }
-            if (is_find == TRUE)
-            {
-                break;
-            }
-        }
-        if (inode->data)
-            free(inode->data);
-        free(inode);
+        nfs_bmap_truncate(inode, 0);                  /* 释放数据块与间接块 */
+        nfs_bmap_release(inode);
+        nfs_bitmap_free(&nfs_super.inode_bm, inode->ino);
+        nfs_clear_inode_dirty(inode);
+        nfs_slab_free(NFS_SLAB_INODE, inode);
     }
     return NFS_ERROR_NONE;
 }
+/**
+ * @brief nfs_read_inode出错时释放已读入的目录项、数据缓冲区与inode本身
+ *
+ * @param inode 已完成nfs_bmap_init
+ * @return struct nfs_inode* 总是NULL
+ */
+static struct nfs_inode* nfs_read_inode_abort(struct nfs_inode* inode) {
+    struct nfs_dentry* dentry_cursor = inode->dentrys;
+    struct nfs_dentry* dentry_next;
+
+    while (dentry_cursor) {
+        dentry_next = dentry_cursor->brother;
+        free_dentry(dentry_cursor);
+        dentry_cursor = dentry_next;
+    }
+    inode->dentrys = NULL;
+    nfs_dir_hash_free(inode);
+    nfs_bmap_release(inode);
+    nfs_slab_free(NFS_SLAB_INODE, inode);
+    return NULL;
+}
 /**
  * @brief 
  * 
@@ -456,75 +1030,62 @@ int nfs_drop_inode(struct nfs_inode *inode)
  * @return struct nfs_inode* 
  */
 struct nfs_inode* nfs_read_inode(struct nfs_dentry* dentry, int ino) {
-    struct nfs_inode* inode = (struct nfs_inode*)malloc(sizeof(struct nfs_inode));
+    struct nfs_inode* inode;
     struct nfs_inode_d inode_d;
-    struct nfs_dentry* sub_dentry;
-    struct nfs_dentry_d dentry_d;
-    int dir_cnt = 0;
-    int index = 0;   // 追加变量用于块号
+    uint8_t* slot;
 
-    // 从磁盘中读取inode数据
-    if (nfs_driver_read(NFS_INO_OFS(ino), (uint8_t *)&inode_d, sizeof(struct nfs_inode_d)) != NFS_ERROR_NONE) {
+    // 从inode表块中取出inode数据
+    if ((slot = nfs_itable_get(ino, FALSE)) == NULL) {
         NFS_DBG("[%s] io error\n", __func__);
         return NULL;
     }
+    nfs_itable_load(slot, &inode_d);
+    if (inode_d.ino != (uint32_t)ino) {               /* 槽从未写入或已被其他inode重用，内容不可信 */
+        NFS_DBG("[%s] ino %d: slot holds ino %u\n", __func__, ino, inode_d.ino);
+        return NULL;
+    }
+    inode = (struct nfs_inode*)nfs_slab_alloc(NFS_SLAB_INODE);
+    if (inode == NULL) {
+        return NULL;
+    }
 
     // 更新内存中的inode数据
     inode->dir_cnt = 0;
-    inode->ino = inode_d.ino;
+    inode->ino = ino;
     inode->size = inode_d.size;
     inode->dentry = dentry;
     inode->dentrys = NULL;
+    inode->dhash = NULL;
+    inode->dhash_sz = 0;
+    inode->dhash_cnt = 0;
+    inode->dirty = 0;
+    inode->dirty_next = NULL;
+    inode->dirty_pprev = NULL;
     for (int i = 0; i < NFS_DATA_PER_FILE; i++) {
-        inode->block_pointer[i] = inode_d.block_pointer[i];
-    }
-
-   // 判断 inode 是否为目录
-if (NFS_IS_DIR(inode)) {
-    struct nfs_dentry *dentry_cursor = inode->dentrys;  // 目录项游标
-    int dir_cnt = inode_d.dir_cnt;                      // 剩余目录项计数
-    int offset;
-    
-    // 逐块读取目录项
-    for (int block_index = 0; dir_cnt > 0 && block_index < NFS_DATA_PER_FILE; block_index++) {
-        // 当前块的起始偏移
-        offset = NFS_DATA_OFS(inode->block_pointer[block_index]);
-
-        // 读取当前块中的所有目录项
-        while (dir_cnt > 0 && offset + sizeof(struct nfs_dentry_d) < NFS_DATA_OFS(inode->block_pointer[block_index] + 1)) {
-            // 读取目录项数据
-            if (nfs_driver_read(offset, (uint8_t *)&dentry_d, sizeof(struct nfs_dentry_d)) != NFS_ERROR_NONE) {
-                NFS_DBG("[%s] io error\n", __func__);
-                return NULL;
-            }
-
-            // 创建并分配新目录项
-            sub_dentry = new_dentry(dentry_d.fname, dentry_d.ftype);
-            sub_dentry->parent = inode->dentry;
-            sub_dentry->ino = dentry_d.ino;
-
-            // 将新目录项分配到 inode
-            nfs_alloc_dentry(inode, sub_dentry);
-
-            // 更新偏移量和剩余目录项计数
-            offset += sizeof(struct nfs_dentry_d);
-            dir_cnt--;
+        inode->block_pointer[i] = inode_d.flags & NFS_INODE_F_EXTENTS ? -1 : inode_d.block_pointer[i];
+    }
+    if (inode_d.flags & NFS_INODE_F_EXTENTS) {       /* 块指针的位置存放的是extent */
+        nfs_bmap_init(inode, -1, -1, inode_d.blocks);
+        if (nfs_ext_read(inode, &inode_d) != NFS_ERROR_NONE) {
+            return nfs_read_inode_abort(inode);
         }
     }
-}
-
-    // 判断inode是否为文件
-    else if (NFS_IS_REG(inode)) {
+    else if (inode_d.flags & NFS_INODE_F_BMAP) {
+        nfs_bmap_init(inode, inode_d.ind_blk, inode_d.dind_blk, inode_d.blocks);
+    }
+    else {                                            /* 旧镜像只有直接指针 */
+        int blocks = 0;
         for (int i = 0; i < NFS_DATA_PER_FILE; i++) {
-            inode->data[i] = (uint8_t *)malloc(NFS_BLOCK_SIZE);
-            if(inode->block_pointer[i] != -1){
-            if (nfs_driver_read(NFS_DATA_OFS(inode->block_pointer[i]), (uint8_t *)inode->data[i], NFS_BLOCK_SIZE) != NFS_ERROR_NONE) {
-                NFS_DBG("[%s] io error\n", __func__);
-                return NULL;
-            }
-            }
+            blocks += inode_d.block_pointer[i] != -1;
         }
+        nfs_bmap_init(inode, -1, -1, blocks);
+    }
+    inode->flags = inode_d.flags & ~NFS_INODE_F_BMAP;
+
+    if (NFS_IS_DIR(inode) && nfs_dir_read(inode, inode_d.dir_cnt) != NFS_ERROR_NONE) {
+        return nfs_read_inode_abort(inode);
     }
+    /* 文件数据不在这里读，由newfs_read/newfs_write按块装入，stat、ls只读inode */
 
     return inode;
 }
@@ -552,105 +1113,123 @@ struct nfs_dentry *nfs_get_dentry(struct nfs_inode *inode, int dir)
     return NULL;
 }
 /**
- * @brief 查找文件或目录
- * path: /qwe/ad  total_lvl = 2,
- *      1) find /'s inode       lvl = 1
- *      2) find qwe's dentry
- *      3) find qwe's inode     lvl = 2
- *      4) find ad's dentry
- *
- * path: /qwe     total_lvl = 1,
- *      1) find /'s inode       lvl = 1
- *      2) find qwe's dentry
- *
- *
- * 如果能查找到，返回该目录项
- * 如果查找不到，返回的是上一个有效的路径
+ * @brief 解析路径，原地遍历各分量，不拷贝、不分配内存
+ * 支持"//"、结尾的'/'、"."与".."，一次遍历同时给出最后一个分量的父目录项，
+ * 创建时可直接在nd->parent下用nd->name建立目录项
  *
  * path: /a/b/c
- *      1) find /'s inode     lvl = 1
- *      2) find a's dentry
- *      3) find a's inode     lvl = 2
- *      4) find b's dentry    如果此时找不到了，is_find=FALSE且返回的是a的inode对应的dentry
+ *      1) find a in /'s index, load a's inode
+ *      2) find b in a's index, 如果此时找不到了，err=-ENOENT，dentry为a，
+ *         且b不是最后一个分量，parent为NULL
+ *      3) find c in b's index, 找不到时parent为b，name为"c"
  *
- * @param path
- * @return struct nfs_dentry*
+ * @param path 绝对路径
+ * @param nd 解析结果
+ * @return int 找到返回0，否则返回负的错误号，同nd->err
  */
-struct nfs_dentry *nfs_lookup(const char *path, boolean *is_find, boolean *is_root)
+int nfs_resolve(const char *path, struct nfs_nameidata *nd)
 {
-    struct nfs_dentry *dentry_cursor = nfs_super.root_dentry;
-    struct nfs_dentry *dentry_ret = NULL;
-    struct nfs_inode *inode;
-    int total_lvl = nfs_calc_lvl(path);
-    int lvl = 0;
-    boolean is_hit;
-    char *fname = NULL;
-    char *path_cpy = (char *)malloc(sizeof(path));
-    *is_root = FALSE;
-    strcpy(path_cpy, path);
+    struct nfs_path_iter it;
+    struct nfs_dentry *cursor;
+    struct nfs_dentry *next;
 
-    if (total_lvl == 0)
-    { /* 根目录 */
-        *is_find = TRUE;
-        *is_root = TRUE;
-        dentry_ret = nfs_super.root_dentry;
+    if (nfs_dcache_lookup(path, nd)) /* 先查路径缓存 */
+    {
+        return nd->err;
     }
-    fname = strtok(path_cpy, "/");
-    while (fname)
+    nd->err = NFS_ERROR_NONE;
+    nd->is_find = FALSE;
+    nd->is_root = FALSE;
+    nd->dentry = nfs_super.root_dentry;
+    nd->parent = NULL;
+
+    nfs_path_iter_init(&it, path);
+    while (nfs_path_next(&it))
     {
-        lvl++;
-        if (dentry_cursor->inode == NULL)
-        { /* Cache机制 */
-            nfs_read_inode(dentry_cursor, dentry_cursor->ino);
-        }
-
-        inode = dentry_cursor->inode;
-
-        if (NFS_IS_REG(inode) && lvl < total_lvl)
+        cursor = nd->dentry;
+        if (cursor->inode == NULL)
         {
-            NFS_DBG("[%s] not a dir\n", __func__);
-            dentry_ret = inode->dentry;
+            cursor->inode = nfs_read_inode(cursor, cursor->ino);
+            if (cursor->inode == NULL)
+            {
+                nd->err = -NFS_ERROR_IO;
+                return nd->err;
+            }
+        }
+        if (!NFS_IS_DIR(cursor->inode))
+        {   /* 还有分量未解析，但当前已不是目录 */
+            nd->err = -NFS_ERROR_NOTDIR;
             break;
         }
-        if (NFS_IS_DIR(inode))
+        if (it.len == 1 && it.name[0] == '.')
         {
-            dentry_cursor = inode->dentrys;
-            is_hit = FALSE;
-
-            while (dentry_cursor) /* 遍历子目录项 */
+            continue;
+        }
+        if (it.len == 2 && it.name[0] == '.' && it.name[1] == '.')
+        {   /* 根目录的".."仍是根目录 */
+            if (cursor->parent)
             {
-                if (memcmp(dentry_cursor->fname, fname, strlen(fname)) == 0)
-                {
-                    is_hit = TRUE;
-                    break;
-                }
-                dentry_cursor = dentry_cursor->brother;
+                nd->dentry = cursor->parent;
             }
+            continue;
+        }
+        if (it.len >= NFS_MAX_FILE_NAME)
+        {
+            nd->err = -NFS_ERROR_NAMETOOLONG;
+            break;
+        }
 
-            if (!is_hit)
-            {
-                *is_find = FALSE;
-                NFS_DBG("[%s] not found %s\n", __func__, fname);
-                dentry_ret = inode->dentry;
-                break;
-            }
+        next = nfs_dir_find(cursor->inode, it.name, it.len); /* 查目录索引 */
+        if (next == NULL)
+        {
+            NFS_DBG("[%s] not found %.*s\n", __func__, it.len, it.name);
+            nd->err = -NFS_ERROR_NOTFOUND;
+            nd->parent = nfs_path_is_last(&it) ? cursor : NULL;
+            break;
+        }
+        nd->dentry = next;
+    }
+    nd->name = it.name;
+    nd->len = it.len;
 
-            if (is_hit && lvl == total_lvl)
+    if (nd->err == NFS_ERROR_NONE)
+    {
+        if (nd->dentry->inode == NULL)
+        {
+            nd->dentry->inode = nfs_read_inode(nd->dentry, nd->dentry->ino);
+            if (nd->dentry->inode == NULL)
             {
-                *is_find = TRUE;
-                dentry_ret = dentry_cursor;
-                break;
+                nd->err = -NFS_ERROR_IO;
+                return nd->err;
             }
         }
-        fname = strtok(NULL, "/");
+        nd->is_find = TRUE;
+        nd->is_root = nd->dentry == nfs_super.root_dentry;
+        nd->parent = nd->dentry->parent;
     }
-
-    if (dentry_ret->inode == NULL)
-    {
-        dentry_ret->inode = nfs_read_inode(dentry_ret, dentry_ret->ino);
+    if (it.canon)
+    {   /* 非规范路径无法按前缀精确失效，不缓存 */
+        nfs_dcache_insert(path, nd);
     }
+    return nd->err;
+}
+/**
+ * @brief 查找文件或目录
+ *
+ * 如果能查找到，返回该目录项
+ * 如果查找不到，返回的是最后一个存在的目录项
+ *
+ * @param path
+ * @return struct nfs_dentry*
+ */
+struct nfs_dentry *nfs_lookup(const char *path, boolean *is_find, boolean *is_root)
+{
+    struct nfs_nameidata nd;
 
-    return dentry_ret;
+    nfs_resolve(path, &nd);
+    *is_find = nd.is_find;
+    *is_root = nd.is_root;
+    return nd.dentry;
 }
 /**
  * @brief 挂载nfs, Layout 如下
@@ -676,14 +1255,18 @@ int nfs_mount(struct custom_options options)
     int map_inode_blks;
     int inode_blks;
     int map_data_blks;
+    int data_num;
 
     int super_blks;
     boolean is_init = FALSE;
 
     nfs_super.is_mounted = FALSE;
+    nfs_super.dirty_list = NULL;
 
     // driver_fd = open(options.device, O_RDWR);
-    driver_fd = ddriver_open(options.device);
+    driver_fd = ddriver_open_ex((char *)options.device,
+                                (options.use_mmap ? DDRIVER_OPEN_MMAP : 0) |
+                                (options.no_lat ? DDRIVER_OPEN_NOLAT : 0));
 
     if (driver_fd < 0)
     {
@@ -691,9 +1274,19 @@ int nfs_mount(struct custom_options options)
     }
 
     nfs_super.driver_fd = driver_fd;
+    nfs_super.show_stats = options.show_stats;
     ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_SIZE, &nfs_super.sz_disk);
     ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_IO_SZ, &nfs_super.sz_io);
 
+    nfs_slab_init();
+    nfs_itable_init();
+    if (nfs_cache_init(options.cache_blks) != NFS_ERROR_NONE ||
+        nfs_ioq_init(NFS_IOQ_DEPTH) != NFS_ERROR_NONE ||
+        nfs_dcache_init(NFS_DCACHE_ENTRIES) != NFS_ERROR_NONE)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+
     root_dentry = new_dentry("/", NFS_DIR); /* 根目录项每次挂载时新建 */
 
     if (nfs_driver_read(NFS_SUPER_OFS, (uint8_t *)(&nfs_super_d),
@@ -704,26 +1297,58 @@ int nfs_mount(struct custom_options options)
     /* 读取super */
     if (nfs_super_d.magic_num != NFS_MAGIC_NUM)
     {   /* 幻数不正确，初始化 */
-        /* 估算各部分大小 */
+        /* 估算各部分大小：inode数按设备容量与NFS_BYTES_PER_INODE确定，
+           其余块扣除数据位图后全部作为数据块 */
         super_blks = NFS_SUPER_BLKS;
-        map_inode_blks = NFS_MAP_INODE_BLKS;
-        map_data_blks = NFS_MAP_DATA_BLKS;
+        inode_num = NFS_DISK_SZ() / NFS_BYTES_PER_INODE;
+        inode_blks = NFS_ROUND_UP(inode_num, NFS_BLOCK_SIZE / NFS_INODE_SIZE) / (NFS_BLOCK_SIZE / NFS_INODE_SIZE);
+        inode_num = inode_blks * (NFS_BLOCK_SIZE / NFS_INODE_SIZE);   /* 最后一个inode表块也用满 */
+        map_inode_blks = NFS_ROUND_UP(inode_num, NFS_BITS_PER_BLK) / NFS_BITS_PER_BLK;
+        data_num = NFS_BLK_OF(NFS_DISK_SZ()) - super_blks - map_inode_blks - inode_blks;
+        map_data_blks = NFS_ROUND_UP(data_num, NFS_BITS_PER_BLK + 1) / (NFS_BITS_PER_BLK + 1);
+        data_num -= map_data_blks;
+        if (inode_num <= NFS_ROOT_INO || data_num <= 0)
+        {
+            NFS_DBG("[%s] device too small: %d bytes\n", __func__, NFS_DISK_SZ());
+            return -NFS_ERROR_NOSPACE;
+        }
         /* 布局layout */
-        nfs_super.max_ino = MAX_INO;
-        nfs_super.max_data = MAX_DATA;
         nfs_super_d.map_inode_blks = map_inode_blks;
         nfs_super_d.map_data_blks = map_data_blks;
+        nfs_super_d.max_ino = inode_num;
+        nfs_super_d.max_data = data_num;
+        nfs_super_d.inode_size = NFS_INODE_SIZE;
 
         nfs_super_d.map_inode_offset = NFS_SUPER_OFS + NFS_BLKS_SZ(super_blks);
         nfs_super_d.map_data_offset = nfs_super_d.map_inode_offset + NFS_BLKS_SZ(map_inode_blks);
         nfs_super_d.inode_offset = nfs_super_d.map_data_offset + NFS_BLKS_SZ(map_data_blks);
-        nfs_super_d.data_offset = nfs_super_d.inode_offset + NFS_BLKS_SZ(MAX_INO);
+        nfs_super_d.data_offset = nfs_super_d.inode_offset + NFS_BLKS_SZ(inode_blks);
 
         nfs_super_d.sz_usage = 0;
+        nfs_super_d.flags = NFS_SUPER_F_GEOMETRY | NFS_SUPER_F_ISIZE;   /* 位图为空，计数在下面重新统计 */
         is_init = TRUE;
         nfs_super_d.magic_num = NFS_MAGIC_NUM;
     }
     nfs_super.sz_usage = nfs_super_d.sz_usage; /* 建立 in-memory 结构 */
+    if (nfs_super_d.flags & NFS_SUPER_F_GEOMETRY)
+    {   /* 几何信息以超级块为准 */
+        nfs_super.max_ino = nfs_super_d.max_ino;
+        nfs_super.max_data = nfs_super_d.max_data;
+    }
+    else
+    {   /* 旧镜像沿用固定布局 */
+        nfs_super.max_ino = MAX_INO;
+        nfs_super.max_data = MAX_DATA;
+    }
+    nfs_super.inode_size = (nfs_super_d.flags & NFS_SUPER_F_ISIZE) ? (int)nfs_super_d.inode_size
+                                                                    : NFS_BLOCK_SIZE;   /* 旧镜像每个inode占一块 */
+    nfs_super.inode_legacy = !(nfs_super_d.flags & NFS_SUPER_F_ISIZE);
+    if (nfs_super.inode_size < NFS_INODE_D_SIZE() || nfs_super.inode_size > NFS_BLOCK_SIZE ||
+        NFS_BLOCK_SIZE % nfs_super.inode_size != 0)
+    {
+        NFS_DBG("[%s] bad inode size %d\n", __func__, nfs_super.inode_size);
+        return -NFS_ERROR_INVAL;
+    }
 
     nfs_super.map_inode = (uint8_t *)malloc(NFS_BLKS_SZ(nfs_super_d.map_inode_blks));
     nfs_super.map_inode_blks = nfs_super_d.map_inode_blks;
@@ -734,6 +1359,7 @@ int nfs_mount(struct custom_options options)
     nfs_super.map_data_offset = nfs_super_d.map_data_offset;
     nfs_super.inode_offset = nfs_super_d.inode_offset;
     nfs_super.data_offset = nfs_super_d.data_offset;
+    nfs_register_regions();
     // nfs_dump_map();
 
     printf("\n--------------------------------------------------------------------------------\n\n");
@@ -748,10 +1374,22 @@ int nfs_mount(struct custom_options options)
     {
         return -NFS_ERROR_IO;
     }
+    if (nfs_super_d.flags & NFS_SUPER_F_COUNTERS)
+    {   /* 直接使用持久化的空闲计数，无需扫描位图 */
+        nfs_bitmap_init(&nfs_super.inode_bm, nfs_super.map_inode, nfs_super.max_ino, nfs_super_d.free_inodes);
+        nfs_bitmap_init(&nfs_super.data_bm, nfs_super.map_data, nfs_super.max_data, nfs_super_d.free_blks);
+    }
+    else
+    {
+        nfs_bitmap_init(&nfs_super.inode_bm, nfs_super.map_inode, nfs_super.max_ino, -1);
+        nfs_bitmap_init(&nfs_super.data_bm, nfs_super.map_data, nfs_super.max_data, -1);
+    }
     if (is_init)
     { /* 分配根节点 */
         root_inode = nfs_alloc_inode(root_dentry);
         nfs_sync_inode(root_inode);
+        nfs_itable_flush();
+        nfs_slab_free(NFS_SLAB_INODE, root_inode);   /* 下面重新读入 */
     }
 
     root_inode = nfs_read_inode(root_dentry, NFS_ROOT_INO); /* 读取根目录 */
@@ -769,47 +1407,47 @@ int nfs_mount(struct custom_options options)
  */
 int nfs_umount()
 {
-    struct nfs_super_d nfs_super_d;
 
     if (!nfs_super.is_mounted)
     {
         return NFS_ERROR_NONE;
     }
 
-    nfs_sync_inode(nfs_super.root_dentry->inode); /* 从根节点向下刷写节点 */
-
-
-    nfs_super_d.magic_num = NFS_MAGIC_NUM;
-    nfs_super_d.map_inode_blks = nfs_super.map_inode_blks;
-    nfs_super_d.map_inode_offset = nfs_super.map_inode_offset;
-    nfs_super_d.sz_usage = nfs_super.sz_usage;
-
-    nfs_super_d.inode_offset = nfs_super.inode_offset;
-    nfs_super_d.map_data_blks = nfs_super.map_data_blks;
-    nfs_super_d.map_data_offset = nfs_super.map_data_offset;
-    nfs_super_d.data_offset = nfs_super.data_offset;
-
-
-
-    if (nfs_driver_write(NFS_SUPER_OFS, (uint8_t *)&nfs_super_d,
-                         sizeof(struct nfs_super_d)) != NFS_ERROR_NONE)
+    nfs_ra_drain(NULL);                           /* 关闭设备前收割所有异步预读 */
+    nfs_ext_rsv_drop(NULL);
+    nfs_ioq_plug();                               /* 写回的脏块先入队，最后按块号顺序下发 */
+    if (nfs_sync_dirty() != NFS_ERROR_NONE)       /* 只写回修改过的inode */
     {
         return -NFS_ERROR_IO;
     }
 
-    // nfs_print_map();
-    // printf("%d",nfs_super.map_data_offset);
-
-    if (nfs_driver_write(nfs_super_d.map_inode_offset, (uint8_t *)(nfs_super.map_inode),
-                         NFS_BLKS_SZ(nfs_super_d.map_inode_blks)) != NFS_ERROR_NONE)
+    if (nfs_sync_super() != NFS_ERROR_NONE)
     {
         return -NFS_ERROR_IO;
     }
-    if (nfs_driver_write(nfs_super_d.map_data_offset, (uint8_t *)(nfs_super.map_data),
-                         NFS_BLKS_SZ(nfs_super_d.map_data_blks)) != NFS_ERROR_NONE)
+
+    if (nfs_cache_sync() != NFS_ERROR_NONE || nfs_ioq_unplug() != NFS_ERROR_NONE)
     {
         return -NFS_ERROR_IO;
     }
+    if (nfs_super.show_stats)
+    {   /* 只在--stats时打印各模块的统计 */
+        nfs_cache_dump();
+        nfs_ra_dump();
+        nfs_bmap_dump();
+        nfs_ext_dump();
+        nfs_itable_dump();
+        nfs_ioq_dump();
+        nfs_dcache_dump();
+        nfs_slab_dump();
+        nfs_dump_dev_stats();
+    }
+    nfs_cache_destroy();
+    nfs_ioq_destroy();
+    nfs_dcache_destroy();
+    nfs_bmap_release_all(nfs_super.root_dentry);  /* 间接块、各文件的缓冲区数组与目录索引不在slab中 */
+    nfs_slab_destroy();                           /* 整体释放所有dentry、inode与数据块缓冲区 */
+    nfs_super.root_dentry = NULL;
 
     free(nfs_super.map_inode);
     free(nfs_super.map_data);
@@ -818,6 +1456,51 @@ int nfs_umount()
     return NFS_ERROR_NONE;
 }
 
+/**
+ * @brief 向驱动登记磁盘布局，驱动据此按区域统计IO
+ *
+ */
+void nfs_register_regions()
+{
+    struct ddriver_regions regions;
+
+    regions.nr = NFS_REGION_NR;
+    regions.start[NFS_REGION_SUPER] = NFS_SUPER_OFS;
+    regions.start[NFS_REGION_MAP] = nfs_super.map_inode_offset;
+    regions.start[NFS_REGION_INODE] = nfs_super.inode_offset;
+    regions.start[NFS_REGION_DATA] = nfs_super.data_offset;
+    ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_REGIONS, &regions);
+}
+
+/**
+ * @brief 打印驱动统计: 总量与各区域的IO分布
+ *
+ */
+void nfs_dump_dev_stats()
+{
+    static const char *names[NFS_REGION_NR] = {"super", "bitmaps", "inodes", "data"};
+    struct ddriver_stats stats;
+    int i;
+
+    stats.version = DDRIVER_STATS_VERSION;
+    stats.size = sizeof(struct ddriver_stats);
+    if (ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_STATS, &stats) < 0)
+    {
+        return;
+    }
+    NFS_DBG("[%s] read %lu (%lu B), write %lu (%lu B), seek %lu, lat r/w/s %lu/%lu/%lu us\n", __func__,
+            (unsigned long)stats.read_cnt, (unsigned long)stats.read_bytes,
+            (unsigned long)stats.write_cnt, (unsigned long)stats.write_bytes,
+            (unsigned long)stats.seek_cnt, (unsigned long)stats.read_lat_us,
+            (unsigned long)stats.write_lat_us, (unsigned long)stats.seek_lat_us);
+    for (i = 0; i < NFS_REGION_NR; i++)
+    {
+        NFS_DBG("[%s]   %-8s read %lu (%lu B), write %lu (%lu B)\n", __func__, names[i],
+                (unsigned long)stats.region_read_cnt[i], (unsigned long)stats.region_read_bytes[i],
+                (unsigned long)stats.region_write_cnt[i], (unsigned long)stats.region_write_bytes[i]);
+    }
+}
+
 void nfs_dump_map()
 {
     int byte_cursor = 0;
@@ -3,8 +3,8 @@ POINTS=0
 TOTAL_POINTS=0
 TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh)
 # mount.sh mkdir.sh touch.sh ls.sh remount.sh (read.sh write.sh cp.sh)
-ALL_TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh)
-ALL_TEST_SCORES=(1 4 5 4 16 2 2)
+ALL_TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh dir.sh fsync.sh bigfile.sh legacy.sh)
+ALL_TEST_SCORES=(1 4 5 4 16 2 2 3 2 2 4)
 MNTPOINT='./mnt'
 PROJECT_NAME="newfs"
 
@@ -35,6 +35,10 @@ elif [[ "${LEVEL}" == "6" ]]; then
     echo "开始mount, mkdir, touch, ls, read&write, cp, umount测试"
     TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh)
     sleep 1
+elif [[ "${LEVEL}" == "7" ]]; then
+    echo "开始mount, mkdir, touch, ls, read&write, cp, umount, 大目录, fsync, 大文件, 旧镜像测试"
+    TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh dir.sh fsync.sh bigfile.sh legacy.sh)
+    sleep 1
 else
     echo "未知测试参数"
     exit 1
@@ -0,0 +1,65 @@
+#!/bin/bash
+
+TEST_CASE="case 10 - big file"
+
+# 新文件按extent映射并连续分配，200KB的文件应由少数几个extent覆盖，
+# 覆盖写中间一段和remount后的读都要经extent查找到正确的块
+BIG_SIZE=204800
+GOLDEN_FILE=$(mktemp)
+
+function check_big_write () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    head -c "$BIG_SIZE" /dev/urandom > "$GOLDEN_FILE"
+    if ! cp "$GOLDEN_FILE" "${MNTPOINT}"/bigfile; then
+        fail "$_TEST_CASE: 写入${BIG_SIZE}字节到文件${MNTPOINT}/bigfile失败"
+        return 1
+    fi
+    # 覆盖写中间的一段，跨越块边界
+    head -c 3000 /dev/urandom > "$GOLDEN_FILE".part
+    dd if="$GOLDEN_FILE".part of="$GOLDEN_FILE" bs=1 seek=70000 conv=notrunc status=none
+    if ! dd if="$GOLDEN_FILE".part of="${MNTPOINT}"/bigfile bs=1 seek=70000 conv=notrunc status=none; then
+        fail "$_TEST_CASE: 覆盖写文件${MNTPOINT}/bigfile失败"
+        return 1
+    fi
+    rm -f "$GOLDEN_FILE".part
+
+    if ! cmp -s "$GOLDEN_FILE" "${MNTPOINT}"/bigfile; then
+        fail "$_TEST_CASE: 读文件${MNTPOINT}/bigfile成功, 但内容不同"
+        return 1
+    fi
+    return 0
+}
+
+function check_big_remount () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    sleep 1
+    umount "${MNTPOINT}"
+    sleep 1
+    try_mount_or_fail
+
+    if [[ "$(stat -c %s "${MNTPOINT}"/bigfile)" != "$BIG_SIZE" ]]; then
+        fail "$_TEST_CASE: remount后${MNTPOINT}/bigfile的大小不是${BIG_SIZE}"
+        return 1
+    fi
+    if ! cmp -s "$GOLDEN_FILE" "${MNTPOINT}"/bigfile; then
+        fail "$_TEST_CASE: remount后${MNTPOINT}/bigfile内容不同"
+        return 1
+    fi
+    return 0
+}
+
+
+try_mount_or_fail
+
+TEST_CASE="case 10.1 - write ${BIG_SIZE} bytes to ${MNTPOINT}/bigfile"
+core_tester echo "$TEST_CASE" check_big_write "$TEST_CASE"
+
+TEST_CASE="case 10.2 - read ${MNTPOINT}/bigfile after remount"
+core_tester echo "$TEST_CASE" check_big_remount "$TEST_CASE"
+
+rm -f "$GOLDEN_FILE"
+clean_mount
@@ -0,0 +1,68 @@
+#!/bin/bash
+
+TEST_CASE="case 8 - big directory"
+
+# 目录项变长存放，DIR_FILES个长名字的文件需要多个目录块
+DIR_FILES=100
+DIR_PREFIX="variable_length_directory_entry_"
+
+function dir_names () {
+    _STEP=$1
+    for ((i = 0; i < DIR_FILES; i += _STEP)); do
+        printf "%s%03d\n" "$DIR_PREFIX" "$i"
+    done
+}
+
+function check_dir_list () {
+    _STEP=$1
+    _TEST_CASE=$2
+
+    if ! diff -q <(dir_names "$_STEP") <(ls "${MNTPOINT}"/bigdir | sort) > /dev/null; then
+        fail "$_TEST_CASE: ls ${MNTPOINT}/bigdir的结果与创建的$((DIR_FILES / _STEP))个文件不一致"
+        return 1
+    fi
+    return 0
+}
+
+function check_dir_create () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    mkdir_and_check "${MNTPOINT}"/bigdir
+    for name in $(dir_names 1); do
+        touch_and_check "${MNTPOINT}"/bigdir/"$name"
+    done
+    check_dir_list 1 "$_TEST_CASE"
+}
+
+function check_dir_remount () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    sleep 1
+    umount "${MNTPOINT}"
+    sleep 1
+    try_mount_or_fail
+    check_dir_list "$_PARAM" "$_TEST_CASE"
+}
+
+function remove_odd_files () {
+    for ((i = 1; i < DIR_FILES; i += 2)); do
+        rm "${MNTPOINT}"/bigdir/"$(printf "%s%03d" "$DIR_PREFIX" "$i")"
+    done
+}
+
+
+try_mount_or_fail
+
+TEST_CASE="case 8.1 - create ${DIR_FILES} files in ${MNTPOINT}/bigdir"
+core_tester echo "$TEST_CASE" check_dir_create "$TEST_CASE"
+
+TEST_CASE="case 8.2 - ls ${MNTPOINT}/bigdir after remount"
+core_tester echo 1 check_dir_remount "$TEST_CASE"
+
+TEST_CASE="case 8.3 - remove half of ${MNTPOINT}/bigdir and remount"
+remove_odd_files
+core_tester echo 2 check_dir_remount "$TEST_CASE"
+
+clean_mount
@@ -0,0 +1,61 @@
+#!/bin/bash
+
+TEST_CASE="case 9 - fsync"
+
+GOLDEN="fsync must persist data before the file system exits"
+
+function kill_fs () {
+    fs_pid=$(pgrep -u $USER $PROJECT_NAME)
+    for PID in $fs_pid; do
+        kill -9 $PID
+    done
+    sleep 1
+    umount "${MNTPOINT}" 2>/dev/null || umount -l "${MNTPOINT}"
+}
+
+function check_fsync () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    touch_and_check "${MNTPOINT}"/fsync0
+    if ! python3 -c 'import os, sys
+fd = os.open(sys.argv[1], os.O_WRONLY)
+os.write(fd, sys.argv[2].encode())
+os.fsync(fd)
+os.close(fd)' "${MNTPOINT}"/fsync0 "$_PARAM"; then
+        fail "$_TEST_CASE: 写入并fsync文件${MNTPOINT}/fsync0失败"
+        return 1
+    fi
+    return 0
+}
+
+function check_fsync_after_crash () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    # 不经umount直接杀死文件系统，fsync过的内容应已落盘
+    kill_fs
+    if check_mount; then
+        fail "$_TEST_CASE: $PROJECT_NAME文件系统仍然在挂载点${MNTPOINT}"
+        return 1
+    fi
+    try_mount_or_fail
+
+    OUTPUT=$(cat "${MNTPOINT}"/fsync0)
+    if [[ "${OUTPUT}" != "$_PARAM" ]]; then
+        fail "$_TEST_CASE: 崩溃后重新挂载, ${MNTPOINT}/fsync0的内容为${OUTPUT}, 正确的内容为: $_PARAM"
+        return 1
+    fi
+    return 0
+}
+
+
+try_mount_or_fail
+
+TEST_CASE="case 9.1 - write and fsync ${MNTPOINT}/fsync0"
+core_tester echo "$GOLDEN" check_fsync "$TEST_CASE"
+
+TEST_CASE="case 9.2 - read ${MNTPOINT}/fsync0 after crash"
+core_tester echo "$GOLDEN" check_fsync_after_crash "$TEST_CASE"
+
+clean_mount
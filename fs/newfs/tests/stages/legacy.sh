@@ -0,0 +1,159 @@
+#!/bin/bash
+
+TEST_CASE="case 11 - legacy image"
+
+# 按旧格式(无NFS_SUPER_F_GEOMETRY，每个inode占一块，定长目录项，只有直接指针)构造镜像:
+#   /olddir/inner  小文件
+#   /oldfile       跨3个数据块的文件，11.4中追加到11块
+GOLDEN_INNER="inner file of legacy image"
+
+function make_legacy_image () {
+    python3 - "$HOME"/ddriver "$GOLDEN_INNER" <<'EOF'
+import struct, sys
+
+BLK = 1024
+MAX_INO, MAX_DATA = 585, 3508
+MAP_INODE_OFS, MAP_DATA_OFS, INODE_OFS = 1 * BLK, 2 * BLK, 3 * BLK
+DATA_OFS = INODE_OFS + MAX_INO * BLK
+REG, DIR = 0, 1
+
+img = bytearray(DATA_OFS + MAX_DATA * BLK)
+
+def inode(ino, ftype, size, dir_cnt, blks):
+    ptrs = blks + [-1] * (6 - len(blks))
+    struct.pack_into('<II128sIi6i', img, INODE_OFS + ino * BLK, ino, size, b'', dir_cnt, ftype, *ptrs)
+    img[MAP_INODE_OFS + ino // 8] |= 1 << (ino % 8)
+    for b in blks:
+        img[MAP_DATA_OFS + b // 8] |= 1 << (b % 8)
+
+def dir_block(blk, dentrys):
+    for i, (name, ftype, ino) in enumerate(dentrys):
+        struct.pack_into('<128siI', img, DATA_OFS + blk * BLK + i * 136, name.encode(), ftype, ino)
+
+def file_data(blks, data):
+    for i, b in enumerate(blks):
+        chunk = data[i * BLK:(i + 1) * BLK]
+        img[DATA_OFS + b * BLK:DATA_OFS + b * BLK + len(chunk)] = chunk
+
+big = bytes((i * 7 + 3) % 251 for i in range(2500))
+inner = sys.argv[2].encode()
+
+inode(0, DIR, 0, 2, [0])
+dir_block(0, [('olddir', DIR, 1), ('oldfile', REG, 2)])
+inode(1, DIR, 0, 1, [1])
+dir_block(1, [('inner', REG, 3)])
+inode(2, REG, len(big), 0, [2, 3, 4])
+file_data([2, 3, 4], big)
+inode(3, REG, len(inner), 0, [5])
+file_data([5], inner)
+
+struct.pack_into('<IIIIIiii', img, 0, 0x52415453, 0, 1, MAP_INODE_OFS, DATA_OFS, 1, MAP_DATA_OFS, INODE_OFS)
+with open(sys.argv[1], 'wb') as f:
+    f.write(img)
+EOF
+}
+
+function golden_oldfile () {
+    python3 -c 'import sys; sys.stdout.buffer.write(bytes((i * 7 + 3) % 251 for i in range(2500)))'
+}
+
+function check_legacy_ls () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    OUTPUT=($(ls "$_PARAM"))
+
+    if [[ "${OUTPUT[*]}" != "olddir oldfile" ]]; then
+        fail "$_TEST_CASE: 旧格式镜像中ls ${_PARAM}的结果为${OUTPUT[*]}, 应该为olddir oldfile"
+        return 1
+    fi
+    if [[ "$(ls "$_PARAM"/olddir)" != "inner" ]]; then
+        fail "$_TEST_CASE: 旧格式镜像中没有找到${_PARAM}/olddir/inner"
+        return 1
+    fi
+    return 0
+}
+
+function check_legacy_read () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    if [[ "$(cat "${MNTPOINT}"/olddir/inner)" != "${GOLDEN_INNER}" ]]; then
+        fail "$_TEST_CASE: 读旧格式文件${MNTPOINT}/olddir/inner内容不同, 正确的内容为: $GOLDEN_INNER"
+        return 1
+    fi
+    if ! cmp -s <(golden_oldfile) "${MNTPOINT}"/oldfile; then
+        fail "$_TEST_CASE: 读旧格式文件${MNTPOINT}/oldfile内容不同"
+        return 1
+    fi
+    return 0
+}
+
+function check_legacy_rewrite () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    # 修改后写回为新格式，remount后旧内容和新内容都应保留
+    touch_and_check "${MNTPOINT}"/olddir/newfile
+    if ! echo "$_PARAM" | tee "${MNTPOINT}"/olddir/newfile > /dev/null; then
+        fail "$_TEST_CASE: 写入文件${MNTPOINT}/olddir/newfile失败"
+        return 1
+    fi
+    sleep 1
+    umount "${MNTPOINT}"
+    sleep 1
+    try_mount_or_fail
+
+    if [[ "$(cat "${MNTPOINT}"/olddir/newfile)" != "$_PARAM" ]]; then
+        fail "$_TEST_CASE: remount后${MNTPOINT}/olddir/newfile内容不同, 正确的内容为: $_PARAM"
+        return 1
+    fi
+    if ! check_legacy_read "$_PARAM" "$_TEST_CASE"; then
+        return 1
+    fi
+    return 0
+}
+function golden_append () {
+    python3 -c 'import sys; sys.stdout.buffer.write(bytes((i * 13 + 5) % 251 for i in range(8000)))'
+}
+
+function check_legacy_append () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    # oldfile只有直接指针，追加到超过6块后须经间接块寻址
+    if ! golden_append >> "${MNTPOINT}"/oldfile; then
+        fail "$_TEST_CASE: 追加写旧格式文件${MNTPOINT}/oldfile失败"
+        return 1
+    fi
+    sleep 1
+    umount "${MNTPOINT}"
+    sleep 1
+    try_mount_or_fail
+
+    if ! cmp -s <(golden_oldfile; golden_append) "${MNTPOINT}"/oldfile; then
+        fail "$_TEST_CASE: remount后${MNTPOINT}/oldfile内容不同"
+        return 1
+    fi
+    return 0
+}
+
+
+clean_mount
+make_legacy_image
+
+try_mount_or_fail
+
+TEST_CASE="case 11.1 - ls legacy image"
+core_tester ls "${MNTPOINT}" check_legacy_ls "$TEST_CASE"
+
+TEST_CASE="case 11.2 - read legacy files"
+core_tester echo "$TEST_CASE" check_legacy_read "$TEST_CASE"
+
+TEST_CASE="case 11.3 - write legacy image and remount"
+core_tester echo "written after upgrade" check_legacy_rewrite "$TEST_CASE"
+
+TEST_CASE="case 11.4 - append past the direct blocks of a legacy file"
+core_tester echo "$TEST_CASE" check_legacy_append "$TEST_CASE"
+
+clean_mount
+clean_ddriver
@@ -13,6 +13,7 @@
 #include "errno.h"
 #include "types.h"
 #include "stdint.h"
+#include <pthread.h>
 
 
 /******************************************************************************
@@ -37,8 +37,32 @@ int sfs_calc_lvl(const char * path) {
     }
     return lvl;
 }
+static pthread_key_t  sfs_scratch_key;
+static pthread_once_t sfs_scratch_once = PTHREAD_ONCE_INIT;
+
+static void sfs_scratch_key_init() {
+    pthread_key_create(&sfs_scratch_key, free);
+}
 /**
- * @brief 驱动读
+ * @brief 获取本线程的暂存缓冲区，两个IO单元大小并按IO单元对齐，用于首尾不对齐的IO单元
+ * 
+ * @return uint8_t* 
+ */
+static uint8_t* sfs_scratch_buf() {
+    uint8_t* scratch;
+
+    pthread_once(&sfs_scratch_once, sfs_scratch_key_init);
+    scratch = (uint8_t*)pthread_getspecific(sfs_scratch_key);
+    if (scratch == NULL) {
+        if (posix_memalign((void **)&scratch, SFS_IO_SZ(), 2 * SFS_IO_SZ()) != 0) {
+            return NULL;
+        }
+        pthread_setspecific(sfs_scratch_key, scratch);
+    }
+    return scratch;
+}
+/**
+ * @brief 驱动读，对齐时直接读入out_content，否则只有首尾IO单元经暂存区中转
  * 
  * @param offset 
  * @param out_content 
@@ -49,23 +73,53 @@ int sfs_driver_read(int offset, uint8_t *out_content, int size) {
     int      offset_aligned = SFS_ROUND_DOWN(offset, SFS_IO_SZ());
     int      bias           = offset - offset_aligned;
     int      size_aligned   = SFS_ROUND_UP((size + bias), SFS_IO_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
+    int      tail           = (bias + size) % SFS_IO_SZ();
+    int      head_len       = bias ? SFS_IO_SZ() - bias : 0;
+    int      iovcnt         = 0;
+    struct iovec iov[3];
+    uint8_t* scratch;
+
     // lseek(SFS_DRIVER(), offset_aligned, SEEK_SET);
     ddriver_seek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        // read(SFS_DRIVER(), cur, SFS_IO_SZ());
-        ddriver_read(SFS_DRIVER(), cur, SFS_IO_SZ());
-        cur          += SFS_IO_SZ();
-        size_aligned -= SFS_IO_SZ();   
+    if (bias == 0 && tail == 0) {
+        if (ddriver_read_units(SFS_DRIVER(), (char *)out_content, size) != size) {
+            return -SFS_ERROR_IO;
+        }
+        return SFS_ERROR_NONE;
+    }
+
+    if ((scratch = sfs_scratch_buf()) == NULL) {
+        return -SFS_ERROR_NOSPACE;
+    }
+    if (size_aligned == SFS_IO_SZ()) {
+        if (ddriver_read_units(SFS_DRIVER(), (char *)scratch, SFS_IO_SZ()) != SFS_IO_SZ()) {
+            return -SFS_ERROR_IO;
+        }
+        memcpy(out_content, scratch + bias, size);
+        return SFS_ERROR_NONE;
+    }
+
+    if (bias) {
+        iov[iovcnt].iov_base  = scratch;
+        iov[iovcnt++].iov_len = SFS_IO_SZ();
+    }
+    if (size - head_len - tail > 0) {
+        iov[iovcnt].iov_base  = out_content + head_len;
+        iov[iovcnt++].iov_len = size - head_len - tail;
+    }
+    if (tail) {
+        iov[iovcnt].iov_base  = scratch + SFS_IO_SZ();
+        iov[iovcnt++].iov_len = SFS_IO_SZ();
+    }
+    if (ddriver_readv(SFS_DRIVER(), iov, iovcnt) != size_aligned) {
+        return -SFS_ERROR_IO;
     }
-    memcpy(out_content, temp_content + bias, size);
-    free(temp_content);
+    memcpy(out_content, scratch + bias, head_len);
+    memcpy(out_content + size - tail, scratch + SFS_IO_SZ(), tail);
     return SFS_ERROR_NONE;
 }
 /**
- * @brief 驱动写
+ * @brief 驱动写，只有首尾未完整覆盖的IO单元经暂存区读出合并
  * 
  * @param offset 
  * @param in_content 
@@ -76,22 +130,62 @@ int sfs_driver_write(int offset, uint8_t *in_content, int size) {
     int      offset_aligned = SFS_ROUND_DOWN(offset, SFS_IO_SZ());
     int      bias           = offset - offset_aligned;
     int      size_aligned   = SFS_ROUND_UP((size + bias), SFS_IO_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    sfs_driver_read(offset_aligned, temp_content, size_aligned);
-    memcpy(temp_content + bias, in_content, size);
-    
+    int      tail_aligned   = offset_aligned + size_aligned - SFS_IO_SZ();
+    int      tail           = (bias + size) % SFS_IO_SZ();
+    int      head_len       = bias ? SFS_IO_SZ() - bias : 0;
+    int      iovcnt         = 0;
+    struct iovec iov[3];
+    uint8_t* scratch;
+
+    if (bias == 0 && tail == 0) {
+        ddriver_seek(SFS_DRIVER(), offset_aligned, SEEK_SET);
+        if (ddriver_write_units(SFS_DRIVER(), (char *)in_content, size) != size) {
+            return -SFS_ERROR_IO;
+        }
+        return SFS_ERROR_NONE;
+    }
+
+    if ((scratch = sfs_scratch_buf()) == NULL) {
+        return -SFS_ERROR_NOSPACE;
+    }
+    if (size_aligned == SFS_IO_SZ()) {
+        if (sfs_driver_read(offset_aligned, scratch, SFS_IO_SZ()) != SFS_ERROR_NONE) {
+            return -SFS_ERROR_IO;
+        }
+        memcpy(scratch + bias, in_content, size);
+        ddriver_seek(SFS_DRIVER(), offset_aligned, SEEK_SET);
+        if (ddriver_write_units(SFS_DRIVER(), (char *)scratch, SFS_IO_SZ()) != SFS_IO_SZ()) {
+            return -SFS_ERROR_IO;
+        }
+        return SFS_ERROR_NONE;
+    }
+
+    if (bias) {
+        if (sfs_driver_read(offset_aligned, scratch, SFS_IO_SZ()) != SFS_ERROR_NONE) {
+            return -SFS_ERROR_IO;
+        }
+        memcpy(scratch + bias, in_content, head_len);
+        iov[iovcnt].iov_base  = scratch;
+        iov[iovcnt++].iov_len = SFS_IO_SZ();
+    }
+    if (size - head_len - tail > 0) {
+        iov[iovcnt].iov_base  = in_content + head_len;
+        iov[iovcnt++].iov_len = size - head_len - tail;
+    }
+    if (tail) {
+        if (sfs_driver_read(tail_aligned, scratch + SFS_IO_SZ(), SFS_IO_SZ()) != SFS_ERROR_NONE) {
+            return -SFS_ERROR_IO;
+        }
+        memcpy(scratch + SFS_IO_SZ(), in_content + size - tail, tail);
+        iov[iovcnt].iov_base  = scratch + SFS_IO_SZ();
+        iov[iovcnt++].iov_len = SFS_IO_SZ();
+    }
+
     // lseek(SFS_DRIVER(), offset_aligned, SEEK_SET);
     ddriver_seek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        // write(SFS_DRIVER(), cur, SFS_IO_SZ());
-        ddriver_write(SFS_DRIVER(), cur, SFS_IO_SZ());
-        cur          += SFS_IO_SZ();
-        size_aligned -= SFS_IO_SZ();   
+    if (ddriver_writev(SFS_DRIVER(), iov, iovcnt) != size_aligned) {
+        return -SFS_ERROR_IO;
     }
-
-    free(temp_content);
     return SFS_ERROR_NONE;
 }
 /**